@@ -1 +1,467 @@
-//        
\ No newline at end of file
+// объявление функций и классов для вычисления арифметических выражений
+
+#ifndef __ARITHMETIC_H__
+#define __ARITHMETIC_H__
+
+#include "simd.h"
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// ошибка в записи выражения, pos - номер символа в исходной строке
+class TExpressionError : public std::runtime_error
+{
+  size_t pos;
+public:
+  TExpressionError(const std::string& msg, size_t p) : std::runtime_error(msg), pos(p) {}
+  size_t Position() const { return pos; }
+};
+
+enum TLexemeType
+{
+  LEX_NUMBER,
+  LEX_VARIABLE,
+  LEX_OPERATION,   // бинарная операция: + - * / ^ < <= == && || ? : или
+                   // зарегистрированная
+  LEX_UNARY_MINUS, // '-' или другая унарная операция в начале выражения
+                   // или после '('
+  LEX_FUNCTION,    // sin, cos, ln, exp
+  LEX_LEFT_BRACKET,
+  LEX_RIGHT_BRACKET
+};
+
+struct TLexeme
+{
+  TLexemeType type;
+  std::string text;
+  double value; // значение числа (только для LEX_NUMBER)
+  size_t pos;   // позиция первого символа в исходной строке
+};
+
+// байт-код: код операции занимает 1 байт, у OP_CONST, OP_VAR, OP_STORE,
+// OP_LOAD, OP_CALL1, OP_CALL2, OP_POWI и переходов за ним следует
+// 2-байтовый операнд (младший байт первым)
+//
+// Переходы бывают только вперед, их операнд - число байт, пропускаемых
+// после операнда. Условные операции переводятся так:
+//   c ? a : b  ->  c OP_JZ(L1) a OP_JMP(L2) L1: b L2:
+//   a && b     ->  a OP_JZ_OR_POP(L) b OP_BOOL L:
+//   a || b     ->  a OP_JNZ_OR_POP(L) b OP_BOOL L:
+// Истина - любое значение, не равное 0 (в том числе NaN); сравнения,
+// && и || дают 1 или 0.
+enum TOpCode
+{
+  OP_END,
+  OP_CONST, // операнд - индекс в таблице констант
+  OP_VAR,   // операнд - номер переменной в GetVariables()
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_NEG,
+  OP_SIN,
+  OP_COS,
+  OP_LN,
+  OP_EXP,
+  OP_STORE, // копирует вершину стека во временную ячейку, операнд - ее номер
+  OP_LOAD,  // кладет в стек значение временной ячейки
+  OP_CALL1, // зарегистрированная унарная операция, операнд - ее символ
+  OP_CALL2, // зарегистрированная бинарная операция, операнд - ее символ
+  OP_POW,   // x^y через pow
+  OP_POWI,  // x^n для целой константы n, операнд - n (со знаком)
+  OP_LT,    // a < b
+  OP_LE,    // a <= b
+  OP_EQ,    // a == b
+  OP_BOOL,  // 1, если вершина не равна 0, иначе 0
+  OP_JMP,
+  OP_JZ,        // снимает вершину и переходит, если она равна 0
+  OP_JZ_OR_POP, // вершина равна 0: она заменяется на +0 и выполняется
+                // переход, иначе вершина снимается
+  OP_JNZ_OR_POP // вершина не равна 0: она заменяется на 1 и выполняется
+                // переход, иначе вершина снимается
+};
+
+constexpr bool IsJump(unsigned char op)
+{
+  return op >= OP_JMP && op <= OP_JNZ_OR_POP;
+}
+
+constexpr bool HasOperand(unsigned char op)
+{
+  return op == OP_CONST || op == OP_VAR || op == OP_STORE || op == OP_LOAD
+    || op == OP_CALL1 || op == OP_CALL2 || op == OP_POWI || IsJump(op);
+}
+
+constexpr bool IsBinary(unsigned char op)
+{
+  return (op >= OP_ADD && op <= OP_DIV) || op == OP_CALL2 || op == OP_POW
+    || (op >= OP_LT && op <= OP_EQ);
+}
+
+// наибольший модуль показателя степени, для которого x^n вычисляется
+// умножениями, а не через pow
+const int POWI_LIMIT = 64;
+
+// x^n возведением в квадрат: множители берутся по битам |n| от младшего
+// к старшему; при n < 0 результат - 1 / x^|n|. Все способы вычисления
+// (интерпретатор, регистровая машина, машинный код, текст C++) выполняют
+// умножения именно в этом порядке.
+template <class T>
+inline T PowI(T x, int n)
+{
+  unsigned m = static_cast<unsigned>(n < 0 ? -n : n);
+  T result = 1;
+  T base = x;
+  while (m != 0)
+  {
+    if (m & 1)
+      result *= base;
+    m >>= 1;
+    if (m != 0)
+      base *= base;
+  }
+  return n < 0 ? 1 / result : result;
+}
+
+// изменение глубины стека после выполнения операции (для условных
+// переходов - если переход не выполнен)
+constexpr int StackEffect(unsigned char op)
+{
+  if (op == OP_CONST || op == OP_VAR || op == OP_LOAD)
+    return 1;
+  if (IsBinary(op) || (IsJump(op) && op != OP_JMP))
+    return -1;
+  return 0;
+}
+
+// сколько значений с вершины стека читает операция
+constexpr size_t Operands(unsigned char op)
+{
+  if (op == OP_CONST || op == OP_VAR || op == OP_LOAD || op == OP_JMP)
+    return 0;
+  return IsBinary(op) ? 2 : 1;
+}
+
+struct TProgram
+{
+  std::vector<unsigned char> code;  // заканчивается OP_END
+  std::vector<double> constants;    // без повторов
+  size_t temps;                     // число временных ячеек
+  size_t depth;                     // наибольшая глубина стека при вычислении
+
+  TProgram() : temps(0), depth(0) {}
+};
+
+// сборка байт-кода с таблицей констант без повторов
+// (повтор определяется по битовому представлению числа)
+class TProgramBuilder
+{
+  static const size_t NO_CONSTANT = static_cast<size_t>(-1);
+
+  TProgram prog;
+  std::map<unsigned long long, size_t> pool;
+  size_t depth; // глубина стека после уже добавленных операций
+  // смещение начала кода каждого значения в стеке
+  std::vector<size_t> starts;
+  bool jumps;
+  bool outputs; // вызывался Output
+  // смещение последней операции, если это OP_CONST, иначе NO_CONSTANT;
+  // нужно, чтобы Power мог убрать константу-показатель
+  size_t lastConstant;
+  bool lastConstantNew;     // константа добавлена в таблицу этой операцией
+  size_t depthBeforeConstant;
+
+  void Insert(size_t offset, unsigned char jump, size_t distance);
+
+public:
+  TProgramBuilder() : depth(0), jumps(false), outputs(false), lastConstant(NO_CONSTANT), lastConstantNew(false),
+    depthBeforeConstant(0) {}
+
+  void Emit(unsigned char op);
+  void Emit(unsigned char op, size_t operand);
+  void Constant(double value);
+  // возведение в степень: если показатель - только что добавленная целая
+  // константа не больше POWI_LIMIT по модулю, она заменяется на OP_POWI
+  void Power();
+  // c ? a : b: код c, a и b уже добавлен подряд; перед a вставляется
+  // OP_JZ, перед b - OP_JMP
+  void Select();
+  // a && b (OP_JZ_OR_POP) или a || b (OP_JNZ_OR_POP): код a и b, вместе
+  // с OP_BOOL после b, уже добавлен; перед b вставляется переход
+  void ShortCircuit(unsigned char jump);
+  // выделяет новую временную ячейку и возвращает ее номер
+  size_t Temp() { return prog.temps++; }
+  // значение на вершине стека - результат очередного выражения программы
+  // из нескольких выражений (см. TExprTree::Emit): дальше код строится
+  // так, как будто его уже сняли; возвращает смещение конца кода; depth
+  // такой программы - оценка сверху
+  size_t Output();
+  // добавляет OP_END и отдает программу, построитель становится пустым
+  TProgram Finish();
+};
+
+// наибольшая глубина стека при вычислении байт-кода; бросает
+// std::logic_error, если операции не хватает операндов, переход ведет
+// не на начало операции, по разным путям глубина стека в одном месте
+// разная или в конце в стеке не одно значение
+size_t StackDepth(const unsigned char* code);
+
+// вычисление байт-кода, vars - значения переменных по номерам,
+// temps - число временных ячеек программы, depth - TProgram::depth
+// (0 - вычислить по байт-коду); стек выделяется один раз ровно
+// на depth значений, и дальше переполнение не проверяется.
+// T - float, double или long double: все операции выполняются в T,
+// константы приводятся к T из double, зарегистрированные операции
+// вызываются для значения, приведенного к double.
+template <class T>
+T Execute(const unsigned char* code, const double* constants, const T* vars,
+  size_t temps = 0, size_t depth = 0);
+
+// Целочисленная программа: константы - целые числа, представимые в int64
+// (не -0), операции - только OP_VAR, OP_CONST, OP_ADD, OP_SUB, OP_MUL,
+// OP_NEG, OP_POWI с неотрицательным показателем, OP_STORE и OP_LOAD.
+// Значение такой программы от целых аргументов - целое число, и его
+// можно вычислить точно, если ни один шаг не выходит за int64.
+bool IsIntegerProgram(const TProgram& prog);
+
+// вычисление целочисленной программы в int64; constants - константы
+// программы, переведенные в int64; возвращает false, если на каком-то
+// шаге было переполнение (тогда result не определен)
+bool ExecuteInteger(const unsigned char* code, const long long* constants, const long long* vars,
+  size_t temps, size_t depth, long long& result);
+
+// трехадресная команда регистровой машины: r[dst] = r[a] op r[b]
+// (у унарных операций b не используется, кроме OP_POWI: там b - показатель);
+// OP_STORE - копирование r[dst] = r[a]; у переходов dst - индекс команды,
+// к которой выполняется переход, условие проверяется в r[a]
+struct TInstruction
+{
+  unsigned char op;     // TOpCode
+  unsigned char symbol; // символ операции для OP_CALL1 и OP_CALL2
+  unsigned short dst;
+  unsigned short a;
+  unsigned short b;
+};
+
+// регистры: сначала переменные, затем константы, затем временные
+struct TRegisterProgram
+{
+  std::vector<TInstruction> code;
+  size_t variables;
+  size_t constants;
+  size_t registers; // всего, вместе с временными
+  unsigned short result;
+};
+
+// перевод байт-кода в команды регистровой машины: значения переменных и
+// констант берутся прямо из их регистров, временные регистры переиспользуются
+TRegisterProgram TranslateToRegisters(const TProgram& prog, size_t varCount);
+double ExecuteRegisters(const TRegisterProgram& prog, const double* constants, const double* vars);
+
+enum TOptimizeFlags
+{
+  OPT_FOLD = 1, // свертка констант и удаление тождественных операций
+  OPT_CSE = 2   // общие подвыражения вычисляются один раз
+};
+
+struct TOptimizeStats
+{
+  size_t nodesBefore; // узлов (операций байт-кода) до оптимизации
+  size_t nodesAfter;
+  size_t shared;      // узлов, замененных ранее построенным таким же узлом
+};
+
+enum TEngine
+{
+  ENGINE_STACK,
+  ENGINE_REGISTER,
+  ENGINE_JIT      // машинный код x86-64, см. jit.h
+};
+
+class TJitCode;
+
+enum TAssociativity
+{
+  ASSOC_LEFT,
+  ASSOC_RIGHT
+};
+
+// операция из таблицы операций TPostfix; op == OP_END - символ не операция
+struct TOperator
+{
+  unsigned char op;   // код операции байт-кода; у && и || - код перехода,
+                      // у '?' и ':' - OP_JZ
+  int priority;       // больше - выполняется раньше
+  TAssociativity associativity;
+  double (*unary)(double);            // для OP_CALL1
+  double (*binary)(double, double);   // для OP_CALL2
+};
+
+// таблица операций, индекс - код символа
+struct TOperatorTable
+{
+  TOperator binary[256];
+  TOperator unary[256];
+};
+
+class TPostfix
+{
+  std::string infix;
+  std::vector<TLexeme> lexemes;
+  // парные скобки: для индекса '(' - индекс ')', и наоборот;
+  // для остальных лексем - NO_PAIR
+  std::vector<size_t> pairs;
+  std::vector<size_t> postfix; // индексы лексем в постфиксном порядке
+  std::vector<std::string> variables;
+  TProgram program;
+  TEngine engine;
+  static TOperatorTable operators;
+  TRegisterProgram registerProgram;
+  // машинный код не меняется после генерации и общий у копий выражения
+  std::shared_ptr<const TJitCode> jit;
+  // IsIntegerProgram(program) и константы программы в int64
+  bool integer;
+  std::vector<long long> integerConstants;
+
+  void Parse();
+  void MatchBrackets();
+  void ToPostfix();
+  void Compile();
+  void PrepareInteger();
+
+public:
+  static const size_t NO_PAIR = static_cast<size_t>(-1);
+
+  // результат проверки корректности: при ошибке pos - номер символа
+  struct TCheckResult
+  {
+    bool ok;
+    size_t pos;
+    const char* message;
+  };
+
+  // Новая операция - один символ, не буква, не цифра и не '_', '.', '(',
+  // ')', '=', '&', '|', пробел. Унарные операции, как и унарный минус,
+  // допустимы только в начале выражения или после '('. Встроенные
+  // операции заменить нельзя. Сравнения, логические и условная операции
+  // имеют приоритет меньше 1, поэтому выполняются после любой
+  // зарегистрированной.
+  // Таблица не защищена от одновременного изменения: операции
+  // регистрируются до разбора выражений, а выражения, в которых операция
+  // уже используется, ссылаются на нее по символу. Бросает
+  // std::invalid_argument при недопустимом символе или priority < 1.
+  static void RegisterOperator(char symbol, int priority, TAssociativity associativity,
+    double (*binary)(double, double));
+  static void RegisterOperator(char symbol, int priority, double (*unary)(double));
+  static const TOperator& BinaryOperator(unsigned char symbol) { return operators.binary[symbol]; }
+  static const TOperator& UnaryOperator(unsigned char symbol) { return operators.unary[symbol]; }
+
+  // проверка без разбора выражения на лексемы и без выделения памяти
+  static TCheckResult Check(const char* expr, size_t len);
+  static TCheckResult Check(const std::string& expr) { return Check(expr.c_str(), expr.size()); }
+
+  // ошибка в строке многострочного текста, line и column считаются с 1
+  struct TLineError
+  {
+    size_t line;
+    size_t column;
+    const char* message;
+  };
+
+  struct TLinesCheckResult
+  {
+    size_t lines;
+    std::vector<TLineError> errors;
+  };
+
+  // проверка текста, в котором каждая непустая строка - отдельное выражение;
+  // текст делится на части по границам строк, каждая проверяется в своем
+  // потоке (threads == 0 - по числу ядер)
+  static TLinesCheckResult CheckLines(const char* text, size_t len, unsigned threads = 0);
+
+  // разбирает и проверяет выражение, при ошибке бросает TExpressionError
+  explicit TPostfix(const std::string& expr);
+
+  const std::string& GetInfix() const { return infix; }
+  std::string GetPostfix() const;
+  const std::vector<TLexeme>& GetLexemes() const { return lexemes; }
+  const std::vector<std::string>& GetVariables() const { return variables; }
+
+  // индекс парной скобки для лексемы i (NO_PAIR, если i - не скобка)
+  size_t GetPair(size_t i) const { return pairs[i]; }
+  const std::vector<size_t>& GetPairs() const { return pairs; }
+  // текст внутри скобок, которым принадлежит лексема-скобка i
+  std::string GetSubexpression(size_t i) const;
+
+  const TProgram& GetProgram() const { return program; }
+
+  // перестраивает байт-код через дерево выражения с заданными проходами
+  TOptimizeStats Optimize(unsigned flags = OPT_FOLD);
+
+  // способ вычисления в Calculate; по умолчанию - стековая машина;
+  // если для выражения нельзя получить машинный код, ENGINE_JIT
+  // заменяется на ENGINE_STACK
+  void SetEngine(TEngine e);
+  TEngine GetEngine() const { return engine; }
+  const TRegisterProgram& GetRegisterProgram() const { return registerProgram; }
+
+  // примерный объем памяти, занимаемый выражением, в байтах
+  size_t MemorySize() const;
+
+  // values[i] - значение переменной GetVariables()[i]; вычисление
+  // в double выбранным способом (точное целочисленное - CalculateExact)
+  double Calculate(const double* values) const;
+  double Calculate(const std::map<std::string, double>& values) const;
+  // если выражение целочисленное (IsInteger) и все значения - целые
+  // числа в пределах int64 (не -0), выражение вычисляется в int64 точно,
+  // и результат округляется до double один раз; при переполнении,
+  // а также для остальных выражений и значений - то же, что Calculate.
+  // Знак нулевого результата тот же, что у Calculate. За пределами 2^53
+  // результат может отличаться от Calculate, у которого округляются до
+  // double все промежуточные значения, поэтому такое вычисление
+  // выбирается явно
+  double CalculateExact(const double* values) const;
+  // выражение целочисленное (см. IsIntegerProgram); зависит от
+  // программы, поэтому может измениться после Optimize (например,
+  // свертка убирает x/1)
+  bool IsInteger() const { return integer; }
+  // точное значение целочисленного выражения от целых значений
+  // переменных; false, если выражение не целочисленное или при
+  // вычислении было переполнение int64
+  bool CalculateInteger(const long long* values, long long& result) const;
+
+  // значение выражения и его производные по переменным с номерами
+  // wrt[0..count-1] в GetVariables() за один проход (см. dual.h):
+  // gradient[j] - производная по переменной wrt[j]; значение то же,
+  // что у Calculate<double>; бросает std::out_of_range при неверном номере
+  double CalculateGradient(const double* values, const size_t* wrt, size_t count, double* gradient) const;
+  // производные по всем переменным, gradient - GetVariables().size()
+  // значений
+  double CalculateGradient(const double* values, double* gradient) const;
+
+  // вычисление в типе T (float, double или long double) стековой машиной
+  // при любом SetEngine (см. Execute); для double результат тот же,
+  // что у Calculate выше
+  template <class T>
+  T Calculate(const T* values) const;
+
+  // columns[i] - значения переменной GetVariables()[i] в строках
+  // 0..rows-1, в result[k] записывается значение выражения в строке k;
+  // строки вычисляются блоками (см. batch.h) при любом SetEngine;
+  // accuracy - точность sin, cos, ln и exp, при MATH_LIBM результаты
+  // совпадают с Calculate
+  void CalculateBatch(const double* const* columns, size_t rows, double* result,
+    TMathAccuracy accuracy = MATH_LIBM) const;
+  // то же во float: в векторе вдвое больше значений; при MATH_LIBM
+  // результаты совпадают с Calculate<float>, при других точностях sin,
+  // cos, ln и exp вычисляются ядрами double, и результат округляется
+  // до float
+  void CalculateBatch(const float* const* columns, size_t rows, float* result,
+    TMathAccuracy accuracy = MATH_LIBM) const;
+};
+
+#endif
@@ -0,0 +1,91 @@
+// вычисление байт-кода сразу для многих наборов значений переменных
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "arithmetic.h"
+#include "pool.h"
+#include "simd.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Значения переменных лежат по столбцам: columns[i][k] - значение
+// переменной i в строке k. Строки обрабатываются блоками по BATCH_BLOCK:
+// каждая операция байт-кода выбирается один раз на блок и выполняется
+// в цикле по его строкам, элемент стека и временная ячейка - массив на
+// блок строк.
+//
+// Условная операция, у которой в блоке все условия одинаковы, вычисляет
+// только выбранную ветвь. Если условия разные, вычисляются обе ветви для
+// всех строк блока, и результат каждой строки берется из ее ветви по маске
+// условия; зарегистрированные операции в такой ветви вызываются и для
+// строк, где ветвь не выбрана.
+const size_t BATCH_BLOCK = 256;
+
+// result[k] - значение выражения в строке k, k < rows; сложение,
+// вычитание, умножение, деление и смена знака выполняются ядрами уровня
+// level, sin, cos, ln и exp - ядрами точности accuracy (см. simd.h);
+// результат от уровня не зависит
+void ExecuteBatch(const TProgram& prog, const double* const* columns, size_t rows, double* result,
+  TSimdLevel level = SimdSupported(), TMathAccuracy accuracy = MATH_LIBM);
+// то же для float (см. TPostfix::CalculateBatch): результат от уровня
+// тоже не зависит
+void ExecuteBatch(const TProgram& prog, const float* const* columns, size_t rows, float* result,
+  TSimdLevel level = SimdSupported(), TMathAccuracy accuracy = MATH_LIBM);
+
+// выражение для вычисления на пуле: columns - по GetVariables() выражения,
+// result - rows значений
+struct TBatchJob
+{
+  const TPostfix* expr;
+  const double* const* columns;
+  double* result;
+};
+
+// строк в одной задаче пула
+const size_t BATCH_TASK_ROWS = 16 * BATCH_BLOCK;
+
+// Строки каждого выражения делятся на задачи по BATCH_TASK_ROWS, задачи
+// всех выражений выполняются пулом; у разных выражений разная стоимость,
+// и простаивающие исполнители перехватывают задачи у занятых. Результаты
+// те же, что у ExecuteBatch для каждого выражения.
+void ExecuteBatch(TThreadPool& pool, const std::vector<TBatchJob>& jobs, size_t rows,
+  TMathAccuracy accuracy = MATH_LIBM);
+
+// Несколько выражений над общими переменными, собранные в одну программу:
+// каждый блок строк проходит через все выражения сразу, поэтому значения
+// переменных блока читаются из памяти один раз, а одинаковые
+// подвыражения разных выражений (с OPT_CSE в flags) вычисляются один раз
+// и берутся из временных ячеек. Без OPT_FOLD результаты совпадают
+// с CalculateBatch каждого выражения.
+class TFusedBatch
+{
+  std::vector<std::string> variables; // всех выражений, в порядке появления
+  TProgram program;
+  std::vector<size_t> ends;           // концы кода выражений в program
+  TOptimizeStats stats;
+
+public:
+  // бросает std::invalid_argument, если выражений нет
+  explicit TFusedBatch(const std::vector<const TPostfix*>& exprs, unsigned flags = OPT_CSE);
+
+  const std::vector<std::string>& GetVariables() const { return variables; }
+  size_t Outputs() const { return ends.size(); }
+  const TProgram& GetProgram() const { return program; }
+  const std::vector<size_t>& GetEnds() const { return ends; }
+  // узлы всех выражений до и после объединения
+  const TOptimizeStats& Stats() const { return stats; }
+
+  // columns[i] - значения переменной GetVariables()[i] в строках
+  // 0..rows-1, в results[j][k] записывается значение выражения j
+  // в строке k
+  void Calculate(const double* const* columns, size_t rows, double* const* results,
+    TMathAccuracy accuracy = MATH_LIBM) const;
+  // то же, строки делятся на задачи по BATCH_TASK_ROWS для пула
+  void Calculate(TThreadPool& pool, const double* const* columns, size_t rows, double* const* results,
+    TMathAccuracy accuracy = MATH_LIBM) const;
+};
+
+#endif
@@ -0,0 +1,112 @@
+// кэш скомпилированных выражений
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "arithmetic.h"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Кэш TPostfix по тексту выражения с вытеснением давно не использованных.
+// Ключ - нормализованный текст (без лишних пробелов), поэтому "a+b" и
+// "a + b" дают одно выражение. Размер ограничен суммой MemorySize()
+// выражений и длин ключей. Выражение отдается через shared_ptr и остается
+// действительным после вытеснения из кэша.
+class TPostfixCache
+{
+public:
+  struct TStats
+  {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes;
+  };
+
+  // optimizeFlags - проходы TPostfix::Optimize для новых выражений
+  explicit TPostfixCache(size_t maxBytes, unsigned optimizeFlags = 0);
+
+  // при отсутствии в кэше выражение компилируется; некорректное
+  // выражение не кэшируется, бросается TExpressionError
+  std::shared_ptr<const TPostfix> Get(const std::string& expr);
+
+  // поиск по уже нормализованному тексту, при отсутствии - пустой указатель
+  std::shared_ptr<const TPostfix> Find(const std::string& key);
+  // добавляет выражение; если ключ уже есть, возвращает имеющееся
+  std::shared_ptr<const TPostfix> Insert(const std::string& key, const std::shared_ptr<const TPostfix>& expr);
+  // компиляция выражения с проходами оптимизации этого кэша
+  std::shared_ptr<const TPostfix> Compile(const std::string& expr) const;
+
+  TStats GetStats() const { return stats; }
+  size_t MaxBytes() const { return maxBytes; }
+  void Clear();
+
+  // пробелы удаляются везде, кроме промежутка между двумя именами или
+  // числами, между двумя знаками операций и внутри незаконченного
+  // порядка числа ("2e +3"), где остается один пробел
+  static std::string Normalize(const std::string& expr);
+  // FNV-1a, 64 бита
+  static unsigned long long Hash(const char* s, size_t len);
+
+private:
+  struct TKeyHash
+  {
+    size_t operator()(const std::string& key) const
+    {
+      return static_cast<size_t>(Hash(key.data(), key.size()));
+    }
+  };
+
+  struct TEntry
+  {
+    std::string key;
+    std::shared_ptr<const TPostfix> expr;
+    size_t bytes;
+  };
+
+  // начало списка - последнее использованное выражение
+  std::list<TEntry> order;
+  std::unordered_map<std::string, std::list<TEntry>::iterator, TKeyHash> index;
+  size_t maxBytes;
+  unsigned flags;
+  TStats stats;
+
+  void Evict();
+};
+
+// Потокобезопасный кэш: ключи распределяются по сегментам по хэшу,
+// у каждого сегмента свой TPostfixCache и свой мьютекс. Компиляция при
+// промахе идет вне блокировки. Скомпилированные выражения неизменяемы и
+// разделяются между потоками через счетчик ссылок shared_ptr.
+class TShardedPostfixCache
+{
+  struct TShard
+  {
+    std::mutex lock;
+    TPostfixCache cache;
+
+    TShard(size_t maxBytes, unsigned flags) : cache(maxBytes, flags) {}
+  };
+
+  std::vector<std::unique_ptr<TShard> > shards;
+
+public:
+  // shards округляется вверх до степени двойки, maxBytes делится поровну
+  TShardedPostfixCache(size_t maxBytes, size_t shards = 16, unsigned optimizeFlags = 0);
+
+  std::shared_ptr<const TPostfix> Get(const std::string& expr);
+
+  size_t ShardCount() const { return shards.size(); }
+  // сумма счетчиков всех сегментов
+  TPostfixCache::TStats GetStats() const;
+  void Clear();
+};
+
+#endif
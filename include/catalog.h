@@ -0,0 +1,101 @@
+// файл скомпилированных выражений
+
+#ifndef __CATALOG_H__
+#define __CATALOG_H__
+
+#include "arithmetic.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Формат файла (версия 1, порядок байт - от младшего к старшему):
+//   TCatalogHeader
+//   TCatalogEntry[count]
+//   данные выражений: исходный текст, байт-код, имена переменных
+//   (строки с нулем в конце), таблица констант и смещения имен
+//   переменных (выровнены на 8 байт)
+// Все ссылки - смещения от начала файла, поэтому файл можно использовать
+// прямо из отображенной в память области по любому адресу.
+// Зарегистрированные операции (TPostfix::RegisterOperator) записываются
+// в байт-код символом: при загрузке они должны быть зарегистрированы так
+// же, как при сохранении.
+
+struct TCatalogHeader
+{
+  char magic[8];         // "ARITHBC"
+  uint32_t version;
+  uint32_t count;        // число выражений
+  uint64_t entries;      // смещение массива TCatalogEntry
+  uint64_t size;         // размер файла
+};
+
+struct TCatalogEntry
+{
+  uint64_t source;       // исходный текст
+  uint64_t code;         // байт-код, заканчивается OP_END
+  uint64_t constants;    // double[constantCount]
+  uint64_t variables;    // uint64_t[variableCount] - смещения имен
+  uint32_t codeSize;
+  uint32_t constantCount;
+  uint32_t variableCount;
+  uint32_t temps;        // ровно столько ячеек, сколько использует код
+  uint32_t depth;        // ровно StackDepth(code)
+  uint32_t reserved;
+};
+
+class TCompiledCatalog
+{
+  const unsigned char* base;
+  size_t size;
+  const TCatalogEntry* entries;
+  size_t count;
+  // результат проверки каждого выражения (ENTRY_*)
+  std::unique_ptr<std::atomic<unsigned char>[]> checked;
+  // отображение файла в память (если каталог открыт из файла)
+  void* mapping;
+  size_t mappedSize;
+#ifdef _WIN32
+  void* file;
+  void* section;
+#endif
+
+  enum { ENTRY_UNCHECKED, ENTRY_VALID, ENTRY_INVALID };
+
+  void Attach(const unsigned char* data, size_t len);
+  void Unmap();
+  // бросает std::runtime_error, если выражение i повреждено
+  void Check(size_t i) const;
+
+  TCompiledCatalog(const TCompiledCatalog&);
+  TCompiledCatalog& operator=(const TCompiledCatalog&);
+
+public:
+  static const uint32_t VERSION = 1;
+
+  // образ файла для набора выражений
+  static std::vector<unsigned char> Serialize(const std::vector<const TPostfix*>& exprs);
+  static void Save(const std::string& path, const std::vector<const TPostfix*>& exprs);
+
+  // отображает файл в память; бросает std::runtime_error, если файл
+  // нельзя открыть или поврежден его заголовок. Выражения проверяются
+  // при первом обращении: Source, Variable и Calculate для поврежденного
+  // выражения бросают std::runtime_error
+  explicit TCompiledCatalog(const std::string& path);
+  // каталог поверх готового образа; память должна быть выровнена на 8
+  // байт и жить дольше каталога
+  TCompiledCatalog(const void* data, size_t len);
+  ~TCompiledCatalog();
+
+  size_t Count() const { return count; }
+  const char* Source(size_t i) const;
+  size_t VariableCount(size_t i) const { return entries[i].variableCount; }
+  const char* Variable(size_t i, size_t k) const;
+  // values[k] - значение переменной Variable(i, k)
+  double Calculate(size_t i, const double* values) const;
+};
+
+#endif
@@ -0,0 +1,23 @@
+// вычисление байт-кода вместе с производными (прямой режим, дуальные числа)
+
+#ifndef __DUAL_H__
+#define __DUAL_H__
+
+#include "arithmetic.h"
+
+#include <cstddef>
+
+// Каждое значение в стеке и во временной ячейке несет вектор производных
+// по count выбранным переменным, и производные вычисляются за тот же
+// проход, что и значение. Значение совпадает с Execute.
+//
+// Условные операции берут производную выбранной ветви; у сравнений, &&,
+// || и OP_BOOL производная 0. У x^y слагаемое по показателю учитывается
+// только там, где производная показателя не 0, поэтому x^2 при x < 0
+// не дает NaN. Производная зарегистрированной операции неизвестна и
+// оценивается центральной разностью по каждому ее аргументу.
+//
+// wrt[j] - номер переменной в vars, gradient[j] - производная по ней.
+double ExecuteDual(const TProgram& prog, const double* vars, const size_t* wrt, size_t count, double* gradient);
+
+#endif
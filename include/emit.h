@@ -0,0 +1,47 @@
+// перевод выражений в исходный текст C++
+
+#ifndef __EMIT_H__
+#define __EMIT_H__
+
+#include "arithmetic.h"
+
+#include <string>
+#include <vector>
+
+// Заголовочный файл C++ из именованных выражений. Для выражения name
+// создаются структура name_vars с полями-переменными и функция
+//   inline double name(const name_vars& v)
+// Функция выполняет операции байт-кода в том же порядке, что и
+// интерпретатор: каждая операция - отдельная константа с промежуточным
+// результатом, поэтому без -ffast-math (и с -ffp-contract=off) результат
+// совпадает с TPostfix::Calculate до бита. Ветви условных операций -
+// блоки if и else, как и в байт-коде, вычисляется только одна из них.
+class TCppEmitter
+{
+  std::vector<std::string> names;
+  std::vector<std::string> bodies;
+  bool bitCast; // в заголовке нужен <bit>
+
+public:
+  TCppEmitter() : bitCast(false) {}
+
+  // бросает std::invalid_argument, если имя функции или переменной не
+  // идентификатор C++, функция с таким именем уже есть, name или
+  // name_vars совпадает с именем функции или структуры, созданных
+  // раньше, или в выражении
+  // есть зарегистрированная операция (ее реализация известна только
+  // во время выполнения)
+  void Add(const std::string& name, const TPostfix& expr);
+
+  size_t Count() const { return names.size(); }
+  // текст заголовка: guard - имя макроса защиты от повторного включения,
+  // функции помещаются в пространство имен ns
+  std::string Header(const std::string& guard, const std::string& ns) const;
+};
+
+// запись числа в виде литерала C++, который читается в то же значение;
+// NaN, отличный от quiet_NaN() знаком или содержимым, записывается
+// через std::bit_cast (C++20, заголовок <bit>)
+std::string CppLiteral(double value);
+
+#endif
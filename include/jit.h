@@ -0,0 +1,52 @@
+// перевод байт-кода в машинный код x86-64
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "arithmetic.h"
+
+#include <cstddef>
+#include <memory>
+
+// машинный код генерируется только для x86-64 с соглашением System V
+// (Linux, macOS); на остальных платформах Compile всегда возвращает
+// пустой указатель и выражения вычисляет интерпретатор
+#if defined(__x86_64__) && !defined(_WIN32)
+#define ARITHMETIC_JIT 1
+#endif
+
+// Значения стека байт-кода лежат в регистрах xmm0..xmm14 (i-й элемент
+// стека - в xmm i), переменные и константы читаются прямо из памяти,
+// временные ячейки находятся в кадре стека. Перед вызовом sin, cos, ln,
+// exp и зарегистрированных операций регистры под аргументами сохраняются
+// в кадр; адрес зарегистрированной операции берется в момент генерации.
+class TJitCode
+{
+public:
+  typedef double (*TFunction)(const double* vars, const double* constants);
+
+private:
+  void* memory;
+  size_t size;
+  TFunction function;
+
+  TJitCode(void* mem, size_t sz);
+  TJitCode(const TJitCode&);
+  TJitCode& operator=(const TJitCode&);
+
+public:
+  // наибольшая глубина стека, которая помещается в регистры
+  static const size_t MAX_DEPTH = 15;
+
+  static bool Supported();
+  // пустой указатель, если платформа не поддерживается, в программе есть
+  // неизвестная операция или стек глубже MAX_DEPTH
+  static std::shared_ptr<const TJitCode> Compile(const TProgram& prog);
+
+  ~TJitCode();
+
+  size_t Size() const { return size; }
+  double Run(const double* vars, const double* constants) const { return function(vars, constants); }
+};
+
+#endif
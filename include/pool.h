@@ -0,0 +1,74 @@
+// пул потоков с перехватом задач
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Задачи одного вызова Run - номера 0..count-1, перед запуском они делятся
+// на равные непрерывные части по очередям исполнителей. Исполнитель берет
+// задачи из начала своей очереди, а когда она пуста - перехватывает из
+// конца чужой, поэтому более дорогие задачи одной части не оставляют
+// остальные ядра без работы. Вызывающий поток - исполнитель 0, потоки пула
+// создаются один раз и между вызовами Run ждут.
+class TThreadPool
+{
+public:
+  typedef void (*TTask)(void* context, size_t index);
+
+private:
+  struct TQueue
+  {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+  };
+
+  std::vector<std::unique_ptr<TQueue> > queues;
+  std::vector<std::thread> threads;
+
+  std::mutex lock;
+  std::condition_variable start;
+  std::condition_variable done;
+  unsigned long long generation; // номер вызова Run
+  bool stop;
+  TTask task;
+  void* context;
+  std::atomic<size_t> remaining;
+  std::atomic<size_t> steals;
+  std::exception_ptr error;
+
+  TThreadPool(const TThreadPool&);
+  TThreadPool& operator=(const TThreadPool&);
+
+  bool Pop(unsigned worker, size_t& index);
+  bool Steal(unsigned worker, size_t& index);
+  void Work(unsigned worker);
+  void Wait(unsigned worker);
+
+public:
+  // workers - число исполнителей вместе с вызывающим потоком
+  // (0 - по числу ядер)
+  explicit TThreadPool(unsigned workers = 0);
+  ~TThreadPool();
+
+  unsigned Workers() const { return static_cast<unsigned>(queues.size()); }
+
+  // выполняет task(context, i) для всех i < count и возвращается, когда
+  // выполнены все; если задачи бросали исключения, после выполнения
+  // остальных бросается первое из них. Run не вызывается из нескольких
+  // потоков одновременно и из самих задач.
+  void Run(size_t count, TTask task, void* context);
+
+  // сколько задач последнего Run выполнено не своим исполнителем
+  size_t Steals() const { return steals; }
+};
+
+#endif
@@ -0,0 +1,88 @@
+// векторные ядра арифметических операций для вычисления блоками строк
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <cstddef>
+
+// векторные ядра собираются только для x86-64 компиляторами GCC и Clang
+// (набор команд задается атрибутом функции, а не ключом компиляции); на
+// остальных платформах доступны только скалярные
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ARITHMETIC_SIMD 1
+#endif
+
+enum TSimdLevel
+{
+  SIMD_SCALAR,
+  SIMD_SSE2,
+  SIMD_AVX2,
+  SIMD_AVX512
+};
+
+// Ядро выполняет операцию над n значениями: y[k] = y[k] op x[k] или
+// x[k] = -x[k]. Массивы могут быть не выровнены, хвост короче ширины
+// вектора обрабатывается скалярно. Каждая операция - одна операция IEEE
+// над double, поэтому результаты всех уровней совпадают побитно, включая
+// знак нуля; не определено только, полезные данные какого из двух
+// NaN-операндов получит результат.
+struct TSimdKernels
+{
+  TSimdLevel level;
+  void (*add)(double* y, const double* x, size_t n);
+  void (*sub)(double* y, const double* x, size_t n);
+  void (*mul)(double* y, const double* x, size_t n);
+  void (*div)(double* y, const double* x, size_t n);
+  void (*neg)(double* x, size_t n);
+};
+
+// те же ядра для float: в векторе той же ширины вдвое больше значений
+struct TSimdFloatKernels
+{
+  TSimdLevel level;
+  void (*add)(float* y, const float* x, size_t n);
+  void (*sub)(float* y, const float* x, size_t n);
+  void (*mul)(float* y, const float* x, size_t n);
+  void (*div)(float* y, const float* x, size_t n);
+  void (*neg)(float* x, size_t n);
+};
+
+// точность sin, cos, ln и exp при вычислении блоками
+enum TMathAccuracy
+{
+  MATH_LIBM,    // функции стандартной библиотеки, те же, что в Calculate
+  MATH_PRECISE, // многочлены, ошибка меньше 1 ulp
+  MATH_FAST     // многочлены с более простой сборкой результата, ошибка до 4 ulp
+};
+
+// Ядро заменяет n значений x[k] на f(x[k]). Многочлены вычисляются для
+// аргументов обычного диапазона (|x| <= 708 у exp, положительные
+// нормализованные числа у ln, |x| <= 1e5 у sin и cos); остальные значения,
+// включая NaN и бесконечности, передаются функции стандартной библиотеки.
+// Скалярный и векторный варианты одной точности выполняют одни и те же
+// операции IEEE (без FMA), поэтому их результаты совпадают побитно.
+struct TMathKernels
+{
+  TMathAccuracy accuracy;
+  TSimdLevel level; // уровень, на котором написано ядро
+  void (*sin)(double* x, size_t n);
+  void (*cos)(double* x, size_t n);
+  void (*ln)(double* x, size_t n);
+  void (*exp)(double* x, size_t n);
+};
+
+// наибольший уровень, который поддерживают процессор и сборка;
+// определяется при первом вызове
+TSimdLevel SimdSupported();
+
+// ядра уровня level; бросает std::invalid_argument, если уровень
+// не поддерживается
+const TSimdKernels& SimdKernels(TSimdLevel level);
+const TSimdFloatKernels& SimdFloatKernels(TSimdLevel level);
+
+// ядра заданной точности не выше уровня level: многочлены написаны для
+// AVX2 (на AVX-512 используются они же) и скалярно; бросает
+// std::invalid_argument, если уровень не поддерживается
+const TMathKernels& MathKernels(TMathAccuracy accuracy, TSimdLevel level);
+
+#endif
@@ -1,9 +1,104 @@
-//     
-//   : 
-// -  , 
-// -  , 
-// -    ( )
-// -   , 
-// -     
-// -  
-//        
\ No newline at end of file
+// объявление и реализация шаблонного стека
+// стек поддерживает операции:
+// - вставка элемента,
+// - извлечение элемента,
+// - просмотр верхнего элемента (без удаления)
+// - проверка на пустоту,
+// - получение количества элементов в стеке
+// - очистка стека
+// при вставке в полный стек должна перевыделяться память
+
+#ifndef __STACK_H__
+#define __STACK_H__
+
+#include <cstddef>
+#include <stdexcept>
+
+template <class T>
+class TStack
+{
+  T* pMem;
+  size_t capacity;
+  size_t count;
+
+  void Grow(size_t newCapacity)
+  {
+    T* p = new T[newCapacity];
+    for (size_t i = 0; i < count; i++)
+      p[i] = pMem[i];
+    delete[] pMem;
+    pMem = p;
+    capacity = newCapacity;
+  }
+
+public:
+  explicit TStack(size_t cap = 10) : capacity(cap > 0 ? cap : 1), count(0)
+  {
+    pMem = new T[capacity];
+  }
+
+  TStack(const TStack& s) : capacity(s.capacity), count(s.count)
+  {
+    pMem = new T[capacity];
+    for (size_t i = 0; i < count; i++)
+      pMem[i] = s.pMem[i];
+  }
+
+  ~TStack()
+  {
+    delete[] pMem;
+  }
+
+  TStack& operator=(const TStack& s)
+  {
+    if (this != &s)
+    {
+      T* p = new T[s.capacity];
+      for (size_t i = 0; i < s.count; i++)
+        p[i] = s.pMem[i];
+      delete[] pMem;
+      pMem = p;
+      capacity = s.capacity;
+      count = s.count;
+    }
+    return *this;
+  }
+
+  void Push(const T& val)
+  {
+    if (count == capacity)
+      Grow(capacity * 2);
+    pMem[count++] = val;
+  }
+
+  T Pop()
+  {
+    if (count == 0)
+      throw std::out_of_range("pop from empty stack");
+    return pMem[--count];
+  }
+
+  T& Top()
+  {
+    if (count == 0)
+      throw std::out_of_range("top of empty stack");
+    return pMem[count - 1];
+  }
+
+  const T& Top() const
+  {
+    if (count == 0)
+      throw std::out_of_range("top of empty stack");
+    return pMem[count - 1];
+  }
+
+  bool IsEmpty() const { return count == 0; }
+
+  size_t Size() const { return count; }
+
+  size_t Capacity() const { return capacity; }
+
+  void Clear() { count = 0; }
+};
+
+#endif
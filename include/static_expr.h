@@ -0,0 +1,688 @@
+// разбор выражения из строкового литерала во время компиляции
+//
+//   auto f = arith::compile<"x*x + 2*y">();   // C++20
+//   auto g = ARITH_COMPILE("x*x + 2*y");      // C++17
+//   double r = f(3.0, 4.0);                   // x = 3, y = 4
+//
+// Грамматика, порядок переменных и порядок операций те же, что у
+// TPostfix: результат совпадает с TPostfix::Calculate до бита. Ошибка в
+// выражении - ошибка компиляции (вызов неconstexpr-функции Fail).
+
+#ifndef __STATIC_EXPR_H__
+#define __STATIC_EXPR_H__
+
+#include "arithmetic.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace arith
+{
+
+// операция байт-кода и глубина стека после нее; у переходов operand -
+// число пропускаемых операций, depth - глубина, если переход не выполнен
+struct TStep
+{
+  unsigned char op;
+  size_t operand;
+  size_t depth;
+};
+
+// число из текста: exact - значение получено без округлений, иначе оно
+// вычисляется при первом обращении через strtod
+struct TLiteral
+{
+  double value;
+  bool exact;
+  size_t pos;
+  size_t len;
+};
+
+template <size_t N>
+struct TStaticProgram
+{
+  TStep code[N];
+  size_t size;
+  TLiteral constants[N];
+  size_t constantCount;
+  size_t variablePos[N];
+  size_t variableLen[N];
+  size_t variableCount;
+  size_t depth;
+};
+
+namespace detail
+{
+
+[[noreturn]] inline void Fail(const char* message, size_t pos)
+{
+  throw TExpressionError(message, pos);
+}
+
+constexpr bool IsSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+constexpr bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool IsIdentStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+constexpr bool IsIdentChar(char c) { return IsIdentStart(c) || IsDigit(c); }
+
+// то же, что ScanNumber в arithmetic.cpp
+constexpr size_t ScanNumber(std::string_view s, size_t i)
+{
+  const size_t n = s.size();
+  size_t j = i;
+  while (j < n && IsDigit(s[j]))
+    j++;
+  if (j < n && s[j] == '.')
+  {
+    j++;
+    while (j < n && IsDigit(s[j]))
+      j++;
+  }
+  if (j == i + 1 && s[i] == '.')
+    return i;
+  if (j < n && (s[j] == 'e' || s[j] == 'E'))
+  {
+    size_t k = j + 1;
+    if (k < n && (s[k] == '+' || s[k] == '-'))
+      k++;
+    if (k < n && IsDigit(s[k]))
+    {
+      while (k < n && IsDigit(s[k]))
+        k++;
+      j = k;
+    }
+  }
+  return j;
+}
+
+// OP_END, если имя - не функция
+constexpr unsigned char FunctionCode(std::string_view name)
+{
+  if (name == "sin")
+    return OP_SIN;
+  if (name == "cos")
+    return OP_COS;
+  if (name == "ln")
+    return OP_LN;
+  if (name == "exp")
+    return OP_EXP;
+  return OP_END;
+}
+
+// Точное значение получается, если мантисса не больше 2^53, а порядок
+// не больше 22 по модулю: тогда обе части представимы точно и одно
+// умножение или деление округляет так же, как strtod. Нули в конце
+// дробной части не влияют на значение и пропускаются.
+constexpr TLiteral Number(std::string_view s, size_t pos, size_t len)
+{
+  TLiteral lit = { 0.0, true, pos, len };
+  const unsigned long long LIMIT = 1ull << 53;
+  unsigned long long m = 0;
+  long exp10 = 0;
+  size_t i = pos;
+  const size_t end = pos + len;
+  size_t digitsEnd = pos;
+  bool point = false;
+  while (digitsEnd < end && (IsDigit(s[digitsEnd]) || s[digitsEnd] == '.'))
+    point = s[digitsEnd++] == '.' || point;
+  const size_t exponent = digitsEnd;
+  while (point && s[digitsEnd - 1] == '0')
+    digitsEnd--;
+  point = false;
+  for (; i < digitsEnd; i++)
+  {
+    if (s[i] == '.')
+    {
+      point = true;
+      continue;
+    }
+    const unsigned d = static_cast<unsigned>(s[i] - '0');
+    if (m > (LIMIT - d) / 10)
+      lit.exact = false;
+    else
+    {
+      m = m * 10 + d;
+      if (point)
+        exp10--;
+    }
+  }
+  i = exponent;
+  if (i < end)
+  {
+    i++; // e или E
+    bool negative = false;
+    if (s[i] == '+' || s[i] == '-')
+      negative = s[i++] == '-';
+    long e = 0;
+    for (; i < end; i++)
+      if (e < 100000)
+        e = e * 10 + (s[i] - '0');
+    exp10 += negative ? -e : e;
+  }
+  if (m == 0 && lit.exact)
+    return lit;
+  if (!lit.exact || exp10 < -22 || exp10 > 22)
+  {
+    lit.exact = false;
+    return lit;
+  }
+  double power = 1.0;
+  for (long k = 0; k < (exp10 < 0 ? -exp10 : exp10); k++)
+    power *= 10.0;
+  const double mantissa = static_cast<double>(m);
+  lit.value = exp10 < 0 ? mantissa / power : mantissa * power;
+  return lit;
+}
+
+enum TTokenClass { TC_OPERAND, TC_OPERATION, TC_MINUS, TC_FUNCTION, TC_LEFT, TC_RIGHT, TC_END };
+enum TState { CS_START, CS_LEFT, CS_OPERAND, CS_BINARY, CS_UNARY, CS_FUNCTION, CS_ACCEPT };
+
+// переходы автомата TPostfix::Check; ошибки - отрицательные значения
+constexpr int Transition(int state, int cls)
+{
+  constexpr int OPND = -1, OPER = -2, UNARY = -3, FBRK = -4, EMPTY = -5, BRACKETS = -6;
+  constexpr int TABLE[6][7] =
+  {
+    //               OPERAND     OPERATION  MINUS     FUNCTION     LEFT     RIGHT       END
+    /* START    */ { CS_OPERAND, OPND,      CS_UNARY, CS_FUNCTION, CS_LEFT, OPND,       EMPTY     },
+    /* LEFT     */ { CS_OPERAND, OPND,      CS_UNARY, CS_FUNCTION, CS_LEFT, BRACKETS,   OPND      },
+    /* OPERAND  */ { OPER,       CS_BINARY, CS_BINARY, OPER,       OPER,    CS_OPERAND, CS_ACCEPT },
+    /* BINARY   */ { CS_OPERAND, OPND,      UNARY,    CS_FUNCTION, CS_LEFT, OPND,       OPND      },
+    /* UNARY    */ { CS_OPERAND, OPND,      UNARY,    CS_FUNCTION, CS_LEFT, OPND,       OPND      },
+    /* FUNCTION */ { FBRK,       FBRK,      FBRK,     FBRK,        CS_LEFT, FBRK,       FBRK      }
+  };
+  return TABLE[state][cls];
+}
+
+constexpr const char* TransitionMessage(int error)
+{
+  switch (error)
+  {
+  case -1: return "operand expected";
+  case -2: return "operation expected";
+  case -3: return "unary minus is allowed only at the start or after '('";
+  case -4: return "'(' expected after function name";
+  case -7: return "':' without matching '?'";
+  case -8: return "'?' without matching ':'";
+  case -9: return "conditional operators are nested too deeply";
+  case -5: return "empty expression";
+  default: return "empty brackets";
+  }
+}
+
+// элемент стека операций; у '(' в op - функция перед скобкой или OP_END;
+// у '?' в op - OP_JZ, у ':' - OP_JMP
+struct TPending
+{
+  unsigned char op;
+  int priority; // как в таблице операций TPostfix
+  bool bracket;
+  size_t pos;
+};
+
+// программа при построении: для каждого значения в стеке - индекс его
+// первой операции, перед ветвями условных операций вставляются переходы
+template <size_t N>
+struct TBuild
+{
+  TStaticProgram<N> p;
+  size_t starts[N];
+  size_t values;
+};
+
+template <size_t N>
+constexpr void Emit(TBuild<N>& b, unsigned char op, size_t operand)
+{
+  TStaticProgram<N>& p = b.p;
+  // целый показатель степени - как в TProgramBuilder::Power
+  if (op == OP_POW && p.code[p.size - 1].op == OP_CONST)
+  {
+    const TLiteral& e = p.constants[p.code[p.size - 1].operand];
+    if (e.exact && e.value >= -POWI_LIMIT && e.value <= POWI_LIMIT
+      && e.value == static_cast<double>(static_cast<int>(e.value)))
+    {
+      p.size--;
+      p.constantCount--;
+      b.values--;
+      p.code[p.size++] = TStep{ OP_POWI, static_cast<size_t>(static_cast<int>(e.value)), 0 };
+      return;
+    }
+  }
+  const size_t n = Operands(op);
+  const size_t start = n > 0 ? b.starts[b.values - n] : p.size;
+  b.values -= n;
+  b.starts[b.values++] = start;
+  p.code[p.size++] = TStep{ op, operand, 0 };
+}
+
+// переход через skip операций перед операцией с индексом at
+template <size_t N>
+constexpr void Insert(TStaticProgram<N>& p, size_t at, unsigned char op, size_t skip)
+{
+  for (size_t k = p.size; k > at; k--)
+    p.code[k] = p.code[k - 1];
+  p.code[at] = TStep{ op, skip, 0 };
+  p.size++;
+}
+
+// то же, что TProgramBuilder::Select и ShortCircuit
+template <size_t N>
+constexpr void Emit(TBuild<N>& b, const TPending& t)
+{
+  TStaticProgram<N>& p = b.p;
+  if (t.op == OP_JMP)
+  {
+    const size_t second = b.starts[--b.values];
+    const size_t first = b.starts[--b.values];
+    Insert(p, second, OP_JMP, p.size - second);
+    Insert(p, first, OP_JZ, second + 1 - first);
+  }
+  else if (t.op == OP_JZ_OR_POP || t.op == OP_JNZ_OR_POP)
+  {
+    Emit(b, OP_BOOL, 0);
+    const size_t second = b.starts[--b.values];
+    Insert(p, second, t.op, p.size - second);
+  }
+  else
+    Emit(b, t.op, 0);
+}
+
+template <size_t N>
+constexpr void Pop(TBuild<N>& b, TPending* ops, size_t& top)
+{
+  Emit(b, ops[--top]);
+}
+
+// глубина стека после каждой операции с учетом переходов
+template <size_t N>
+constexpr void SetDepths(TStaticProgram<N>& p)
+{
+  size_t labels[N + 1]{}; // глубина + 1 в месте, куда ведет переход
+  size_t depth = 0;
+  for (size_t k = 0; k < p.size; k++)
+  {
+    if (labels[k] != 0)
+      depth = labels[k] - 1;
+    if (IsJump(p.code[k].op))
+      labels[k + 1 + p.code[k].operand] = depth - (p.code[k].op == OP_JZ ? 1 : 0) + 1;
+    depth += StackEffect(p.code[k].op);
+    p.code[k].depth = depth;
+    if (depth > p.depth)
+      p.depth = depth;
+  }
+}
+
+} // namespace detail
+
+// проверка и перевод в байт-код; N - не меньше длины строки + 1;
+// при ошибке бросает TExpressionError (во время компиляции - ошибка)
+template <size_t N>
+constexpr TStaticProgram<N> Parse(std::string_view s)
+{
+  using namespace detail;
+  TBuild<N> b{};
+  TStaticProgram<N>& p = b.p;
+  TPending ops[N]{};
+  size_t top = 0, brackets = 0;
+  // '?', для которых еще не было ':', как в TPostfix::Check
+  const size_t MAX_CONDITIONS = 64;
+  size_t conditionPos[MAX_CONDITIONS]{};
+  size_t conditionDepth[MAX_CONDITIONS]{};
+  size_t conditions = 0;
+  int state = CS_START;
+  unsigned char function = OP_END; // функция, ожидающая '('
+  size_t i = 0;
+  for (;;)
+  {
+    while (i < s.size() && IsSpace(s[i]))
+      i++;
+    const size_t pos = i;
+    int cls = TC_END;
+    if (i == s.size())
+      cls = TC_END;
+    else if (IsDigit(s[i]) || s[i] == '.')
+    {
+      i = ScanNumber(s, i);
+      if (i == pos)
+        Fail("number expected", pos);
+      cls = TC_OPERAND;
+    }
+    else if (IsIdentStart(s[i]))
+    {
+      while (i < s.size() && IsIdentChar(s[i]))
+        i++;
+      cls = FunctionCode(s.substr(pos, i - pos)) != OP_END ? TC_FUNCTION : TC_OPERAND;
+    }
+    else
+    {
+      const char c = s[i++];
+      switch (c)
+      {
+      case '+': case '*': case '/': case '^': case '<': case '?': case ':': cls = TC_OPERATION; break;
+      case '=': case '&': case '|':
+        if (i == s.size() || s[i] != c)
+          Fail("invalid character", pos);
+        cls = TC_OPERATION;
+        break;
+      case '-': cls = TC_MINUS; break;
+      case '(': cls = TC_LEFT; break;
+      case ')':
+        if (brackets == 0)
+          Fail("unmatched ')'", pos);
+        cls = TC_RIGHT;
+        break;
+      default:
+        Fail("invalid character", pos);
+      }
+    }
+
+    // вторые символы <=, ==, && и ||
+    if (cls == TC_OPERATION && i < s.size() && ((s[pos] == '<' && s[i] == '=') || s[pos] == '='
+      || s[pos] == '&' || s[pos] == '|'))
+      i++;
+
+    const int next = Transition(state, cls);
+    if (next < 0)
+      Fail(TransitionMessage(next), pos);
+    if (next == CS_ACCEPT)
+      break;
+
+    if (cls == TC_OPERATION && s[pos] == '?')
+    {
+      if (conditions == MAX_CONDITIONS)
+        Fail(TransitionMessage(-9), pos);
+      conditionPos[conditions] = pos;
+      conditionDepth[conditions++] = brackets;
+    }
+    else if (cls == TC_OPERATION && s[pos] == ':')
+    {
+      if (conditions == 0 || conditionDepth[conditions - 1] != brackets)
+        Fail(TransitionMessage(-7), pos);
+      conditions--;
+    }
+    else if (cls == TC_RIGHT && conditions > 0 && conditionDepth[conditions - 1] == brackets)
+      Fail(TransitionMessage(-8), conditionPos[conditions - 1]);
+
+    // перевод в постфиксную форму, как в TPostfix::ToPostfix
+    switch (cls)
+    {
+    case TC_OPERAND:
+      if (IsDigit(s[pos]) || s[pos] == '.')
+      {
+        p.constants[p.constantCount] = Number(s, pos, i - pos);
+        Emit(b, OP_CONST, p.constantCount++);
+      }
+      else
+      {
+        const std::string_view name = s.substr(pos, i - pos);
+        size_t slot = 0;
+        while (slot < p.variableCount && s.substr(p.variablePos[slot], p.variableLen[slot]) != name)
+          slot++;
+        if (slot == p.variableCount)
+        {
+          p.variablePos[slot] = pos;
+          p.variableLen[slot] = i - pos;
+          p.variableCount++;
+        }
+        Emit(b, OP_VAR, slot);
+      }
+      break;
+    case TC_FUNCTION:
+      function = FunctionCode(s.substr(pos, i - pos));
+      break;
+    case TC_LEFT:
+      ops[top++] = TPending{ function, 0, true, pos };
+      function = OP_END;
+      brackets++;
+      break;
+    case TC_RIGHT:
+      while (!ops[top - 1].bracket)
+        Pop(b, ops, top);
+      if (ops[--top].op != OP_END)
+        Emit(b, ops[top].op, 0);
+      brackets--;
+      break;
+    case TC_MINUS:
+      if (state != CS_OPERAND)
+      {
+        ops[top++] = TPending{ OP_NEG, 3, false, pos };
+        break;
+      }
+      [[fallthrough]];
+    case TC_OPERATION:
+    {
+      const char c = s[pos];
+      if (c == ':')
+      {
+        while (ops[top - 1].op != OP_JZ || ops[top - 1].bracket)
+          Pop(b, ops, top);
+        ops[top - 1].op = OP_JMP;
+        break;
+      }
+      const bool twice = i - pos == 2;
+      const int priority = (c == '+' || c == '-') ? 1 : c == '^' ? 4 : (c == '*' || c == '/') ? 2
+        : c == '<' ? 0 : c == '=' ? -1 : c == '&' ? -2 : c == '|' ? -3 : -4;
+      const unsigned char op = c == '+' ? OP_ADD : c == '-' ? OP_SUB : c == '*' ? OP_MUL
+        : c == '/' ? OP_DIV : c == '^' ? OP_POW : c == '<' ? (twice ? OP_LE : OP_LT)
+        : c == '=' ? OP_EQ : c == '&' ? OP_JZ_OR_POP : c == '|' ? OP_JNZ_OR_POP : OP_JZ;
+      // '^' и '?' - правоассоциативные операции
+      const int limit = (c == '^' || c == '?') ? priority + 1 : priority;
+      while (top > 0 && !ops[top - 1].bracket && ops[top - 1].priority >= limit)
+        Pop(b, ops, top);
+      ops[top++] = TPending{ op, priority, false, pos };
+      break;
+    }
+    }
+    state = next;
+  }
+  if (brackets != 0)
+  {
+    while (!ops[top - 1].bracket)
+      top--;
+    Fail("unmatched '('", ops[top - 1].pos);
+  }
+  if (conditions > 0)
+    Fail(TransitionMessage(-8), conditionPos[conditions - 1]);
+  while (top > 0)
+    Pop(b, ops, top);
+  SetDepths(p);
+  return p;
+}
+
+// вычислитель выражения Source::Text(); все операции известны во время
+// компиляции, значения стека - элементы локального массива с
+// постоянными индексами, поэтому компилятор раскладывает их по регистрам
+template <class Source>
+class TStaticExpression
+{
+  static constexpr std::string_view text = Source::Text();
+  static constexpr TStaticProgram<text.size() + 1> program = Parse<text.size() + 1>(text);
+
+  template <size_t C>
+  static double Constant()
+  {
+    constexpr TLiteral lit = program.constants[C];
+    if constexpr (lit.exact)
+      return lit.value;
+    else
+    {
+      static const double value = std::strtod(std::string(text.substr(lit.pos, lit.len)).c_str(), 0);
+      return value;
+    }
+  }
+
+  template <size_t I>
+  static void Step(double* s, const double* vars)
+  {
+    constexpr TStep step = program.code[I];
+    constexpr size_t d = step.depth - 1; // вершина стека после операции
+    if constexpr (step.op == OP_CONST)
+      s[d] = Constant<step.operand>();
+    else if constexpr (step.op == OP_VAR)
+      s[d] = vars[step.operand];
+    else if constexpr (step.op == OP_ADD)
+      s[d] = s[d] + s[d + 1];
+    else if constexpr (step.op == OP_SUB)
+      s[d] = s[d] - s[d + 1];
+    else if constexpr (step.op == OP_MUL)
+      s[d] = s[d] * s[d + 1];
+    else if constexpr (step.op == OP_DIV)
+      s[d] = s[d] / s[d + 1];
+    else if constexpr (step.op == OP_NEG)
+      s[d] = -s[d];
+    else if constexpr (step.op == OP_SIN)
+      s[d] = std::sin(s[d]);
+    else if constexpr (step.op == OP_COS)
+      s[d] = std::cos(s[d]);
+    else if constexpr (step.op == OP_LN)
+      s[d] = std::log(s[d]);
+    else if constexpr (step.op == OP_POW)
+      s[d] = std::pow(s[d], s[d + 1]);
+    else if constexpr (step.op == OP_POWI)
+      s[d] = PowI(s[d], static_cast<int>(step.operand));
+    else if constexpr (step.op == OP_LT)
+      s[d] = s[d] < s[d + 1] ? 1.0 : 0.0;
+    else if constexpr (step.op == OP_LE)
+      s[d] = s[d] <= s[d + 1] ? 1.0 : 0.0;
+    else if constexpr (step.op == OP_EQ)
+      s[d] = s[d] == s[d + 1] ? 1.0 : 0.0;
+    else if constexpr (step.op == OP_BOOL)
+      s[d] = s[d] != 0.0 ? 1.0 : 0.0;
+    else
+      s[d] = std::exp(s[d]);
+  }
+
+  static constexpr bool HasJumps()
+  {
+    for (size_t k = 0; k < program.size; k++)
+      if (IsJump(program.code[k].op))
+        return true;
+    return false;
+  }
+
+  // выполнение с операции I до конца; переход - вызов для операции, к
+  // которой он ведет
+  template <size_t I>
+  static void From(double* s, const double* vars)
+  {
+    if constexpr (I < program.size)
+    {
+      constexpr TStep step = program.code[I];
+      if constexpr (!IsJump(step.op))
+      {
+        Step<I>(s, vars);
+        From<I + 1>(s, vars);
+      }
+      else
+      {
+        constexpr size_t target = I + 1 + step.operand;
+        constexpr size_t d = step.depth; // проверяемое значение
+        if constexpr (step.op == OP_JMP)
+          From<target>(s, vars);
+        else if constexpr (step.op == OP_JZ)
+        {
+          if (s[d] == 0.0)
+            From<target>(s, vars);
+          else
+            From<I + 1>(s, vars);
+        }
+        else if ((s[d] == 0.0) == (step.op == OP_JZ_OR_POP))
+        {
+          s[d] = step.op == OP_JZ_OR_POP ? 0.0 : 1.0;
+          From<target>(s, vars);
+        }
+        else
+          From<I + 1>(s, vars);
+      }
+    }
+  }
+
+  // без переходов операции выполняются подряд; с переходами - цепочкой
+  // вызовов From, поэтому длина такого выражения ограничена глубиной
+  // вложенности шаблонов компилятора
+  template <size_t... I>
+  static double Run(const double* vars, std::index_sequence<I...>)
+  {
+    double s[program.depth];
+    if constexpr (HasJumps())
+      From<0>(s, vars);
+    else
+      (Step<I>(s, vars), ...);
+    return s[0];
+  }
+
+public:
+  static constexpr size_t VariableCount() { return program.variableCount; }
+  // имя переменной с номером i, в порядке TPostfix::GetVariables
+  static constexpr std::string_view Variable(size_t i)
+  {
+    return text.substr(program.variablePos[i], program.variableLen[i]);
+  }
+  static constexpr size_t Depth() { return program.depth; }
+  static constexpr std::string_view Text() { return text; }
+
+  // values[i] - значение переменной Variable(i)
+  double Calculate(const double* values) const
+  {
+    return Run(values, std::make_index_sequence<program.size>());
+  }
+
+  // значения переменных в порядке Variable(0), Variable(1), ...
+  template <class... T>
+  double operator()(T... values) const
+  {
+    static_assert(sizeof...(T) == VariableCount(), "wrong number of variable values");
+    const double v[sizeof...(T) + 1] = { static_cast<double>(values)... };
+    return Calculate(v);
+  }
+};
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+// строковый литерал как параметр шаблона
+template <size_t N>
+struct TFixedString
+{
+  char data[N];
+
+  constexpr TFixedString(const char (&s)[N]) : data()
+  {
+    for (size_t i = 0; i < N; i++)
+      data[i] = s[i];
+  }
+};
+
+template <TFixedString S>
+struct TLiteralSource
+{
+  static constexpr std::string_view Text() { return std::string_view(S.data, sizeof(S.data) - 1); }
+};
+
+template <TFixedString S>
+constexpr TStaticExpression<TLiteralSource<S> > compile()
+{
+  return TStaticExpression<TLiteralSource<S> >();
+}
+
+#endif
+
+} // namespace arith
+
+// вариант для C++17: источник текста - локальный класс
+#define ARITH_COMPILE(literal) \
+  ([] { \
+    struct TSource \
+    { \
+      static constexpr std::string_view Text() { return literal; } \
+    }; \
+    return ::arith::TStaticExpression<TSource>(); \
+  }())
+
+#endif
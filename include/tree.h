@@ -0,0 +1,92 @@
+// дерево арифметического выражения для оптимизирующих проходов
+//
+// узлы лежат в одном непрерывном массиве и ссылаются друг на друга
+// 32-битными индексами; дети всегда создаются раньше родителя
+
+#ifndef __TREE_H__
+#define __TREE_H__
+
+#include "arithmetic.h"
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+// Условные операции - узлы с кодом перехода: OP_JZ - c ? a : b
+// (cond - c, left - a, right - b), OP_JZ_OR_POP и OP_JNZ_OR_POP - a && b
+// и a || b (left - a, right - b вместе с OP_BOOL). Правые дети условных
+// операций (и left у OP_JZ) вычисляются не всегда.
+struct TNode
+{
+  unsigned char op;   // TOpCode
+  unsigned int left;  // TExprTree::NO_NODE, если нет
+  unsigned int right;
+  unsigned int cond;  // условие для OP_JZ
+  unsigned int slot;  // номер переменной для OP_VAR, символ для OP_CALL1/2
+  double value;       // значение для OP_CONST
+};
+
+class TExprTree
+{
+  struct TNodeHash
+  {
+    size_t operator()(const TNode& n) const;
+  };
+  struct TNodeEqual
+  {
+    bool operator()(const TNode& a, const TNode& b) const;
+  };
+
+  std::vector<TNode> nodes;
+  std::vector<unsigned int> roots; // по одному на выражение
+  unsigned flags;
+  // при OPT_CSE - уже построенные узлы, одинаковые узлы не повторяются
+  std::unordered_map<TNode, unsigned int, TNodeHash, TNodeEqual> known;
+  size_t shared;
+
+  unsigned int Add(unsigned char op, unsigned int left, unsigned int right, unsigned int slot, double value,
+    unsigned int cond = NO_NODE);
+  unsigned int Constant(double value);
+  unsigned int Make(unsigned char op, unsigned int left, unsigned int right, unsigned int slot,
+    unsigned int cond = NO_NODE);
+  unsigned int Simplify(unsigned char op, unsigned int left, unsigned int right, unsigned int slot,
+    unsigned int cond);
+
+public:
+  static const unsigned int NO_NODE = 0xFFFFFFFFu;
+
+  // строит дерево по байт-коду; flags - набор TOptimizeFlags,
+  // свертка и поиск такого же узла выполняются сразу при создании узла;
+  // с OPT_CSE дерево становится ациклическим графом
+  TExprTree(const TProgram& prog, unsigned flags);
+  // дерево без выражений, они добавляются через Append
+  explicit TExprTree(unsigned flags);
+
+  // добавляет еще одно выражение со своим корнем: переменная i программы
+  // становится переменной slots[i]; с OPT_CSE узлы, одинаковые с узлами
+  // уже добавленных выражений, общие с ними; возвращает корень
+  unsigned int Append(const TProgram& prog, const std::vector<unsigned int>& slots);
+
+  // корень первого выражения
+  unsigned int Root() const { return roots[0]; }
+  const std::vector<unsigned int>& Roots() const { return roots; }
+  const TNode& Node(unsigned int i) const { return nodes[i]; }
+  size_t Size() const { return nodes.size(); }
+  // число узлов, достижимых из корней
+  size_t Reachable() const;
+  // сколько раз вместо нового узла был взят уже существующий
+  size_t Shared() const { return shared; }
+
+  // узел, на который ссылаются несколько родителей, вычисляется один раз,
+  // сохраняется во временную ячейку и дальше загружается из нее; ячейка,
+  // заполненная внутри ветви условной операции, после ветви не читается.
+  // Если выражений несколько, их код идет подряд, код выражения j
+  // заканчивается в (*ends)[j] и оставляет в стеке одно значение, которое
+  // снимает тот, кто выполняет программу; ячейки общие для всех выражений.
+  // Такая программа не заканчивается одним значением, и выполнять ее
+  // можно только по частям (см. batch.h); бросает std::logic_error, если
+  // выражений несколько, а ends == 0.
+  TProgram Emit(std::vector<size_t>* ends = 0) const;
+};
+
+#endif
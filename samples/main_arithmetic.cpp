@@ -1,6 +1,573 @@
 // реализация пользовательского приложения
+//
+// postfix                          - ввод и вычисление одного выражения
+// postfix --check FILE [--threads N] - только проверка файла выражений,
+//                                    по одному в строке
+// postfix --bench FILE [--repeat N]  - сравнение стековой и регистровой
+//                                    машин и машинного кода на выражениях
+//                                    из файла
+// postfix --cache-bench FILE [--threads N] [--repeat N]
+//                                  - поиск в кэше выражений из 1, 2, 4, ...
+//                                    N потоков
+// postfix --batch-bench FILE [--threads N] [--repeat N]
+//                                  - вычисление выражений из файла блоками
+//                                    строк пулом из 1, 2, 4, ... N потоков
+//                                    (по умолчанию до 64), по отдельности
+//                                    и одной общей программой
+// postfix --save FILE OUT            - компиляция выражений из файла в
+//                                    двоичный каталог OUT
+// postfix --load OUT                 - открытие каталога и вычисление всех
+//                                    выражений
+// postfix --emit-cpp FILE            - заголовок C++ с функциями для строк
+//                                    вида "имя = выражение" (в stdout)
+// postfix --math-bench [--repeat N]  - наибольшая ошибка в ulp и скорость
+//                                    sin, cos, ln, exp каждой точности
 
-int main()
+#include "arithmetic.h"
+#include "batch.h"
+#include "cache.h"
+#include "catalog.h"
+#include "emit.h"
+#include "pool.h"
+#include "simd.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+int Interactive()
+{
+  std::string expr;
+  std::cout << "Enter expression: ";
+  std::getline(std::cin, expr);
+
+  try
+  {
+    TPostfix p(expr);
+    std::cout << "Postfix: " << p.GetPostfix() << std::endl;
+
+    std::map<std::string, double> values;
+    const std::vector<std::string>& vars = p.GetVariables();
+    for (size_t i = 0; i < vars.size(); i++)
+    {
+      std::cout << vars[i] << " = ";
+      std::cin >> values[vars[i]];
+    }
+    std::cout << "Result: " << p.Calculate(values) << std::endl;
+  }
+  catch (const TExpressionError& e)
+  {
+    std::cout << expr << std::endl;
+    std::cout << std::string(e.Position(), ' ') << '^' << std::endl;
+    std::cout << "Error at position " << e.Position() + 1 << ": " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+bool ReadFile(const char* path, std::string& text)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+  {
+    std::cerr << "cannot open " << path << std::endl;
+    return false;
+  }
+  text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  return true;
+}
+
+int CheckFile(const char* path, unsigned threads)
+{
+  std::string text;
+  if (!ReadFile(path, text))
+    return 2;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const TPostfix::TLinesCheckResult res = TPostfix::CheckLines(text.data(), text.size(), threads);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (size_t i = 0; i < res.errors.size(); i++)
+  {
+    const TPostfix::TLineError& e = res.errors[i];
+    std::cout << path << ':' << e.line << ':' << e.column << ": " << e.message << '\n';
+  }
+  std::cout << res.lines << " lines, " << res.errors.size() << " errors, "
+    << seconds << " s";
+  if (seconds > 0)
+    std::cout << ", " << static_cast<double>(res.lines) / seconds << " lines/s";
+  std::cout << std::endl;
+  return res.errors.empty() ? 0 : 1;
+}
+
+// корректные выражения из текста, по одному в строке
+std::vector<std::string> ValidLines(const std::string& text)
+{
+  std::vector<std::string> lines;
+  size_t begin = 0;
+  while (begin < text.size())
+  {
+    size_t end = text.find('\n', begin);
+    if (end == std::string::npos)
+      end = text.size();
+    const std::string line = text.substr(begin, end - begin);
+    begin = end + 1;
+    if (TPostfix::Check(line).ok)
+      lines.push_back(line);
+  }
+  return lines;
+}
+
+struct TBenchItem
+{
+  TPostfix expr;
+  std::vector<double> values;
+
+  explicit TBenchItem(const std::string& line) : expr(line) {}
+};
+
+bool Same(double x, double y)
+{
+  return x == y || (x != x && y != y);
+}
+
+double BenchEngine(std::vector<TBenchItem>& items, TEngine engine, int repeat, double& checksum)
+{
+  for (size_t i = 0; i < items.size(); i++)
+    items[i].expr.SetEngine(engine);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; r++)
+    for (size_t i = 0; i < items.size(); i++)
+      checksum += items[i].expr.Calculate(items[i].values.empty() ? 0 : &items[i].values[0]);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int BenchFile(const char* path, int repeat)
+{
+  std::string text;
+  if (!ReadFile(path, text))
+    return 2;
+
+  std::vector<TBenchItem> items;
+  const std::vector<std::string> lines = ValidLines(text);
+  for (size_t l = 0; l < lines.size(); l++)
+  {
+    TBenchItem item(lines[l]);
+    for (size_t v = 0; v < item.expr.GetVariables().size(); v++)
+      item.values.push_back(0.5 + std::rand() / (RAND_MAX + 1.0));
+    items.push_back(item);
+  }
+  if (items.empty())
+  {
+    std::cerr << "no valid expressions in " << path << std::endl;
+    return 2;
+  }
+
+  const double evals = static_cast<double>(items.size()) * repeat;
+  double stackSum = 0, registerSum = 0, jitSum = 0;
+  const double stackTime = BenchEngine(items, ENGINE_STACK, repeat, stackSum);
+  const double registerTime = BenchEngine(items, ENGINE_REGISTER, repeat, registerSum);
+  const double jitTime = BenchEngine(items, ENGINE_JIT, repeat, jitSum);
+  size_t compiled = 0;
+  for (size_t i = 0; i < items.size(); i++)
+    if (items[i].expr.GetEngine() == ENGINE_JIT)
+      compiled++;
+  std::cout << items.size() << " expressions x " << repeat << " repeats" << std::endl;
+  std::cout << "stack:    " << stackTime * 1e9 / evals << " ns/eval" << std::endl;
+  std::cout << "register: " << registerTime * 1e9 / evals << " ns/eval" << std::endl;
+  std::cout << "jit:      " << jitTime * 1e9 / evals << " ns/eval (" << compiled
+    << " of " << items.size() << " compiled)" << std::endl;
+  // NaN в сумме означает, что хотя бы одно выражение дало NaN
+  if (!Same(stackSum, registerSum) || !Same(stackSum, jitSum))
+    std::cout << "warning: engines disagree" << std::endl;
+  return 0;
+}
+
+void CacheWorker(TShardedPostfixCache* cache, const std::vector<std::string>* lines, int lookups, unsigned seed, double* checksum)
+{
+  double sum = 0;
+  for (int i = 0; i < lookups; i++)
+  {
+    seed = seed * 1103515245u + 12345u;
+    const std::shared_ptr<const TPostfix> p = cache->Get((*lines)[(seed >> 8) % lines->size()]);
+    sum += static_cast<double>(p->GetVariables().size());
+  }
+  *checksum = sum;
+}
+
+int CacheBench(const char* path, unsigned maxThreads, int lookups)
 {
+  std::string text;
+  if (!ReadFile(path, text))
+    return 2;
+  const std::vector<std::string> lines = ValidLines(text);
+  if (lines.empty())
+  {
+    std::cerr << "no valid expressions in " << path << std::endl;
+    return 2;
+  }
+  if (maxThreads == 0)
+    maxThreads = std::thread::hardware_concurrency();
+  if (maxThreads == 0)
+    maxThreads = 1;
+
+  TShardedPostfixCache cache(size_t(1) << 30, 64);
+  for (size_t i = 0; i < lines.size(); i++)
+    cache.Get(lines[i]);
+
+  std::vector<unsigned> counts;
+  for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+    counts.push_back(threads);
+  counts.push_back(maxThreads);
+
+  double base = 0;
+  for (size_t c = 0; c < counts.size(); c++)
+  {
+    const unsigned threads = counts[c];
+    std::vector<std::thread> workers;
+    std::vector<double> sums(threads);
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++)
+      workers.push_back(std::thread(CacheWorker, &cache, &lines, lookups, t + 1, &sums[t]));
+    for (unsigned t = 0; t < threads; t++)
+      workers[t].join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double rate = static_cast<double>(lookups) * threads / seconds;
+    if (threads == 1)
+      base = rate;
+    std::cout << threads << " threads: " << rate << " lookups/s, x" << rate / base << std::endl;
+  }
+  return 0;
+}
+
+// столбцы общие для всех выражений: у каждого имени переменной свой
+int BatchBench(const char* path, unsigned maxThreads, int repeat)
+{
+  std::string text;
+  if (!ReadFile(path, text))
+    return 2;
+  const std::vector<std::string> lines = ValidLines(text);
+  if (lines.empty())
+  {
+    std::cerr << "no valid expressions in " << path << std::endl;
+    return 2;
+  }
+  if (maxThreads == 0)
+    maxThreads = 64;
+
+  const size_t rows = 1 << 16;
+  std::vector<TPostfix> exprs;
+  exprs.reserve(lines.size());
+  for (size_t i = 0; i < lines.size(); i++)
+    exprs.push_back(TPostfix(lines[i]));
+  std::map<std::string, std::vector<double> > values;
+  std::vector<std::vector<const double*> > columns(exprs.size());
+  for (size_t i = 0; i < exprs.size(); i++)
+  {
+    const std::vector<std::string>& vars = exprs[i].GetVariables();
+    for (size_t v = 0; v < vars.size(); v++)
+    {
+      std::vector<double>& column = values[vars[v]];
+      if (column.empty())
+        for (size_t k = 0; k < rows; k++)
+          column.push_back(0.5 + std::rand() / (RAND_MAX + 1.0));
+      columns[i].push_back(&column[0]);
+    }
+  }
+  std::vector<std::vector<double> > results(exprs.size(), std::vector<double>(rows));
+  std::vector<TBatchJob> jobs;
+  for (size_t i = 0; i < exprs.size(); i++)
+  {
+    TBatchJob job = { &exprs[i], columns[i].empty() ? 0 : &columns[i][0], &results[i][0] };
+    jobs.push_back(job);
+  }
+
+  std::vector<const TPostfix*> ptrs;
+  for (size_t i = 0; i < exprs.size(); i++)
+    ptrs.push_back(&exprs[i]);
+  const TFusedBatch fused(ptrs);
+  std::vector<const double*> fusedColumns;
+  for (size_t v = 0; v < fused.GetVariables().size(); v++)
+    fusedColumns.push_back(&values[fused.GetVariables()[v]][0]);
+  std::vector<double*> fusedResults;
+  for (size_t i = 0; i < exprs.size(); i++)
+    fusedResults.push_back(&results[i][0]);
+
+  std::vector<unsigned> counts;
+  for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+    counts.push_back(threads);
+  counts.push_back(maxThreads);
+
+  std::cout << exprs.size() << " expressions x " << rows << " rows x " << repeat << " repeats, fused "
+    << fused.Stats().nodesBefore << " -> " << fused.Stats().nodesAfter << " nodes" << std::endl;
+  double base = 0;
+  for (size_t c = 0; c < counts.size(); c++)
+  {
+    TThreadPool pool(counts[c]);
+    size_t steals = 0;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++)
+    {
+      ExecuteBatch(pool, jobs, rows);
+      steals += pool.Steals();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double rate = static_cast<double>(rows) * exprs.size() * repeat / seconds;
+    const std::chrono::steady_clock::time_point fusedStart = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++)
+      fused.Calculate(pool, fusedColumns.empty() ? 0 : &fusedColumns[0], rows, &fusedResults[0]);
+    const double fusedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - fusedStart).count();
+    if (c == 0)
+      base = rate;
+    std::cout << counts[c] << " threads: " << rate << " evals/s, x" << rate / base
+      << ", " << steals / repeat << " steals/run; fused " << rate * seconds / fusedSeconds << " evals/s" << std::endl;
+  }
+  return 0;
+}
+
+int SaveCatalog(const char* path, const char* out)
+{
+  std::string text;
+  if (!ReadFile(path, text))
+    return 2;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const std::vector<std::string> lines = ValidLines(text);
+  std::vector<TPostfix> exprs;
+  exprs.reserve(lines.size());
+  for (size_t i = 0; i < lines.size(); i++)
+    exprs.push_back(TPostfix(lines[i]));
+  std::vector<const TPostfix*> ptrs;
+  for (size_t i = 0; i < exprs.size(); i++)
+    ptrs.push_back(&exprs[i]);
+  try
+  {
+    TCompiledCatalog::Save(out, ptrs);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << exprs.size() << " expressions compiled in " << seconds << " s" << std::endl;
   return 0;
 }
+
+int LoadCatalog(const char* path)
+{
+  try
+  {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TCompiledCatalog catalog(path);
+    const double openTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::vector<double> values;
+    double checksum = 0;
+    for (size_t i = 0; i < catalog.Count(); i++)
+    {
+      values.assign(catalog.VariableCount(i) + 1, 1.0);
+      checksum += catalog.Calculate(i, &values[0]);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << catalog.Count() << " expressions, open " << openTime << " s, open and evaluate "
+      << seconds << " s, checksum " << checksum << std::endl;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
+int EmitCpp(const char* path)
+{
+  std::string text;
+  if (!ReadFile(path, text))
+    return 2;
+
+  TCppEmitter emitter;
+  int errors = 0;
+  size_t begin = 0;
+  for (size_t line = 1; begin < text.size(); line++)
+  {
+    size_t end = text.find('\n', begin);
+    if (end == std::string::npos)
+      end = text.size();
+    std::string s = text.substr(begin, end - begin);
+    begin = end + 1;
+    if (!s.empty() && s[s.size() - 1] == '\r')
+      s.erase(s.size() - 1);
+    const size_t first = s.find_first_not_of(" \t");
+    if (first == std::string::npos || s[first] == '#')
+      continue;
+
+    const size_t eq = s.find('=');
+    if (eq == std::string::npos)
+    {
+      std::cerr << path << ':' << line << ": expected 'name = expression'" << std::endl;
+      errors++;
+      continue;
+    }
+    const size_t nameEnd = s.find_last_not_of(" \t", eq == 0 ? 0 : eq - 1);
+    const std::string name = eq == 0 || nameEnd == std::string::npos || nameEnd < first
+      ? std::string() : s.substr(first, nameEnd - first + 1);
+    try
+    {
+      emitter.Add(name, TPostfix(s.substr(eq + 1)));
+    }
+    catch (const TExpressionError& e)
+    {
+      std::cerr << path << ':' << line << ':' << eq + 2 + e.Position() << ": " << e.what() << std::endl;
+      errors++;
+    }
+    catch (const std::invalid_argument& e)
+    {
+      std::cerr << path << ':' << line << ": " << e.what() << std::endl;
+      errors++;
+    }
+  }
+  if (errors > 0)
+    return 1;
+  std::cout << emitter.Header("FORMULAS_H", "formulas");
+  return 0;
+}
+
+// ошибка в ulp относительно значения, вычисленного в long double
+double UlpError(double y, long double exact)
+{
+  const double d = static_cast<double>(exact);
+  if (std::isinf(d) || d == 0.0)
+    return y == d ? 0.0 : HUGE_VAL;
+  const double ulp = std::nextafter(std::fabs(d), HUGE_VAL) - std::fabs(d);
+  return static_cast<double>(std::fabs(static_cast<long double>(y) - exact) / ulp);
+}
+
+int MathBench(int repeat)
+{
+  const char* const NAMES[] = { "sin", "cos", "ln", "exp" };
+  const char* const TIERS[] = { "libm", "precise", "fast" };
+  const size_t COUNT = 1 << 16;
+
+  std::cout << "SIMD level " << SimdSupported() << ", " << COUNT << " values x " << repeat << " repeats" << std::endl;
+  std::cout << "function  tier      max ulp   Mvalues/s" << std::endl;
+  for (int f = 0; f < 4; f++)
+  {
+    // рабочие диапазоны: |x| <= 100 для sin и cos, 1e-300..1e300 для ln,
+    // |x| <= 700 для exp
+    std::vector<double> x(COUNT);
+    for (size_t k = 0; k < COUNT; k++)
+    {
+      const double u = std::rand() / (RAND_MAX + 1.0);
+      x[k] = f < 2 ? (u - 0.5) * 200 : f == 2 ? std::pow(10.0, (u - 0.5) * 600) : (u - 0.5) * 1400;
+    }
+    for (int t = MATH_LIBM; t <= MATH_FAST; t++)
+    {
+      const TMathKernels& kernels = MathKernels(static_cast<TMathAccuracy>(t), SimdSupported());
+      void (*const kernel[])(double*, size_t) = { kernels.sin, kernels.cos, kernels.ln, kernels.exp };
+      std::vector<double> y(x);
+      kernel[f](&y[0], COUNT);
+      double worst = 0;
+      for (size_t k = 0; k < COUNT; k++)
+      {
+        const long double a = x[k];
+        const long double exact = f == 0 ? std::sin(a) : f == 1 ? std::cos(a) : f == 2 ? std::log(a) : std::exp(a);
+        const double error = UlpError(y[k], exact);
+        if (error > worst)
+          worst = error;
+      }
+
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (int r = 0; r < repeat; r++)
+      {
+        y = x;
+        kernel[f](&y[0], COUNT);
+      }
+      const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << std::left << std::setw(10) << NAMES[f] << std::setw(10) << TIERS[t] << std::setw(10)
+        << std::fixed << std::setprecision(3) << worst << std::setprecision(1) << COUNT * repeat / seconds * 1e-6
+        << std::endl;
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const char* checkPath = 0;
+  const char* benchPath = 0;
+  const char* cacheBenchPath = 0;
+  const char* batchBenchPath = 0;
+  const char* savePath = 0;
+  const char* saveOut = 0;
+  const char* loadPath = 0;
+  const char* emitPath = 0;
+  bool mathBench = false;
+  unsigned threads = 0;
+  int repeat = 1000;
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--check") == 0 && i + 1 < argc)
+      checkPath = argv[++i];
+    else if (std::strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+      benchPath = argv[++i];
+    else if (std::strcmp(argv[i], "--cache-bench") == 0 && i + 1 < argc)
+      cacheBenchPath = argv[++i];
+    else if (std::strcmp(argv[i], "--batch-bench") == 0 && i + 1 < argc)
+      batchBenchPath = argv[++i];
+    else if (std::strcmp(argv[i], "--save") == 0 && i + 2 < argc)
+    {
+      savePath = argv[++i];
+      saveOut = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+      loadPath = argv[++i];
+    else if (std::strcmp(argv[i], "--emit-cpp") == 0 && i + 1 < argc)
+      emitPath = argv[++i];
+    else if (std::strcmp(argv[i], "--math-bench") == 0)
+      mathBench = true;
+    else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      threads = static_cast<unsigned>(std::atoi(argv[++i]));
+    else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+      repeat = std::atoi(argv[++i]);
+    else
+    {
+      std::cerr << "usage: " << argv[0] << " [--check FILE [--threads N]] [--bench FILE [--repeat N]]"
+        " [--cache-bench FILE [--threads N] [--repeat N]] [--batch-bench FILE [--threads N] [--repeat N]]"
+        " [--save FILE OUT] [--load OUT]"
+        " [--emit-cpp FILE] [--math-bench [--repeat N]]" << std::endl;
+      return 2;
+    }
+  }
+
+  if (checkPath)
+    return CheckFile(checkPath, threads);
+  if (benchPath)
+    return BenchFile(benchPath, repeat);
+  if (cacheBenchPath)
+    return CacheBench(cacheBenchPath, threads, repeat * 1000);
+  if (batchBenchPath)
+    return BatchBench(batchBenchPath, threads, repeat / 100 > 0 ? repeat / 100 : 1);
+  if (savePath)
+    return SaveCatalog(savePath, saveOut);
+  if (loadPath)
+    return LoadCatalog(loadPath);
+  if (emitPath)
+    return EmitCpp(emitPath);
+  if (mathBench)
+    return MathBench(repeat / 10 > 0 ? repeat / 10 : 1);
+  return Interactive();
+}
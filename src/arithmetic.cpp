@@ -1 +1,1591 @@
-//        
\ No newline at end of file
+// реализация функций и классов для вычисления арифметических выражений
+
+#include "arithmetic.h"
+#include "batch.h"
+#include "dual.h"
+#include "jit.h"
+#include "stack.h"
+#include "tree.h"
+
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+
+const char* const FUNCTIONS[] = { "sin", "cos", "ln", "exp" };
+
+bool IsFunctionName(const char* s, size_t len)
+{
+  for (size_t i = 0; i < sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]); i++)
+    if (std::strlen(FUNCTIONS[i]) == len && std::strncmp(FUNCTIONS[i], s, len) == 0)
+      return true;
+  return false;
+}
+
+bool IsDigit(char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; }
+bool IsIdentStart(char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_'; }
+bool IsIdentChar(char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+
+// конец числа, начинающегося с s[i] (цифра или '.'); i, если числа нет
+size_t ScanNumber(const char* s, size_t i, size_t n)
+{
+  size_t j = i;
+  while (j < n && IsDigit(s[j]))
+    j++;
+  if (j < n && s[j] == '.')
+  {
+    j++;
+    while (j < n && IsDigit(s[j]))
+      j++;
+  }
+  if (j == i + 1 && s[i] == '.')
+    return i;
+  if (j < n && (s[j] == 'e' || s[j] == 'E'))
+  {
+    size_t k = j + 1;
+    if (k < n && (s[k] == '+' || s[k] == '-'))
+      k++;
+    if (k < n && IsDigit(s[k]))
+    {
+      while (k < n && IsDigit(s[k]))
+        k++;
+      j = k;
+    }
+  }
+  return j;
+}
+
+size_t ScanIdentifier(const char* s, size_t i, size_t n)
+{
+  while (i < n && IsIdentChar(s[i]))
+    i++;
+  return i;
+}
+
+// Проверка корректности - конечный автомат над классами лексем.
+// Переход берется из таблицы по (состояние, класс); отрицательное
+// значение - номер ошибки. Глубина скобок считается счетчиком.
+
+enum TTokenClass
+{
+  TC_OPERAND,   // число или переменная
+  TC_OPERATION, // + * /
+  TC_MINUS,     // унарная и бинарная операция одновременно - решает автомат
+  TC_PREFIX,    // только унарная операция
+  TC_FUNCTION,
+  TC_LEFT,
+  TC_RIGHT,
+  TC_END,
+  TC_COUNT
+};
+
+enum TCheckState
+{
+  CS_START,     // начало выражения
+  CS_LEFT,      // после '('
+  CS_OPERAND,   // после операнда или ')'
+  CS_BINARY,    // после бинарной операции
+  CS_UNARY,     // после унарного минуса
+  CS_FUNCTION,  // после имени функции
+  CS_COUNT,
+  CS_ACCEPT = CS_COUNT
+};
+
+enum TCheckError
+{
+  CE_EMPTY = -1,
+  CE_OPERAND_EXPECTED = -2,
+  CE_OPERATION_EXPECTED = -3,
+  CE_UNARY_MINUS = -4,
+  CE_BRACKET_AFTER_FUNCTION = -5,
+  CE_EMPTY_BRACKETS = -6,
+  CE_UNARY_OPERATION = -7
+};
+
+const char* const CHECK_MESSAGES[] =
+{
+  "",
+  "empty expression",
+  "operand expected",
+  "operation expected",
+  "unary minus is allowed only at the start or after '('",
+  "'(' expected after function name",
+  "empty brackets",
+  "unary operation is allowed only at the start or after '('"
+};
+
+#define OPND CE_OPERAND_EXPECTED
+#define OPER CE_OPERATION_EXPECTED
+#define FBRK CE_BRACKET_AFTER_FUNCTION
+#define UNRY CE_UNARY_OPERATION
+
+const signed char CHECK_TABLE[CS_COUNT][TC_COUNT] =
+{
+  //               OPERAND     OPERATION  MINUS           PREFIX    FUNCTION     LEFT     RIGHT              END
+  /* START    */ { CS_OPERAND, OPND,      CS_UNARY,       CS_UNARY, CS_FUNCTION, CS_LEFT, OPND,              CE_EMPTY  },
+  /* LEFT     */ { CS_OPERAND, OPND,      CS_UNARY,       CS_UNARY, CS_FUNCTION, CS_LEFT, CE_EMPTY_BRACKETS, OPND      },
+  /* OPERAND  */ { OPER,       CS_BINARY, CS_BINARY,      OPER,     OPER,        OPER,    CS_OPERAND,        CS_ACCEPT },
+  /* BINARY   */ { CS_OPERAND, OPND,      CE_UNARY_MINUS, UNRY,     CS_FUNCTION, CS_LEFT, OPND,              OPND      },
+  /* UNARY    */ { CS_OPERAND, OPND,      CE_UNARY_MINUS, UNRY,     CS_FUNCTION, CS_LEFT, OPND,              OPND      },
+  /* FUNCTION */ { FBRK,       FBRK,      FBRK,           FBRK,     FBRK,        CS_LEFT, FBRK,              FBRK      }
+};
+
+#undef OPND
+#undef OPER
+#undef FBRK
+#undef UNRY
+
+TPostfix::TCheckResult Failure(size_t pos, const char* message)
+{
+  TPostfix::TCheckResult r;
+  r.ok = false;
+  r.pos = pos;
+  r.message = message;
+  return r;
+}
+
+// позиция последней незакрытой '(' - нужна только для сообщения об ошибке
+size_t FindUnclosedBracket(const char* s, size_t n)
+{
+  size_t closed = 0;
+  for (size_t i = n; i-- > 0;)
+  {
+    if (s[i] == ')')
+      closed++;
+    else if (s[i] == '(')
+    {
+      if (closed == 0)
+        return i;
+      closed--;
+    }
+  }
+  return n;
+}
+
+// приоритеты встроенных операций, которые выполняются после
+// зарегистрированных (у тех приоритет не меньше 1), как в C
+const int PRIORITY_LESS = 0;
+const int PRIORITY_EQUAL = -1;
+const int PRIORITY_AND = -2;
+const int PRIORITY_OR = -3;
+const int PRIORITY_CONDITION = -4;
+
+// операции из двух символов; их первые символы, кроме '<', сами по себе
+// операциями не являются
+struct TLongOperator
+{
+  char text[3];
+  TOperator op;
+};
+
+const TLongOperator LONG_OPERATORS[] =
+{
+  { "<=", { OP_LE, PRIORITY_LESS, ASSOC_LEFT, 0, 0 } },
+  { "==", { OP_EQ, PRIORITY_EQUAL, ASSOC_LEFT, 0, 0 } },
+  { "&&", { OP_JZ_OR_POP, PRIORITY_AND, ASSOC_LEFT, 0, 0 } },
+  { "||", { OP_JNZ_OR_POP, PRIORITY_OR, ASSOC_LEFT, 0, 0 } }
+};
+
+// операция из двух символов, которая начинается с s[i], или 0
+const TLongOperator* FindLongOperator(const char* s, size_t i, size_t n)
+{
+  if (i + 1 >= n)
+    return 0;
+  for (size_t k = 0; k < sizeof(LONG_OPERATORS) / sizeof(LONG_OPERATORS[0]); k++)
+    if (s[i] == LONG_OPERATORS[k].text[0] && s[i + 1] == LONG_OPERATORS[k].text[1])
+      return &LONG_OPERATORS[k];
+  return 0;
+}
+
+// операция лексемы из таблицы операций; у остальных лексем priority == 0
+const TOperator& LexemeOperator(const TLexeme& lex)
+{
+  static const TOperator NONE = { OP_END, 0, ASSOC_LEFT, 0, 0 };
+  const unsigned char c = static_cast<unsigned char>(lex.text[0]);
+  if (lex.type == LEX_UNARY_MINUS)
+    return TPostfix::UnaryOperator(c);
+  if (lex.type == LEX_OPERATION)
+  {
+    if (lex.text.size() == 2)
+      return FindLongOperator(lex.text.c_str(), 0, 2)->op;
+    return TPostfix::BinaryOperator(c);
+  }
+  return NONE;
+}
+
+// встроенные операции; остальные элементы - пустые (op == OP_END)
+constexpr TOperatorTable MakeOperatorTable()
+{
+  TOperatorTable t{};
+  t.binary['+'] = TOperator{ OP_ADD, 1, ASSOC_LEFT, 0, 0 };
+  t.binary['-'] = TOperator{ OP_SUB, 1, ASSOC_LEFT, 0, 0 };
+  t.binary['*'] = TOperator{ OP_MUL, 2, ASSOC_LEFT, 0, 0 };
+  t.binary['/'] = TOperator{ OP_DIV, 2, ASSOC_LEFT, 0, 0 };
+  t.binary['^'] = TOperator{ OP_POW, 4, ASSOC_RIGHT, 0, 0 };
+  t.binary['<'] = TOperator{ OP_LT, PRIORITY_LESS, ASSOC_LEFT, 0, 0 };
+  // '?' и ':' - части одной условной операции, в постфиксную запись
+  // попадает только ':'
+  t.binary['?'] = TOperator{ OP_JZ, PRIORITY_CONDITION, ASSOC_RIGHT, 0, 0 };
+  t.binary[':'] = TOperator{ OP_JZ, PRIORITY_CONDITION, ASSOC_RIGHT, 0, 0 };
+  t.unary['-'] = TOperator{ OP_NEG, 3, ASSOC_RIGHT, 0, 0 };
+  return t;
+}
+
+bool CanRegister(char symbol)
+{
+  const unsigned char c = static_cast<unsigned char>(symbol);
+  if (c == 0 || c >= 0x80 || IsIdentChar(symbol) || std::isspace(c) || std::strchr(".()=&|", c)
+    || std::iscntrl(c))
+    return false;
+  // встроенные операции не заменяются
+  const unsigned char b = TPostfix::BinaryOperator(c).op;
+  const unsigned char u = TPostfix::UnaryOperator(c).op;
+  return (b == OP_END || b == OP_CALL2) && (u == OP_END || u == OP_CALL1);
+}
+
+unsigned char FunctionCode(const std::string& name)
+{
+  if (name == "sin")
+    return OP_SIN;
+  if (name == "cos")
+    return OP_COS;
+  if (name == "ln")
+    return OP_LN;
+  return OP_EXP;
+}
+
+
+} // namespace
+
+const size_t TPostfix::NO_PAIR;
+
+TOperatorTable TPostfix::operators = MakeOperatorTable();
+
+void TPostfix::RegisterOperator(char symbol, int priority, TAssociativity associativity,
+  double (*binary)(double, double))
+{
+  if (!CanRegister(symbol) || priority < 1 || !binary)
+    throw std::invalid_argument(std::string("cannot register binary operator '") + symbol + "'");
+  const TOperator op = { OP_CALL2, priority, associativity, 0, binary };
+  operators.binary[static_cast<unsigned char>(symbol)] = op;
+}
+
+void TPostfix::RegisterOperator(char symbol, int priority, double (*unary)(double))
+{
+  if (!CanRegister(symbol) || priority < 1 || !unary)
+    throw std::invalid_argument(std::string("cannot register unary operator '") + symbol + "'");
+  const TOperator op = { OP_CALL1, priority, ASSOC_RIGHT, unary, 0 };
+  operators.unary[static_cast<unsigned char>(symbol)] = op;
+}
+
+TPostfix::TPostfix(const std::string& expr) : infix(expr), engine(ENGINE_STACK), integer(false)
+{
+  registerProgram.registers = 0;
+  const TCheckResult check = Check(infix);
+  if (!check.ok)
+    throw TExpressionError(check.message, check.pos);
+  Parse();
+  MatchBrackets();
+  ToPostfix();
+  Compile();
+}
+
+TPostfix::TCheckResult TPostfix::Check(const char* s, size_t n)
+{
+  int state = CS_START;
+  size_t depth = 0;
+  // '?', для которых еще не было ':': позиция и глубина скобок
+  const size_t MAX_CONDITIONS = 64;
+  size_t conditionPos[MAX_CONDITIONS];
+  size_t conditionDepth[MAX_CONDITIONS];
+  size_t conditions = 0;
+  size_t i = 0;
+  for (;;)
+  {
+    while (i < n && std::isspace(static_cast<unsigned char>(s[i])))
+      i++;
+    const size_t pos = i;
+    int cls;
+    if (i == n)
+      cls = TC_END;
+    else if (IsDigit(s[i]) || s[i] == '.')
+    {
+      i = ScanNumber(s, i, n);
+      if (i == pos)
+        return Failure(pos, "number expected");
+      cls = TC_OPERAND;
+    }
+    else if (IsIdentStart(s[i]))
+    {
+      i = ScanIdentifier(s, i, n);
+      cls = IsFunctionName(s + pos, i - pos) ? TC_FUNCTION : TC_OPERAND;
+    }
+    else
+    {
+      const unsigned char c = static_cast<unsigned char>(s[i++]);
+      if (c == '(')
+      {
+        cls = TC_LEFT;
+        depth++;
+      }
+      else if (c == ')')
+      {
+        if (depth == 0)
+          return Failure(pos, "unmatched ')'");
+        cls = TC_RIGHT;
+        depth--;
+      }
+      else if (FindLongOperator(s, pos, n))
+      {
+        cls = TC_OPERATION;
+        i++;
+      }
+      else
+      {
+        const bool binary = operators.binary[c].op != OP_END;
+        const bool unary = operators.unary[c].op != OP_END;
+        if (!binary && !unary)
+          return Failure(pos, "invalid character");
+        cls = binary ? (unary ? TC_MINUS : TC_OPERATION) : TC_PREFIX;
+      }
+    }
+
+    const int next = CHECK_TABLE[state][cls];
+    if (next < 0)
+      return Failure(pos, CHECK_MESSAGES[-next]);
+    if (next == CS_ACCEPT)
+      break;
+    state = next;
+
+    // ':' относится к последнему '?' внутри тех же скобок
+    if (cls == TC_OPERATION && i == pos + 1 && s[pos] == '?')
+    {
+      if (conditions == MAX_CONDITIONS)
+        return Failure(pos, "conditional operators are nested too deeply");
+      conditionPos[conditions] = pos;
+      conditionDepth[conditions++] = depth;
+    }
+    else if (cls == TC_OPERATION && i == pos + 1 && s[pos] == ':')
+    {
+      if (conditions == 0 || conditionDepth[conditions - 1] != depth)
+        return Failure(pos, "':' without matching '?'");
+      conditions--;
+    }
+    else if (cls == TC_RIGHT && conditions > 0 && conditionDepth[conditions - 1] > depth)
+      return Failure(conditionPos[conditions - 1], "'?' without matching ':'");
+  }
+  if (depth != 0)
+    return Failure(FindUnclosedBracket(s, n), "unmatched '('");
+  if (conditions > 0)
+    return Failure(conditionPos[conditions - 1], "'?' without matching ':'");
+
+  TCheckResult r;
+  r.ok = true;
+  r.pos = 0;
+  r.message = "";
+  return r;
+}
+
+namespace
+{
+
+struct TLinesChunk
+{
+  size_t lines;
+  std::vector<TPostfix::TLineError> errors; // номера строк - от начала части
+};
+
+void CheckChunk(const char* s, size_t n, TLinesChunk* chunk)
+{
+  chunk->lines = 0;
+  size_t begin = 0;
+  while (begin < n)
+  {
+    const char* eol = static_cast<const char*>(std::memchr(s + begin, '\n', n - begin));
+    const size_t end = eol ? static_cast<size_t>(eol - s) : n;
+    size_t len = end - begin;
+    if (len > 0 && s[begin + len - 1] == '\r')
+      len--;
+    chunk->lines++;
+
+    size_t first = begin;
+    while (first < begin + len && std::isspace(static_cast<unsigned char>(s[first])))
+      first++;
+    if (first < begin + len)
+    {
+      const TPostfix::TCheckResult r = TPostfix::Check(s + begin, len);
+      if (!r.ok)
+      {
+        TPostfix::TLineError e;
+        e.line = chunk->lines;
+        e.column = r.pos + 1;
+        e.message = r.message;
+        chunk->errors.push_back(e);
+      }
+    }
+    begin = end + 1;
+  }
+}
+
+} // namespace
+
+TPostfix::TLinesCheckResult TPostfix::CheckLines(const char* text, size_t len, unsigned threads)
+{
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  if (threads == 0)
+    threads = 1;
+
+  // границы частей сдвигаются на начало следующей строки
+  std::vector<size_t> bounds(1, 0);
+  for (unsigned k = 1; k < threads; k++)
+  {
+    size_t b = len / threads * k;
+    if (b < bounds.back())
+      b = bounds.back();
+    const char* eol = b < len ? static_cast<const char*>(std::memchr(text + b, '\n', len - b)) : 0;
+    bounds.push_back(eol ? static_cast<size_t>(eol - text) + 1 : len);
+  }
+  bounds.push_back(len);
+
+  // у каждого потока свой список ошибок, общих данных при проверке нет
+  std::vector<TLinesChunk> chunks(threads);
+  std::vector<std::thread> workers;
+  for (unsigned k = 1; k < threads; k++)
+    workers.push_back(std::thread(CheckChunk, text + bounds[k], bounds[k + 1] - bounds[k], &chunks[k]));
+  CheckChunk(text, bounds[1], &chunks[0]);
+  for (size_t k = 0; k < workers.size(); k++)
+    workers[k].join();
+
+  TLinesCheckResult res;
+  res.lines = 0;
+  for (unsigned k = 0; k < threads; k++)
+  {
+    for (size_t e = 0; e < chunks[k].errors.size(); e++)
+    {
+      chunks[k].errors[e].line += res.lines;
+      res.errors.push_back(chunks[k].errors[e]);
+    }
+    res.lines += chunks[k].lines;
+  }
+  return res;
+}
+
+void TPostfix::Parse()
+{
+  // выражение уже проверено автоматом, здесь только выделяются лексемы
+  const char* s = infix.c_str();
+  const size_t n = infix.size();
+  size_t i = 0;
+  while (i < n)
+  {
+    const char c = s[i];
+    if (std::isspace(static_cast<unsigned char>(c)))
+    {
+      i++;
+      continue;
+    }
+    TLexeme lex;
+    lex.pos = i;
+    lex.value = 0.0;
+    if (IsDigit(c) || c == '.')
+    {
+      const size_t j = ScanNumber(s, i, n);
+      lex.type = LEX_NUMBER;
+      lex.text = infix.substr(i, j - i);
+      lex.value = std::strtod(lex.text.c_str(), 0);
+      i = j;
+    }
+    else if (IsIdentStart(c))
+    {
+      const size_t j = ScanIdentifier(s, i, n);
+      lex.type = IsFunctionName(s + i, j - i) ? LEX_FUNCTION : LEX_VARIABLE;
+      lex.text = infix.substr(i, j - i);
+      i = j;
+    }
+    else
+    {
+      lex.text = std::string(1, c);
+      switch (c)
+      {
+      case '(': lex.type = LEX_LEFT_BRACKET; break;
+      case ')': lex.type = LEX_RIGHT_BRACKET; break;
+      default:
+        if (FindLongOperator(s, i, n))
+          lex.text = infix.substr(i, 2);
+        lex.type = ((lexemes.empty() || lexemes.back().type == LEX_LEFT_BRACKET)
+          && lex.text.size() == 1 && operators.unary[static_cast<unsigned char>(c)].op != OP_END)
+          ? LEX_UNARY_MINUS : LEX_OPERATION;
+        break;
+      }
+      i += lex.text.size();
+    }
+    lexemes.push_back(lex);
+  }
+
+  for (size_t k = 0; k < lexemes.size(); k++)
+  {
+    if (lexemes[k].type != LEX_VARIABLE)
+      continue;
+    bool known = false;
+    for (size_t v = 0; v < variables.size() && !known; v++)
+      known = variables[v] == lexemes[k].text;
+    if (!known)
+      variables.push_back(lexemes[k].text);
+  }
+}
+
+void TPostfix::MatchBrackets()
+{
+  pairs.assign(lexemes.size(), NO_PAIR);
+  TStack<size_t> open;
+  for (size_t i = 0; i < lexemes.size(); i++)
+  {
+    if (lexemes[i].type == LEX_LEFT_BRACKET)
+      open.Push(i);
+    else if (lexemes[i].type == LEX_RIGHT_BRACKET)
+    {
+      const size_t j = open.Pop();
+      pairs[i] = j;
+      pairs[j] = i;
+    }
+  }
+}
+
+void TPostfix::ToPostfix()
+{
+  // функция не кладется в стек операций: при закрытии скобки ее
+  // аргумента она находится по индексу пары открывающей скобки
+  TStack<size_t> ops;
+  for (size_t i = 0; i < lexemes.size(); i++)
+  {
+    const TLexeme& lex = lexemes[i];
+    switch (lex.type)
+    {
+    case LEX_NUMBER:
+    case LEX_VARIABLE:
+      postfix.push_back(i);
+      break;
+    case LEX_FUNCTION:
+      break;
+    case LEX_LEFT_BRACKET:
+      ops.Push(i);
+      break;
+    case LEX_RIGHT_BRACKET:
+    {
+      while (ops.Top() != pairs[i])
+        postfix.push_back(ops.Pop());
+      ops.Pop();
+      const size_t open = pairs[i];
+      if (open > 0 && lexemes[open - 1].type == LEX_FUNCTION)
+        postfix.push_back(open - 1);
+      break;
+    }
+    case LEX_UNARY_MINUS:
+      ops.Push(i);
+      break;
+    case LEX_OPERATION:
+    {
+      if (lex.text == ":")
+      {
+        // ветвь "то" закончена: выталкиваются ее операции, '?' в стеке
+        // заменяется на ':', который и попадет в постфиксную запись
+        while (lexemes[ops.Top()].text != "?")
+          postfix.push_back(ops.Pop());
+        ops.Top() = i;
+        break;
+      }
+      // левоассоциативная операция выталкивает операции того же
+      // приоритета, правоассоциативная - только более высокого
+      const TOperator& op = LexemeOperator(lex);
+      const int limit = op.associativity == ASSOC_LEFT ? op.priority : op.priority + 1;
+      while (!ops.IsEmpty() && lexemes[ops.Top()].type != LEX_LEFT_BRACKET
+        && LexemeOperator(lexemes[ops.Top()]).priority >= limit)
+        postfix.push_back(ops.Pop());
+      ops.Push(i);
+      break;
+    }
+    }
+  }
+  while (!ops.IsEmpty())
+    postfix.push_back(ops.Pop());
+}
+
+std::string TPostfix::GetPostfix() const
+{
+  std::string res;
+  for (size_t i = 0; i < postfix.size(); i++)
+  {
+    if (i > 0)
+      res += ' ';
+    const TLexeme& lex = lexemes[postfix[i]];
+    if (lex.type == LEX_UNARY_MINUS && lex.text == "-")
+      res += '~';
+    else
+      res += lex.text == ":" ? "?:" : lex.text;
+  }
+  return res;
+}
+
+std::string TPostfix::GetSubexpression(size_t i) const
+{
+  const size_t j = pairs[i];
+  if (j == NO_PAIR)
+    throw std::invalid_argument("lexeme is not a bracket");
+  const size_t open = i < j ? i : j;
+  const size_t close = i < j ? j : i;
+  const size_t from = lexemes[open].pos + 1;
+  return infix.substr(from, lexemes[close].pos - from);
+}
+
+void TPostfix::Compile()
+{
+  TProgramBuilder builder;
+  for (size_t i = 0; i < postfix.size(); i++)
+  {
+    const TLexeme& lex = lexemes[postfix[i]];
+    switch (lex.type)
+    {
+    case LEX_NUMBER:
+      builder.Constant(lex.value);
+      break;
+    case LEX_VARIABLE:
+    {
+      size_t slot = 0;
+      while (variables[slot] != lex.text)
+        slot++;
+      builder.Emit(OP_VAR, slot);
+      break;
+    }
+    case LEX_FUNCTION:
+      builder.Emit(FunctionCode(lex.text));
+      break;
+    case LEX_UNARY_MINUS:
+    case LEX_OPERATION:
+    {
+      const unsigned char op = LexemeOperator(lex).op;
+      if (op == OP_POW)
+        builder.Power();
+      else if (op == OP_JZ)
+        builder.Select();
+      else if (op == OP_JZ_OR_POP || op == OP_JNZ_OR_POP)
+      {
+        builder.Emit(OP_BOOL);
+        builder.ShortCircuit(op);
+      }
+      else if (HasOperand(op))
+        builder.Emit(op, static_cast<unsigned char>(lex.text[0]));
+      else
+        builder.Emit(op);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+  program = builder.Finish();
+  PrepareInteger();
+}
+
+void TPostfix::PrepareInteger()
+{
+  integer = IsIntegerProgram(program);
+  integerConstants.clear();
+  if (integer)
+    for (size_t i = 0; i < program.constants.size(); i++)
+      integerConstants.push_back(static_cast<long long>(program.constants[i]));
+}
+
+const size_t TProgramBuilder::NO_CONSTANT;
+
+void TProgramBuilder::Emit(unsigned char op)
+{
+  const size_t start = Operands(op) > 0 ? starts[starts.size() - Operands(op)] : prog.code.size();
+  starts.resize(starts.size() - Operands(op));
+  starts.push_back(start);
+  prog.code.push_back(op);
+  depth += StackEffect(op);
+  lastConstant = NO_CONSTANT;
+}
+
+void TProgramBuilder::Emit(unsigned char op, size_t operand)
+{
+  if (operand > 0xFFFF)
+    throw std::length_error("too many constants or variables in expression");
+  const size_t start = Operands(op) > 0 ? starts[starts.size() - Operands(op)] : prog.code.size();
+  starts.resize(starts.size() - Operands(op));
+  starts.push_back(start);
+  lastConstant = NO_CONSTANT;
+  depth += StackEffect(op);
+  if (depth > prog.depth)
+    prog.depth = depth;
+  prog.code.push_back(op);
+  prog.code.push_back(static_cast<unsigned char>(operand & 0xFF));
+  prog.code.push_back(static_cast<unsigned char>(operand >> 8));
+}
+
+void TProgramBuilder::Constant(double value)
+{
+  unsigned long long bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  std::map<unsigned long long, size_t>::const_iterator it = pool.find(bits);
+  size_t index;
+  const bool added = it == pool.end();
+  if (!added)
+    index = it->second;
+  else
+  {
+    index = prog.constants.size();
+    prog.constants.push_back(value);
+    pool[bits] = index;
+  }
+  const size_t offset = prog.code.size();
+  const size_t maxDepth = prog.depth;
+  Emit(OP_CONST, index);
+  lastConstant = offset;
+  lastConstantNew = added;
+  depthBeforeConstant = maxDepth;
+}
+
+void TProgramBuilder::Power()
+{
+  if (lastConstant != NO_CONSTANT)
+  {
+    const size_t index = prog.code[lastConstant + 1] | (prog.code[lastConstant + 2] << 8);
+    const double e = prog.constants[index];
+    if (e == std::floor(e) && std::fabs(e) <= POWI_LIMIT)
+    {
+      if (lastConstantNew)
+      {
+        unsigned long long bits;
+        std::memcpy(&bits, &e, sizeof(bits));
+        pool.erase(bits);
+        prog.constants.pop_back();
+      }
+      prog.code.resize(lastConstant);
+      starts.pop_back();
+      depth--;
+      prog.depth = depthBeforeConstant;
+      Emit(OP_POWI, static_cast<unsigned short>(static_cast<int>(e)));
+      return;
+    }
+  }
+  Emit(OP_POW);
+}
+
+void TProgramBuilder::Insert(size_t offset, unsigned char jump, size_t distance)
+{
+  if (distance > 0xFFFF)
+    throw std::length_error("conditional branch is too long");
+  const unsigned char code[] =
+  {
+    jump, static_cast<unsigned char>(distance & 0xFF), static_cast<unsigned char>(distance >> 8)
+  };
+  prog.code.insert(prog.code.begin() + offset, code, code + sizeof(code));
+  lastConstant = NO_CONSTANT;
+  jumps = true;
+}
+
+void TProgramBuilder::Select()
+{
+  const size_t b = starts.back();
+  starts.pop_back();
+  const size_t a = starts.back();
+  starts.pop_back();
+  // сначала вставка дальше от начала, чтобы смещение a не изменилось
+  Insert(b, OP_JMP, prog.code.size() - b);
+  Insert(a, OP_JZ, b + 3 - a);
+  depth -= 2;
+}
+
+void TProgramBuilder::ShortCircuit(unsigned char jump)
+{
+  const size_t b = starts.back();
+  starts.pop_back();
+  Insert(b, jump, prog.code.size() - b);
+  depth--;
+}
+
+size_t TProgramBuilder::Output()
+{
+  if (starts.empty())
+    throw std::logic_error("no value to output");
+  starts.pop_back();
+  depth--;
+  outputs = true;
+  lastConstant = NO_CONSTANT;
+  return prog.code.size();
+}
+
+TProgram TProgramBuilder::Finish()
+{
+  prog.code.push_back(OP_END);
+  // при переходах значения разных ветвей не лежат в стеке одновременно,
+  // и глубина, посчитанная подряд по операциям, завышена; программу из
+  // нескольких выражений StackDepth не проверяет
+  if (jumps && !outputs)
+    prog.depth = StackDepth(&prog.code[0]);
+  pool.clear();
+  starts.clear();
+  jumps = false;
+  outputs = false;
+  TProgram res;
+  res.code.swap(prog.code);
+  res.constants.swap(prog.constants);
+  res.temps = prog.temps;
+  res.depth = prog.depth;
+  prog.temps = 0;
+  prog.depth = 0;
+  depth = 0;
+  lastConstant = NO_CONSTANT;
+  return res;
+}
+
+size_t StackDepth(const unsigned char* code)
+{
+  // глубина стека в местах, куда ведут еще не пройденные переходы
+  std::map<const unsigned char*, size_t> labels;
+  size_t depth = 0, maxDepth = 0;
+  bool reachable = true; // false сразу после OP_JMP
+  for (const unsigned char* pc = code;; pc += HasOperand(*pc) ? 3 : 1)
+  {
+    const std::map<const unsigned char*, size_t>::iterator label = labels.find(pc);
+    if (label != labels.end())
+    {
+      if (reachable && label->second != depth)
+        throw std::logic_error("stack depth differs at jump target");
+      depth = label->second;
+      reachable = true;
+      labels.erase(label);
+    }
+    else if (!reachable)
+      throw std::logic_error("unreachable bytecode");
+    if (*pc == OP_END)
+      break;
+
+    if (depth < Operands(*pc))
+      throw std::logic_error("stack underflow in bytecode");
+    if (IsJump(*pc))
+    {
+      // при переходе по OP_JZ условие снято, у остальных переходов
+      // значение остается в стеке
+      const size_t target = depth - (*pc == OP_JZ ? 1 : 0);
+      const std::pair<std::map<const unsigned char*, size_t>::iterator, bool> r =
+        labels.insert(std::make_pair(pc + 3 + (pc[1] | (pc[2] << 8)), target));
+      if (!r.second && r.first->second != target)
+        throw std::logic_error("stack depth differs at jump target");
+      reachable = *pc != OP_JMP;
+    }
+    depth += StackEffect(*pc);
+    if (depth > maxDepth)
+      maxDepth = depth;
+  }
+  if (!labels.empty())
+    throw std::logic_error("jump target is not an instruction");
+  if (depth != 1)
+    throw std::logic_error("bytecode must leave exactly one value");
+  return maxDepth;
+}
+
+template <class T>
+T Execute(const unsigned char* code, const double* constants, const T* vars,
+  size_t temps, size_t depth)
+{
+  if (depth == 0)
+    depth = StackDepth(code);
+
+  // ячейки и стек в одном буфере: сначала ячейки, затем стек
+  const size_t LOCAL_SIZE = 32;
+  T local[LOCAL_SIZE];
+  std::vector<T> heap;
+  T* t = local;
+  if (temps + depth > LOCAL_SIZE)
+  {
+    heap.resize(temps + depth);
+    t = &heap[0];
+  }
+  T* sp = t + temps - 1; // указывает на вершину стека
+
+  for (const unsigned char* pc = code;;)
+  {
+    switch (*pc++)
+    {
+    case OP_END:
+      return *sp;
+    case OP_CONST:
+      *++sp = static_cast<T>(constants[pc[0] | (pc[1] << 8)]);
+      pc += 2;
+      break;
+    case OP_VAR:
+      *++sp = vars[pc[0] | (pc[1] << 8)];
+      pc += 2;
+      break;
+    case OP_ADD: sp[-1] += sp[0]; sp--; break;
+    case OP_SUB: sp[-1] -= sp[0]; sp--; break;
+    case OP_MUL: sp[-1] *= sp[0]; sp--; break;
+    case OP_DIV: sp[-1] /= sp[0]; sp--; break;
+    case OP_NEG: *sp = -*sp; break;
+    case OP_SIN: *sp = std::sin(*sp); break;
+    case OP_COS: *sp = std::cos(*sp); break;
+    case OP_LN: *sp = std::log(*sp); break;
+    case OP_EXP: *sp = std::exp(*sp); break;
+    case OP_STORE:
+      t[pc[0] | (pc[1] << 8)] = *sp;
+      pc += 2;
+      break;
+    case OP_LOAD:
+      *++sp = t[pc[0] | (pc[1] << 8)];
+      pc += 2;
+      break;
+    case OP_CALL1:
+      *sp = static_cast<T>(TPostfix::UnaryOperator(pc[0]).unary(static_cast<double>(*sp)));
+      pc += 2;
+      break;
+    case OP_CALL2:
+      sp[-1] = static_cast<T>(TPostfix::BinaryOperator(pc[0]).binary(static_cast<double>(sp[-1]),
+        static_cast<double>(sp[0])));
+      sp--;
+      pc += 2;
+      break;
+    case OP_POW: sp[-1] = std::pow(sp[-1], sp[0]); sp--; break;
+    case OP_POWI:
+      *sp = PowI(*sp, static_cast<short>(pc[0] | (pc[1] << 8)));
+      pc += 2;
+      break;
+    case OP_LT: sp[-1] = sp[-1] < sp[0] ? T(1) : T(0); sp--; break;
+    case OP_LE: sp[-1] = sp[-1] <= sp[0] ? T(1) : T(0); sp--; break;
+    case OP_EQ: sp[-1] = sp[-1] == sp[0] ? T(1) : T(0); sp--; break;
+    case OP_BOOL: *sp = *sp != 0 ? T(1) : T(0); break;
+    case OP_JMP:
+      pc += 2 + (pc[0] | (pc[1] << 8));
+      break;
+    case OP_JZ:
+      pc += 2 + (*sp-- == 0 ? pc[0] | (pc[1] << 8) : 0);
+      break;
+    case OP_JZ_OR_POP:
+      if (*sp == 0)
+      {
+        *sp = 0;
+        pc += 2 + (pc[0] | (pc[1] << 8));
+      }
+      else
+      {
+        sp--;
+        pc += 2;
+      }
+      break;
+    case OP_JNZ_OR_POP:
+      if (*sp != 0)
+      {
+        *sp = 1;
+        pc += 2 + (pc[0] | (pc[1] << 8));
+      }
+      else
+      {
+        sp--;
+        pc += 2;
+      }
+      break;
+    default:
+      throw std::logic_error("invalid opcode");
+    }
+  }
+}
+
+template float Execute<float>(const unsigned char*, const double*, const float*, size_t, size_t);
+template double Execute<double>(const unsigned char*, const double*, const double*, size_t, size_t);
+template long double Execute<long double>(const unsigned char*, const double*, const long double*, size_t, size_t);
+
+namespace
+{
+
+// значение double - целое число в пределах int64 и не -0
+bool IsIntegral(double x)
+{
+  // сначала диапазон: перевод в int64 значения вне него не определен
+  return x >= -9223372036854775808.0 && x < 9223372036854775808.0
+    && static_cast<double>(static_cast<long long>(x)) == x && !(x == 0.0 && std::signbit(x));
+}
+
+// операции int64 с проверкой переполнения: false, если результат
+// не представим
+#if defined(__GNUC__) || defined(__clang__)
+bool Add(long long a, long long b, long long& r) { return !__builtin_add_overflow(a, b, &r); }
+bool Sub(long long a, long long b, long long& r) { return !__builtin_sub_overflow(a, b, &r); }
+bool Mul(long long a, long long b, long long& r) { return !__builtin_mul_overflow(a, b, &r); }
+#else
+bool Add(long long a, long long b, long long& r)
+{
+  if ((b > 0 && a > LLONG_MAX - b) || (b < 0 && a < LLONG_MIN - b))
+    return false;
+  r = a + b;
+  return true;
+}
+
+bool Sub(long long a, long long b, long long& r)
+{
+  if ((b < 0 && a > LLONG_MAX + b) || (b > 0 && a < LLONG_MIN + b))
+    return false;
+  r = a - b;
+  return true;
+}
+
+bool Mul(long long a, long long b, long long& r)
+{
+  if (a == 0 || b == 0)
+  {
+    r = 0;
+    return true;
+  }
+  if ((a == -1 && b == LLONG_MIN) || (b == -1 && a == LLONG_MIN))
+    return false;
+  const long long p = static_cast<long long>(static_cast<unsigned long long>(a) * static_cast<unsigned long long>(b));
+  if (p / b != a)
+    return false;
+  r = p;
+  return true;
+}
+#endif
+
+// x^n умножениями в том же порядке, что и PowI, n >= 0
+bool PowInteger(long long x, unsigned n, long long& r)
+{
+  long long result = 1;
+  long long base = x;
+  while (n != 0)
+  {
+    if ((n & 1) && !Mul(result, base, result))
+      return false;
+    n >>= 1;
+    if (n != 0 && !Mul(base, base, base))
+      return false;
+  }
+  r = result;
+  return true;
+}
+
+} // namespace
+
+bool IsIntegerProgram(const TProgram& prog)
+{
+  for (size_t i = 0; i < prog.constants.size(); i++)
+    if (!IsIntegral(prog.constants[i]))
+      return false;
+  for (const unsigned char* pc = &prog.code[0]; *pc != OP_END; pc += HasOperand(*pc) ? 3 : 1)
+  {
+    switch (*pc)
+    {
+    case OP_CONST:
+    case OP_VAR:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_NEG:
+    case OP_STORE:
+    case OP_LOAD:
+      break;
+    case OP_POWI:
+      if (static_cast<short>(pc[1] | (pc[2] << 8)) < 0)
+        return false;
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ExecuteInteger(const unsigned char* code, const long long* constants, const long long* vars,
+  size_t temps, size_t depth, long long& result)
+{
+  if (depth == 0)
+    depth = StackDepth(code);
+
+  const size_t LOCAL_SIZE = 32;
+  long long local[LOCAL_SIZE];
+  std::vector<long long> heap;
+  long long* t = local;
+  if (temps + depth > LOCAL_SIZE)
+  {
+    heap.resize(temps + depth);
+    t = &heap[0];
+  }
+  long long* sp = t + temps - 1;
+
+  for (const unsigned char* pc = code;;)
+  {
+    switch (*pc++)
+    {
+    case OP_END:
+      result = *sp;
+      return true;
+    case OP_CONST:
+      *++sp = constants[pc[0] | (pc[1] << 8)];
+      pc += 2;
+      break;
+    case OP_VAR:
+      *++sp = vars[pc[0] | (pc[1] << 8)];
+      pc += 2;
+      break;
+    case OP_ADD:
+      if (!Add(sp[-1], sp[0], sp[-1]))
+        return false;
+      sp--;
+      break;
+    case OP_SUB:
+      if (!Sub(sp[-1], sp[0], sp[-1]))
+        return false;
+      sp--;
+      break;
+    case OP_MUL:
+      if (!Mul(sp[-1], sp[0], sp[-1]))
+        return false;
+      sp--;
+      break;
+    case OP_NEG:
+      if (!Sub(0, *sp, *sp))
+        return false;
+      break;
+    case OP_STORE:
+      t[pc[0] | (pc[1] << 8)] = *sp;
+      pc += 2;
+      break;
+    case OP_LOAD:
+      *++sp = t[pc[0] | (pc[1] << 8)];
+      pc += 2;
+      break;
+    case OP_POWI:
+      if (!PowInteger(*sp, static_cast<unsigned>(pc[0] | (pc[1] << 8)), *sp))
+        return false;
+      pc += 2;
+      break;
+    default:
+      throw std::logic_error("operation is not integer");
+    }
+  }
+}
+
+namespace
+{
+
+// место, куда ведет еще не пройденный переход
+struct TRegisterLabel
+{
+  static const size_t NO_JOIN = static_cast<size_t>(-1);
+
+  const unsigned char* target;
+  size_t jump; // индекс команды перехода, у которой нужно заполнить dst
+  // регистр, в который обе ветви кладут результат; NO_JOIN - начало
+  // ветви "иначе", тогда stack и free - состояние на момент перехода
+  size_t join;
+  TStack<size_t> stack;
+  TStack<size_t> free;
+};
+
+// временный регистр, который можно занять под результат команды
+bool Reusable(size_t r, size_t firstTemp, const std::vector<bool>& pinned)
+{
+  return r >= firstTemp && !(r - firstTemp < pinned.size() && pinned[r - firstTemp]);
+}
+
+void Copy(TRegisterProgram& res, size_t dst, size_t src)
+{
+  if (dst > 0xFFFF)
+    throw std::length_error("too many registers in expression");
+  TInstruction ins;
+  ins.op = OP_STORE;
+  ins.symbol = 0;
+  ins.dst = static_cast<unsigned short>(dst);
+  ins.a = static_cast<unsigned short>(src);
+  ins.b = 0;
+  res.code.push_back(ins);
+}
+
+// переход с индексом jump ведет к следующей добавленной команде
+void SetTarget(TRegisterProgram& res, size_t jump)
+{
+  if (res.code.size() > 0xFFFF)
+    throw std::length_error("too many instructions in expression");
+  res.code[jump].dst = static_cast<unsigned short>(res.code.size());
+}
+
+} // namespace
+
+TRegisterProgram TranslateToRegisters(const TProgram& prog, size_t varCount)
+{
+  TRegisterProgram res;
+  const size_t firstTemp = varCount + prog.constants.size();
+  size_t temps = 0;
+  TStack<size_t> st;   // регистры, в которых лежат значения стека
+  TStack<size_t> free; // освободившиеся временные регистры
+  // регистр каждой временной ячейки байт-кода; такой регистр закреплен:
+  // он не освобождается и не становится результатом другой команды
+  std::vector<size_t> stored(prog.temps);
+  std::vector<bool> pinned;
+  // переходы вложены друг в друга, последний ведет ближе всех
+  std::vector<TRegisterLabel> labels;
+
+  for (const unsigned char* pc = &prog.code[0];;)
+  {
+    // копирование в общий регистр выполняется только в ветви, из
+    // которой не было перехода
+    while (!labels.empty() && labels.back().target == pc)
+    {
+      const size_t join = labels.back().join;
+      const size_t x = st.Pop();
+      if (x != join)
+      {
+        Copy(res, join, x);
+        if (Reusable(x, firstTemp, pinned))
+          free.Push(x);
+      }
+      SetTarget(res, labels.back().jump);
+      labels.pop_back();
+      st.Push(join);
+    }
+    if (*pc == OP_END)
+      break;
+
+    const unsigned char op = *pc++;
+    size_t operand = 0;
+    if (HasOperand(op))
+    {
+      operand = pc[0] | (pc[1] << 8);
+      pc += 2;
+    }
+    if (op == OP_CONST || op == OP_VAR || op == OP_STORE || op == OP_LOAD)
+    {
+      if (op == OP_VAR)
+        st.Push(operand);
+      else if (op == OP_CONST)
+        st.Push(varCount + operand);
+      else if (op == OP_LOAD)
+        st.Push(stored[operand]);
+      else
+      {
+        stored[operand] = st.Top();
+        if (st.Top() >= firstTemp)
+        {
+          if (pinned.size() <= st.Top() - firstTemp)
+            pinned.resize(st.Top() - firstTemp + 1, false);
+          pinned[st.Top() - firstTemp] = true;
+        }
+      }
+      continue;
+    }
+
+    TInstruction ins;
+    ins.op = op;
+    ins.symbol = static_cast<unsigned char>(operand);
+    // у OP_POWI в b - показатель степени
+    ins.b = op == OP_POWI ? static_cast<unsigned short>(operand) : 0;
+    if (IsJump(op))
+    {
+      TRegisterLabel label;
+      label.target = pc + operand;
+      ins.a = 0;
+      ins.dst = 0;
+      if (op == OP_JZ)
+      {
+        const size_t c = st.Pop();
+        ins.a = static_cast<unsigned short>(c);
+        if (Reusable(c, firstTemp, pinned))
+          free.Push(c);
+        label.join = TRegisterLabel::NO_JOIN;
+        label.stack = st;
+        label.free = free;
+      }
+      else if (op == OP_JMP)
+      {
+        // конец ветви "то"; ветвь "иначе" начинается с того же состояния
+        // регистров, что было перед ветвью "то"
+        if (labels.empty() || labels.back().join != TRegisterLabel::NO_JOIN || labels.back().target != pc)
+          throw std::logic_error("unstructured jump in bytecode");
+        label.join = firstTemp + temps++;
+        Copy(res, label.join, st.Pop());
+        const TRegisterLabel otherwise = labels.back();
+        labels.pop_back();
+        res.code.push_back(ins);
+        label.jump = res.code.size() - 1;
+        labels.push_back(label);
+        SetTarget(res, otherwise.jump);
+        st = otherwise.stack;
+        free = otherwise.free;
+        continue;
+      }
+      else
+      {
+        // при переходе значение остается в своем регистре, поэтому его
+        // регистр и становится общим результатом
+        const size_t a = st.Pop();
+        label.join = Reusable(a, firstTemp, pinned) ? a : firstTemp + temps++;
+        if (label.join != a)
+          Copy(res, label.join, a);
+        ins.a = static_cast<unsigned short>(label.join);
+      }
+      res.code.push_back(ins);
+      label.jump = res.code.size() - 1;
+      labels.push_back(label);
+      continue;
+    }
+
+    size_t dst;
+    if (IsBinary(op))
+    {
+      const size_t b = st.Pop();
+      const size_t a = st.Pop();
+      ins.a = static_cast<unsigned short>(a);
+      ins.b = static_cast<unsigned short>(b);
+      const bool reuseA = Reusable(a, firstTemp, pinned);
+      const bool reuseB = Reusable(b, firstTemp, pinned);
+      if (reuseA)
+      {
+        dst = a;
+        if (reuseB)
+          free.Push(b);
+      }
+      else if (reuseB)
+        dst = b;
+      else
+        dst = free.IsEmpty() ? firstTemp + temps++ : free.Pop();
+    }
+    else
+    {
+      const size_t a = st.Pop();
+      ins.a = static_cast<unsigned short>(a);
+      dst = Reusable(a, firstTemp, pinned) ? a : (free.IsEmpty() ? firstTemp + temps++ : free.Pop());
+    }
+    if (dst > 0xFFFF)
+      throw std::length_error("too many registers in expression");
+    ins.dst = static_cast<unsigned short>(dst);
+    res.code.push_back(ins);
+    st.Push(dst);
+  }
+  res.variables = varCount;
+  res.constants = prog.constants.size();
+  res.registers = firstTemp + temps;
+  res.result = static_cast<unsigned short>(st.Pop());
+  return res;
+}
+
+double ExecuteRegisters(const TRegisterProgram& prog, const double* constants, const double* vars)
+{
+  const size_t LOCAL_REGISTERS = 64;
+  double local[LOCAL_REGISTERS];
+  std::vector<double> heap;
+  double* r = local;
+  if (prog.registers > LOCAL_REGISTERS)
+  {
+    heap.resize(prog.registers);
+    r = &heap[0];
+  }
+  if (prog.variables > 0)
+    std::memcpy(r, vars, prog.variables * sizeof(double));
+  if (prog.constants > 0)
+    std::memcpy(r + prog.variables, constants, prog.constants * sizeof(double));
+
+  const TInstruction* const begin = prog.code.empty() ? 0 : &prog.code[0];
+  const TInstruction* const end = begin + prog.code.size();
+  const TInstruction* ins = begin;
+  for (; ins != end; ins++)
+  {
+    switch (ins->op)
+    {
+    case OP_ADD: r[ins->dst] = r[ins->a] + r[ins->b]; break;
+    case OP_SUB: r[ins->dst] = r[ins->a] - r[ins->b]; break;
+    case OP_MUL: r[ins->dst] = r[ins->a] * r[ins->b]; break;
+    case OP_DIV: r[ins->dst] = r[ins->a] / r[ins->b]; break;
+    case OP_NEG: r[ins->dst] = -r[ins->a]; break;
+    case OP_SIN: r[ins->dst] = std::sin(r[ins->a]); break;
+    case OP_COS: r[ins->dst] = std::cos(r[ins->a]); break;
+    case OP_LN: r[ins->dst] = std::log(r[ins->a]); break;
+    case OP_EXP: r[ins->dst] = std::exp(r[ins->a]); break;
+    case OP_CALL1: r[ins->dst] = TPostfix::UnaryOperator(ins->symbol).unary(r[ins->a]); break;
+    case OP_CALL2: r[ins->dst] = TPostfix::BinaryOperator(ins->symbol).binary(r[ins->a], r[ins->b]); break;
+    case OP_POW: r[ins->dst] = std::pow(r[ins->a], r[ins->b]); break;
+    case OP_POWI: r[ins->dst] = PowI(r[ins->a], static_cast<short>(ins->b)); break;
+    case OP_LT: r[ins->dst] = r[ins->a] < r[ins->b] ? 1.0 : 0.0; break;
+    case OP_LE: r[ins->dst] = r[ins->a] <= r[ins->b] ? 1.0 : 0.0; break;
+    case OP_EQ: r[ins->dst] = r[ins->a] == r[ins->b] ? 1.0 : 0.0; break;
+    case OP_BOOL: r[ins->dst] = r[ins->a] != 0.0 ? 1.0 : 0.0; break;
+    case OP_STORE: r[ins->dst] = r[ins->a]; break;
+    // цикл сам переходит к следующей команде, поэтому индекс на 1 меньше
+    case OP_JMP: ins = begin + ins->dst - 1; break;
+    case OP_JZ:
+      if (r[ins->a] == 0.0)
+        ins = begin + ins->dst - 1;
+      break;
+    case OP_JZ_OR_POP:
+      if (r[ins->a] == 0.0)
+      {
+        r[ins->a] = 0.0;
+        ins = begin + ins->dst - 1;
+      }
+      break;
+    case OP_JNZ_OR_POP:
+      if (r[ins->a] != 0.0)
+      {
+        r[ins->a] = 1.0;
+        ins = begin + ins->dst - 1;
+      }
+      break;
+    default:
+      throw std::logic_error("invalid opcode");
+    }
+  }
+  return r[prog.result];
+}
+
+TOptimizeStats TPostfix::Optimize(unsigned flags)
+{
+  const TExprTree tree(program, flags);
+  TOptimizeStats stats;
+  stats.nodesBefore = 0;
+  for (const unsigned char* pc = &program.code[0]; *pc != OP_END; pc += HasOperand(*pc) ? 3 : 1)
+    if (*pc != OP_STORE)
+      stats.nodesBefore++;
+  stats.nodesAfter = tree.Reachable();
+  stats.shared = tree.Shared();
+  program = tree.Emit();
+  PrepareInteger();
+  if (registerProgram.registers != 0)
+    registerProgram = TranslateToRegisters(program, variables.size());
+  if (jit)
+    jit = TJitCode::Compile(program);
+  if (engine == ENGINE_JIT && !jit)
+    engine = ENGINE_STACK;
+  return stats;
+}
+
+size_t TPostfix::MemorySize() const
+{
+  size_t size = sizeof(*this) + infix.capacity();
+  for (size_t i = 0; i < lexemes.size(); i++)
+    size += sizeof(TLexeme) + lexemes[i].text.capacity();
+  size += pairs.capacity() * sizeof(size_t) + postfix.capacity() * sizeof(size_t);
+  for (size_t i = 0; i < variables.size(); i++)
+    size += sizeof(std::string) + variables[i].capacity();
+  size += program.code.capacity() + program.constants.capacity() * sizeof(double);
+  size += integerConstants.capacity() * sizeof(long long);
+  size += registerProgram.code.capacity() * sizeof(TInstruction);
+  if (jit)
+    size += jit->Size();
+  return size;
+}
+
+void TPostfix::SetEngine(TEngine e)
+{
+  if (e == ENGINE_REGISTER && registerProgram.registers == 0)
+    registerProgram = TranslateToRegisters(program, variables.size());
+  if (e == ENGINE_JIT && !jit)
+  {
+    jit = TJitCode::Compile(program);
+    if (!jit)
+      e = ENGINE_STACK;
+  }
+  engine = e;
+}
+
+bool TPostfix::CalculateInteger(const long long* values, long long& result) const
+{
+  if (!integer)
+    return false;
+  return ExecuteInteger(&program.code[0], integerConstants.empty() ? 0 : &integerConstants[0], values,
+    program.temps, program.depth, result);
+}
+
+double TPostfix::CalculateExact(const double* values) const
+{
+  // значения переменных переводятся в int64, если все они целые
+  const size_t LOCAL_SIZE = 16;
+  long long local[LOCAL_SIZE];
+  std::vector<long long> heap;
+  long long* slots = local;
+  if (variables.size() > LOCAL_SIZE)
+  {
+    heap.resize(variables.size());
+    slots = &heap[0];
+  }
+  bool exact = integer;
+  for (size_t i = 0; i < variables.size() && exact; i++)
+  {
+    exact = IsIntegral(values[i]);
+    if (exact)
+      slots[i] = static_cast<long long>(values[i]);
+  }
+  long long result = 0;
+  if (!exact || !CalculateInteger(slots, result))
+    return Calculate(values);
+  if (result != 0)
+    return static_cast<double>(result);
+  // точный результат - 0: у double берется только знак нуля (например,
+  // -a при a = 0 дает -0), округления в double его не меняют
+  return std::signbit(Calculate(values)) ? -0.0 : 0.0;
+}
+
+double TPostfix::Calculate(const double* values) const
+{
+  const double* constants = program.constants.empty() ? 0 : &program.constants[0];
+  if (engine == ENGINE_REGISTER)
+    return ExecuteRegisters(registerProgram, constants, values);
+  if (engine == ENGINE_JIT)
+    return jit->Run(values, constants);
+  return Execute(&program.code[0], constants, values, program.temps, program.depth);
+}
+
+template <class T>
+T TPostfix::Calculate(const T* values) const
+{
+  const double* constants = program.constants.empty() ? 0 : &program.constants[0];
+  return Execute(&program.code[0], constants, values, program.temps, program.depth);
+}
+
+template float TPostfix::Calculate<float>(const float*) const;
+template double TPostfix::Calculate<double>(const double*) const;
+template long double TPostfix::Calculate<long double>(const long double*) const;
+
+double TPostfix::CalculateGradient(const double* values, const size_t* wrt, size_t count, double* gradient) const
+{
+  for (size_t j = 0; j < count; j++)
+    if (wrt[j] >= variables.size())
+      throw std::out_of_range("variable index is out of range");
+  return ExecuteDual(program, values, wrt, count, gradient);
+}
+
+double TPostfix::CalculateGradient(const double* values, double* gradient) const
+{
+  std::vector<size_t> wrt(variables.size());
+  for (size_t i = 0; i < wrt.size(); i++)
+    wrt[i] = i;
+  return CalculateGradient(values, wrt.empty() ? 0 : &wrt[0], wrt.size(), gradient);
+}
+
+double TPostfix::Calculate(const std::map<std::string, double>& values) const
+{
+  std::vector<double> slots(variables.size());
+  for (size_t i = 0; i < variables.size(); i++)
+  {
+    std::map<std::string, double>::const_iterator it = values.find(variables[i]);
+    if (it == values.end())
+      throw std::invalid_argument("no value for variable '" + variables[i] + "'");
+    slots[i] = it->second;
+  }
+  return Calculate(slots.empty() ? 0 : &slots[0]);
+}
+
+void TPostfix::CalculateBatch(const double* const* columns, size_t rows, double* result,
+  TMathAccuracy accuracy) const
+{
+  ExecuteBatch(program, columns, rows, result, SimdSupported(), accuracy);
+}
+
+void TPostfix::CalculateBatch(const float* const* columns, size_t rows, float* result,
+  TMathAccuracy accuracy) const
+{
+  ExecuteBatch(program, columns, rows, result, SimdSupported(), accuracy);
+}
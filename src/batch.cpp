@@ -0,0 +1,392 @@
+// вычисление байт-кода блоками строк
+
+#include "batch.h"
+#include "tree.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+
+// sin, cos, ln или exp над n значениями x
+void ApplyMath(const TMathKernels& math, unsigned char op, double* x, size_t n, double*)
+{
+  switch (op)
+  {
+  case OP_SIN: math.sin(x, n); break;
+  case OP_COS: math.cos(x, n); break;
+  case OP_LN: math.ln(x, n); break;
+  default: math.exp(x, n); break;
+  }
+}
+
+// при MATH_LIBM - функции float, как в Execute<float>; многочлены есть
+// только для double, поэтому значения переводятся в double через scratch
+void ApplyMath(const TMathKernels& math, unsigned char op, float* x, size_t n, double* scratch)
+{
+  if (math.accuracy == MATH_LIBM)
+  {
+    switch (op)
+    {
+    case OP_SIN: for (size_t k = 0; k < n; k++) x[k] = std::sin(x[k]); break;
+    case OP_COS: for (size_t k = 0; k < n; k++) x[k] = std::cos(x[k]); break;
+    case OP_LN: for (size_t k = 0; k < n; k++) x[k] = std::log(x[k]); break;
+    default: for (size_t k = 0; k < n; k++) x[k] = std::exp(x[k]); break;
+    }
+    return;
+  }
+  for (size_t k = 0; k < n; k++)
+    scratch[k] = x[k];
+  ApplyMath(math, op, scratch, n, 0);
+  for (size_t k = 0; k < n; k++)
+    x[k] = static_cast<float>(scratch[k]);
+}
+
+// Элемент стека - столбец из BATCH_BLOCK значений типа T; sp указывает
+// на первый свободный столбец, вершина стека - столбец sp - BATCH_BLOCK.
+// K - ядра для T: TSimdKernels или TSimdFloatKernels.
+template <class T, class K>
+class TBatchRunner
+{
+  const TProgram& prog;
+  const T* const* columns;
+  const K& kernels;
+  const TMathKernels& math;
+  T* temps;       // temps столбцов, за ними стек
+  T* stack;
+  double* scratch; // столбец для ApplyMath
+  size_t offset;  // первая строка блока
+  size_t n;       // число строк в блоке
+
+  size_t Zeros(const T* x) const;
+  void Run(const unsigned char* pc, const unsigned char* end, T* sp) const;
+
+public:
+  TBatchRunner(const TProgram& p, const T* const* cols, const K& k, const TMathKernels& m, T* memory, double* s)
+    : prog(p), columns(cols), kernels(k), math(m), temps(memory), stack(memory + p.temps * BATCH_BLOCK), scratch(s),
+      offset(0), n(0) {}
+
+  // ends - концы кода выражений программы (см. TExprTree::Emit),
+  // значение выражения j записывается в results[j]
+  void Block(size_t first, size_t rows, const std::vector<size_t>& ends, T* const* results);
+};
+
+template <class T, class K>
+size_t TBatchRunner<T, K>::Zeros(const T* x) const
+{
+  size_t zeros = 0;
+  for (size_t k = 0; k < n; k++)
+    zeros += x[k] == 0;
+  return zeros;
+}
+
+// выполняет байт-код от pc до end; если условия перехода в блоке разные,
+// ветви выполняются рекурсивно над вершиной стека, а затем смешиваются
+template <class T, class K>
+void TBatchRunner<T, K>::Run(const unsigned char* pc, const unsigned char* end, T* sp) const
+{
+  const size_t B = BATCH_BLOCK;
+  while (pc != end)
+  {
+    const unsigned char op = *pc++;
+    size_t operand = 0;
+    if (HasOperand(op))
+    {
+      operand = pc[0] | (pc[1] << 8);
+      pc += 2;
+    }
+    T* x = sp - B;
+    T* y = sp - 2 * B;
+    switch (op)
+    {
+    case OP_CONST:
+      for (size_t k = 0; k < n; k++)
+        sp[k] = static_cast<T>(prog.constants[operand]);
+      sp += B;
+      break;
+    case OP_VAR:
+      for (size_t k = 0; k < n; k++)
+        sp[k] = columns[operand][offset + k];
+      sp += B;
+      break;
+    case OP_ADD: kernels.add(y, x, n); sp = x; break;
+    case OP_SUB: kernels.sub(y, x, n); sp = x; break;
+    case OP_MUL: kernels.mul(y, x, n); sp = x; break;
+    case OP_DIV: kernels.div(y, x, n); sp = x; break;
+    case OP_NEG: kernels.neg(x, n); break;
+    case OP_SIN:
+    case OP_COS:
+    case OP_LN:
+    case OP_EXP:
+      ApplyMath(math, op, x, n, scratch);
+      break;
+    case OP_STORE:
+      for (size_t k = 0; k < n; k++)
+        temps[operand * B + k] = x[k];
+      break;
+    case OP_LOAD:
+      for (size_t k = 0; k < n; k++)
+        sp[k] = temps[operand * B + k];
+      sp += B;
+      break;
+    case OP_CALL1:
+    {
+      double (*f)(double) = TPostfix::UnaryOperator(static_cast<unsigned char>(operand)).unary;
+      for (size_t k = 0; k < n; k++)
+        x[k] = static_cast<T>(f(static_cast<double>(x[k])));
+      break;
+    }
+    case OP_CALL2:
+    {
+      double (*f)(double, double) = TPostfix::BinaryOperator(static_cast<unsigned char>(operand)).binary;
+      for (size_t k = 0; k < n; k++)
+        y[k] = static_cast<T>(f(static_cast<double>(y[k]), static_cast<double>(x[k])));
+      sp = x;
+      break;
+    }
+    case OP_POW: for (size_t k = 0; k < n; k++) y[k] = std::pow(y[k], x[k]); sp = x; break;
+    case OP_POWI:
+    {
+      const int e = static_cast<short>(operand);
+      for (size_t k = 0; k < n; k++)
+        x[k] = PowI(x[k], e);
+      break;
+    }
+    case OP_LT: for (size_t k = 0; k < n; k++) y[k] = y[k] < x[k] ? T(1) : T(0); sp = x; break;
+    case OP_LE: for (size_t k = 0; k < n; k++) y[k] = y[k] <= x[k] ? T(1) : T(0); sp = x; break;
+    case OP_EQ: for (size_t k = 0; k < n; k++) y[k] = y[k] == x[k] ? T(1) : T(0); sp = x; break;
+    case OP_BOOL: for (size_t k = 0; k < n; k++) x[k] = x[k] != 0 ? T(1) : T(0); break;
+    case OP_JMP:
+      pc += operand;
+      break;
+    case OP_JZ:
+    {
+      const unsigned char* target = pc + operand;
+      const size_t zeros = Zeros(x);
+      sp = x;
+      if (zeros == n)
+        pc = target;
+      else if (zeros != 0)
+      {
+        // ветвь "то" заканчивается переходом за ветвь "иначе"; условие
+        // остается в стеке, над ним - результаты обеих ветвей
+        if (target[-3] != OP_JMP)
+          throw std::logic_error("unstructured jump in bytecode");
+        const unsigned char* join = target + (target[-2] | (target[-1] << 8));
+        Run(pc, target - 3, sp + B);
+        Run(target, join, sp + 2 * B);
+        for (size_t k = 0; k < n; k++)
+          x[k] = x[k] != 0 ? x[B + k] : x[2 * B + k];
+        sp += B;
+        pc = join;
+      }
+      break;
+    }
+    case OP_JZ_OR_POP:
+    {
+      const unsigned char* target = pc + operand;
+      const size_t zeros = Zeros(x);
+      if (zeros == 0)
+        sp = x;
+      else
+      {
+        if (zeros != n)
+          Run(pc, target, sp);
+        for (size_t k = 0; k < n; k++)
+          x[k] = x[k] == 0 ? T(0) : sp[k];
+        pc = target;
+      }
+      break;
+    }
+    case OP_JNZ_OR_POP:
+    {
+      const unsigned char* target = pc + operand;
+      const size_t zeros = Zeros(x);
+      if (zeros == n)
+        sp = x;
+      else
+      {
+        if (zeros != 0)
+          Run(pc, target, sp);
+        for (size_t k = 0; k < n; k++)
+          x[k] = x[k] != 0 ? T(1) : sp[k];
+        pc = target;
+      }
+      break;
+    }
+    default:
+      throw std::logic_error("invalid opcode");
+    }
+  }
+}
+
+// значения переменных блока читаются из памяти выражением, которое первым
+// их использует, дальше они уже в кэше; ячейки общих подвыражений
+// заполняются одним выражением и читаются следующими
+template <class T, class K>
+void TBatchRunner<T, K>::Block(size_t first, size_t rows, const std::vector<size_t>& ends, T* const* results)
+{
+  offset = first;
+  n = rows;
+  const unsigned char* pc = &prog.code[0];
+  for (size_t j = 0; j < ends.size(); j++)
+  {
+    Run(pc, &prog.code[0] + ends[j], stack);
+    pc = &prog.code[0] + ends[j];
+    for (size_t k = 0; k < n; k++)
+      results[j][first + k] = stack[k];
+  }
+}
+
+// строки first..last-1 программы prog из ends.size() выражений
+template <class T, class K>
+void ExecuteRows(const TProgram& prog, const std::vector<size_t>& ends, const T* const* columns,
+  size_t first, size_t last, T* const* results, const K& kernels, const TMathKernels& math)
+{
+  if (prog.code.empty() || prog.code.back() != OP_END)
+    throw std::logic_error("bytecode must end with OP_END");
+  if (first >= last)
+    return;
+
+  // при разных условиях в блоке каждая условная операция занимает еще
+  // два столбца стека: под результаты своих ветвей
+  size_t conditions = 0;
+  for (const unsigned char* pc = &prog.code[0]; *pc != OP_END; pc += HasOperand(*pc) ? 3 : 1)
+    if (IsJump(*pc) && *pc != OP_JMP)
+      conditions++;
+  const size_t depth = prog.depth != 0 ? prog.depth : StackDepth(&prog.code[0]);
+
+  std::vector<T> memory((prog.temps + depth + 2 * conditions) * BATCH_BLOCK);
+  std::vector<double> scratch(BATCH_BLOCK);
+  TBatchRunner<T, K> runner(prog, columns, kernels, math, &memory[0], &scratch[0]);
+  for (size_t block = first; block < last; block += BATCH_BLOCK)
+    runner.Block(block, last - block < BATCH_BLOCK ? last - block : BATCH_BLOCK, ends, results);
+}
+
+// концы кода программы из одного выражения
+std::vector<size_t> SingleEnd(const TProgram& prog)
+{
+  return std::vector<size_t>(1, prog.code.empty() ? 0 : prog.code.size() - 1);
+}
+
+struct TPoolBatch
+{
+  const std::vector<TBatchJob>* jobs;
+  size_t rows;
+  size_t tasksPerJob;
+  const TSimdKernels* kernels;
+  const TMathKernels* math;
+};
+
+// задача index - часть index % tasksPerJob выражения index / tasksPerJob
+void ExecuteTask(void* context, size_t index)
+{
+  const TPoolBatch& batch = *static_cast<const TPoolBatch*>(context);
+  const TBatchJob& job = (*batch.jobs)[index / batch.tasksPerJob];
+  const size_t first = index % batch.tasksPerJob * BATCH_TASK_ROWS;
+  const size_t last = batch.rows - first < BATCH_TASK_ROWS ? batch.rows : first + BATCH_TASK_ROWS;
+  const TProgram& prog = job.expr->GetProgram();
+  double* const results[] = { job.result };
+  ExecuteRows(prog, SingleEnd(prog), job.columns, first, last, results, *batch.kernels, *batch.math);
+}
+
+struct TFusedTasks
+{
+  const TFusedBatch* fused;
+  const double* const* columns;
+  size_t rows;
+  double* const* results;
+  const TSimdKernels* kernels;
+  const TMathKernels* math;
+};
+
+// задача index - строки index * BATCH_TASK_ROWS.. всех выражений
+void ExecuteFusedTask(void* context, size_t index)
+{
+  const TFusedTasks& tasks = *static_cast<const TFusedTasks*>(context);
+  const size_t first = index * BATCH_TASK_ROWS;
+  const size_t last = tasks.rows - first < BATCH_TASK_ROWS ? tasks.rows : first + BATCH_TASK_ROWS;
+  ExecuteRows(tasks.fused->GetProgram(), tasks.fused->GetEnds(), tasks.columns, first, last, tasks.results,
+    *tasks.kernels, *tasks.math);
+}
+
+} // namespace
+
+void ExecuteBatch(const TProgram& prog, const double* const* columns, size_t rows, double* result,
+  TSimdLevel level, TMathAccuracy accuracy)
+{
+  double* const results[] = { result };
+  ExecuteRows(prog, SingleEnd(prog), columns, 0, rows, results, SimdKernels(level), MathKernels(accuracy, level));
+}
+
+void ExecuteBatch(const TProgram& prog, const float* const* columns, size_t rows, float* result,
+  TSimdLevel level, TMathAccuracy accuracy)
+{
+  float* const results[] = { result };
+  ExecuteRows(prog, SingleEnd(prog), columns, 0, rows, results, SimdFloatKernels(level),
+    MathKernels(accuracy, level));
+}
+
+void ExecuteBatch(TThreadPool& pool, const std::vector<TBatchJob>& jobs, size_t rows, TMathAccuracy accuracy)
+{
+  if (rows == 0 || jobs.empty())
+    return;
+  TPoolBatch batch;
+  batch.jobs = &jobs;
+  batch.rows = rows;
+  batch.tasksPerJob = (rows + BATCH_TASK_ROWS - 1) / BATCH_TASK_ROWS;
+  batch.kernels = &SimdKernels(SimdSupported());
+  batch.math = &MathKernels(accuracy, SimdSupported());
+  pool.Run(jobs.size() * batch.tasksPerJob, ExecuteTask, &batch);
+}
+
+TFusedBatch::TFusedBatch(const std::vector<const TPostfix*>& exprs, unsigned flags)
+{
+  if (exprs.empty())
+    throw std::invalid_argument("no expressions to fuse");
+  TExprTree tree(flags);
+  stats.nodesBefore = 0;
+  for (size_t i = 0; i < exprs.size(); i++)
+  {
+    const std::vector<std::string>& vars = exprs[i]->GetVariables();
+    std::vector<unsigned int> slots(vars.size());
+    for (size_t v = 0; v < vars.size(); v++)
+    {
+      slots[v] = 0;
+      while (slots[v] < variables.size() && variables[slots[v]] != vars[v])
+        slots[v]++;
+      if (slots[v] == variables.size())
+        variables.push_back(vars[v]);
+    }
+    const TProgram& prog = exprs[i]->GetProgram();
+    for (const unsigned char* pc = &prog.code[0]; *pc != OP_END; pc += HasOperand(*pc) ? 3 : 1)
+      if (*pc != OP_STORE)
+        stats.nodesBefore++;
+    tree.Append(prog, slots);
+  }
+  stats.nodesAfter = tree.Reachable();
+  stats.shared = tree.Shared();
+  program = tree.Emit(&ends);
+}
+
+void TFusedBatch::Calculate(const double* const* columns, size_t rows, double* const* results,
+  TMathAccuracy accuracy) const
+{
+  ExecuteRows(program, ends, columns, 0, rows, results, SimdKernels(SimdSupported()),
+    MathKernels(accuracy, SimdSupported()));
+}
+
+void TFusedBatch::Calculate(TThreadPool& pool, const double* const* columns, size_t rows, double* const* results,
+  TMathAccuracy accuracy) const
+{
+  TFusedTasks tasks;
+  tasks.fused = this;
+  tasks.columns = columns;
+  tasks.rows = rows;
+  tasks.results = results;
+  tasks.kernels = &SimdKernels(SimdSupported());
+  tasks.math = &MathKernels(accuracy, SimdSupported());
+  pool.Run((rows + BATCH_TASK_ROWS - 1) / BATCH_TASK_ROWS, ExecuteFusedTask, &tasks);
+}
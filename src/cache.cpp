@@ -0,0 +1,218 @@
+// реализация кэша скомпилированных выражений
+
+#include "cache.h"
+
+#include <cctype>
+
+namespace
+{
+
+bool IsWordChar(char c)
+{
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+}
+
+// знак операции: пробел между двумя знаками убирать нельзя, иначе
+// "a < = b" совпало бы с "a<=b"
+bool IsOperatorChar(char c)
+{
+  return !IsWordChar(c) && c != '(' && c != ')';
+}
+
+// res заканчивается числом с незаконченным порядком ("2e", "1.5E-"),
+// и c продолжил бы порядок, если убрать пробел: "2e +3" - число 2,
+// переменная e и +3, а "2e+3" - одно число
+bool ContinuesExponent(const std::string& res, char c)
+{
+  size_t end = res.size();
+  if (end > 0 && (res[end - 1] == '+' || res[end - 1] == '-'))
+  {
+    if (!std::isdigit(static_cast<unsigned char>(c)))
+      return false;
+    end--;
+  }
+  else if (c != '+' && c != '-')
+    return false;
+  if (end == 0 || (res[end - 1] != 'e' && res[end - 1] != 'E'))
+    return false;
+  size_t begin = end - 1;
+  while (begin > 0 && IsWordChar(res[begin - 1]))
+    begin--;
+  if (begin + 1 == end)
+    return false;
+  for (size_t i = begin; i + 1 < end; i++)
+    if (!std::isdigit(static_cast<unsigned char>(res[i])) && res[i] != '.')
+      return false;
+  return true;
+}
+
+} // namespace
+
+TPostfixCache::TPostfixCache(size_t maxSize, unsigned optimizeFlags) : maxBytes(maxSize), flags(optimizeFlags)
+{
+  stats.hits = 0;
+  stats.misses = 0;
+  stats.evictions = 0;
+  stats.entries = 0;
+  stats.bytes = 0;
+}
+
+std::string TPostfixCache::Normalize(const std::string& expr)
+{
+  std::string res;
+  res.reserve(expr.size());
+  bool space = false;
+  for (size_t i = 0; i < expr.size(); i++)
+  {
+    const char c = expr[i];
+    if (std::isspace(static_cast<unsigned char>(c)))
+    {
+      space = true;
+      continue;
+    }
+    if (space && !res.empty())
+    {
+      const char prev = res[res.size() - 1];
+      if ((IsWordChar(prev) && IsWordChar(c)) || (IsOperatorChar(prev) && IsOperatorChar(c))
+        || ContinuesExponent(res, c))
+        res += ' ';
+    }
+    space = false;
+    res += c;
+  }
+  return res;
+}
+
+unsigned long long TPostfixCache::Hash(const char* s, size_t len)
+{
+  unsigned long long h = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++)
+  {
+    h ^= static_cast<unsigned char>(s[i]);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+std::shared_ptr<const TPostfix> TPostfixCache::Get(const std::string& expr)
+{
+  const std::string key = Normalize(expr);
+  std::shared_ptr<const TPostfix> p = Find(key);
+  if (p)
+    return p;
+  return Insert(key, Compile(expr));
+}
+
+std::shared_ptr<const TPostfix> TPostfixCache::Find(const std::string& key)
+{
+  std::unordered_map<std::string, std::list<TEntry>::iterator, TKeyHash>::iterator it = index.find(key);
+  if (it == index.end())
+  {
+    stats.misses++;
+    return std::shared_ptr<const TPostfix>();
+  }
+  stats.hits++;
+  order.splice(order.begin(), order, it->second);
+  return it->second->expr;
+}
+
+std::shared_ptr<const TPostfix> TPostfixCache::Compile(const std::string& expr) const
+{
+  std::shared_ptr<TPostfix> p(new TPostfix(expr));
+  if (flags != 0)
+    p->Optimize(flags);
+  return p;
+}
+
+std::shared_ptr<const TPostfix> TPostfixCache::Insert(const std::string& key, const std::shared_ptr<const TPostfix>& expr)
+{
+  std::unordered_map<std::string, std::list<TEntry>::iterator, TKeyHash>::iterator it = index.find(key);
+  if (it != index.end())
+  {
+    order.splice(order.begin(), order, it->second);
+    return it->second->expr;
+  }
+
+  TEntry e;
+  e.key = key;
+  e.expr = expr;
+  e.bytes = expr->MemorySize() + 2 * key.capacity() + sizeof(TEntry);
+  order.push_front(e);
+  index[key] = order.begin();
+  stats.entries++;
+  stats.bytes += e.bytes;
+  Evict();
+  return expr;
+}
+
+void TPostfixCache::Evict()
+{
+  while (stats.bytes > maxBytes && !order.empty())
+  {
+    const TEntry& e = order.back();
+    stats.bytes -= e.bytes;
+    stats.entries--;
+    stats.evictions++;
+    index.erase(e.key);
+    order.pop_back();
+  }
+}
+
+void TPostfixCache::Clear()
+{
+  order.clear();
+  index.clear();
+  stats.entries = 0;
+  stats.bytes = 0;
+}
+
+TShardedPostfixCache::TShardedPostfixCache(size_t maxBytes, size_t count, unsigned optimizeFlags)
+{
+  size_t n = 1;
+  while (n < count)
+    n *= 2;
+  for (size_t i = 0; i < n; i++)
+    shards.push_back(std::unique_ptr<TShard>(new TShard(maxBytes / n, optimizeFlags)));
+}
+
+std::shared_ptr<const TPostfix> TShardedPostfixCache::Get(const std::string& expr)
+{
+  const std::string key = TPostfixCache::Normalize(expr);
+  // младшие биты FNV-1a перемешаны хуже, сегмент выбирается по старшим
+  const unsigned long long h = TPostfixCache::Hash(key.data(), key.size());
+  TShard& shard = *shards[static_cast<size_t>(h >> 40) & (shards.size() - 1)];
+  {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    std::shared_ptr<const TPostfix> p = shard.cache.Find(key);
+    if (p)
+      return p;
+  }
+  std::shared_ptr<const TPostfix> compiled = shard.cache.Compile(expr);
+  std::lock_guard<std::mutex> guard(shard.lock);
+  return shard.cache.Insert(key, compiled);
+}
+
+TPostfixCache::TStats TShardedPostfixCache::GetStats() const
+{
+  TPostfixCache::TStats total = { 0, 0, 0, 0, 0 };
+  for (size_t i = 0; i < shards.size(); i++)
+  {
+    std::lock_guard<std::mutex> guard(shards[i]->lock);
+    const TPostfixCache::TStats s = shards[i]->cache.GetStats();
+    total.hits += s.hits;
+    total.misses += s.misses;
+    total.evictions += s.evictions;
+    total.entries += s.entries;
+    total.bytes += s.bytes;
+  }
+  return total;
+}
+
+void TShardedPostfixCache::Clear()
+{
+  for (size_t i = 0; i < shards.size(); i++)
+  {
+    std::lock_guard<std::mutex> guard(shards[i]->lock);
+    shards[i]->cache.Clear();
+  }
+}
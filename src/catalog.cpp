@@ -0,0 +1,352 @@
+// запись и чтение файла скомпилированных выражений
+
+#include "catalog.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+const char MAGIC[8] = { 'A', 'R', 'I', 'T', 'H', 'B', 'C', 0 };
+
+size_t Align8(size_t n)
+{
+  return (n + 7) & ~static_cast<size_t>(7);
+}
+
+size_t Append(std::vector<unsigned char>& buf, const void* data, size_t len)
+{
+  const size_t at = buf.size();
+  buf.resize(at + len);
+  if (len > 0)
+    std::memcpy(&buf[at], data, len);
+  return at;
+}
+
+size_t AppendString(std::vector<unsigned char>& buf, const std::string& s)
+{
+  return Append(buf, s.c_str(), s.size() + 1);
+}
+
+void Pad8(std::vector<unsigned char>& buf)
+{
+  buf.resize(Align8(buf.size()), 0);
+}
+
+bool IsLittleEndian()
+{
+  const uint16_t one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+  return first == 1;
+}
+
+void Fail(const char* what)
+{
+  throw std::runtime_error(std::string("compiled catalog: ") + what);
+}
+
+// строка с нулем в конце целиком внутри файла
+bool IsString(const unsigned char* data, size_t len, uint64_t offset)
+{
+  return offset < len && std::memchr(data + offset, 0, len - offset) != 0;
+}
+
+// число временных ячеек, на которые ссылается байт-код
+size_t UsedTemps(const unsigned char* code, size_t codeSize)
+{
+  size_t temps = 0;
+  for (size_t pc = 0; pc + 1 < codeSize; pc += HasOperand(code[pc]) ? 3 : 1)
+    if (code[pc] == OP_STORE || code[pc] == OP_LOAD)
+    {
+      const size_t operand = code[pc + 1] | (code[pc + 2] << 8);
+      if (operand + 1 > temps)
+        temps = operand + 1;
+    }
+  return temps;
+}
+
+// байт-код выражения: операции и их операнды не выходят за codeSize,
+// OP_END - только последний байт, операнды - допустимые номера констант,
+// переменных, временных ячеек и зарегистрированных операций, переходы
+// не выходят за конец кода; temps и depth - ровно те, что нужны байт-коду,
+// чтобы Execute не выделял лишнего
+bool IsValidCode(const unsigned char* code, const TCatalogEntry& e)
+{
+  const size_t last = e.codeSize - 1;
+  for (size_t pc = 0; pc < last; pc += HasOperand(code[pc]) ? 3 : 1)
+  {
+    const unsigned char op = code[pc];
+    if (op == OP_END || op > OP_JNZ_OR_POP)
+      return false;
+    if (!HasOperand(op))
+      continue;
+    if (last - pc < 3)
+      return false;
+    const size_t operand = code[pc + 1] | (code[pc + 2] << 8);
+    if ((op == OP_CONST && operand >= e.constantCount)
+      || (op == OP_VAR && operand >= e.variableCount)
+      || (op == OP_CALL1 && (operand > 0xFF || !TPostfix::UnaryOperator(static_cast<unsigned char>(operand)).unary))
+      || (op == OP_CALL2 && (operand > 0xFF || !TPostfix::BinaryOperator(static_cast<unsigned char>(operand)).binary))
+      || (IsJump(op) && operand > last - pc - 3))
+      return false;
+  }
+  if (UsedTemps(code, e.codeSize) != e.temps)
+    return false;
+  // здесь последняя операция заканчивается ровно перед OP_END, и все
+  // переходы ведут внутрь кода, поэтому StackDepth не выйдет за него
+  try
+  {
+    return StackDepth(code) == e.depth;
+  }
+  catch (const std::logic_error&)
+  {
+    return false;
+  }
+}
+
+// причина, по которой выражение нельзя использовать, или 0
+const char* EntryError(const unsigned char* base, size_t len, const TCatalogEntry& e)
+{
+  const bool ok = e.source < len && e.code < len && e.codeSize > 0 && e.codeSize <= len - e.code
+    && base[e.code + e.codeSize - 1] == OP_END
+    && e.constants % 8 == 0 && e.constants <= len && e.constantCount <= (len - e.constants) / 8
+    && e.variables % 8 == 0 && e.variables <= len && e.variableCount <= (len - e.variables) / 8
+    && IsString(base, len, e.source);
+  if (!ok)
+    return "bad entry";
+  const uint64_t* names = reinterpret_cast<const uint64_t*>(base + e.variables);
+  for (size_t k = 0; k < e.variableCount; k++)
+    if (!IsString(base, len, names[k]))
+      return "bad variable name";
+  if (!IsValidCode(base + e.code, e))
+    return "bad bytecode";
+  return 0;
+}
+
+} // namespace
+
+const uint32_t TCompiledCatalog::VERSION;
+
+std::vector<unsigned char> TCompiledCatalog::Serialize(const std::vector<const TPostfix*>& exprs)
+{
+  if (!IsLittleEndian())
+    Fail("only little-endian hosts are supported");
+  if (exprs.size() > 0xFFFFFFFFu)
+    Fail("too many expressions");
+
+  std::vector<unsigned char> buf;
+  TCatalogHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.count = static_cast<uint32_t>(exprs.size());
+  header.entries = sizeof(TCatalogHeader);
+  Append(buf, &header, sizeof(header));
+
+  std::vector<TCatalogEntry> entries(exprs.size());
+  buf.resize(buf.size() + entries.size() * sizeof(TCatalogEntry));
+
+  for (size_t i = 0; i < exprs.size(); i++)
+  {
+    const TPostfix& p = *exprs[i];
+    const TProgram& prog = p.GetProgram();
+    const std::vector<std::string>& vars = p.GetVariables();
+    TCatalogEntry& e = entries[i];
+    std::memset(&e, 0, sizeof(e));
+
+    e.source = AppendString(buf, p.GetInfix());
+    e.code = Append(buf, &prog.code[0], prog.code.size());
+    e.codeSize = static_cast<uint32_t>(prog.code.size());
+    std::vector<uint64_t> names(vars.size());
+    for (size_t k = 0; k < vars.size(); k++)
+      names[k] = AppendString(buf, vars[k]);
+
+    Pad8(buf);
+    e.constants = Append(buf, prog.constants.empty() ? 0 : &prog.constants[0], prog.constants.size() * sizeof(double));
+    e.constantCount = static_cast<uint32_t>(prog.constants.size());
+    e.variables = Append(buf, names.empty() ? 0 : &names[0], names.size() * sizeof(uint64_t));
+    e.variableCount = static_cast<uint32_t>(vars.size());
+    // точные значения, их проверяет IsValidCode
+    e.temps = static_cast<uint32_t>(UsedTemps(&prog.code[0], prog.code.size()));
+    e.depth = static_cast<uint32_t>(StackDepth(&prog.code[0]));
+  }
+  Pad8(buf);
+
+  if (!entries.empty())
+    std::memcpy(&buf[sizeof(TCatalogHeader)], &entries[0], entries.size() * sizeof(TCatalogEntry));
+  const uint64_t total = buf.size();
+  std::memcpy(&buf[offsetof(TCatalogHeader, size)], &total, sizeof(total));
+  return buf;
+}
+
+void TCompiledCatalog::Save(const std::string& path, const std::vector<const TPostfix*>& exprs)
+{
+  const std::vector<unsigned char> buf = Serialize(exprs);
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!out)
+    Fail("cannot create file");
+  out.write(reinterpret_cast<const char*>(&buf[0]), static_cast<std::streamsize>(buf.size()));
+  if (!out)
+    Fail("write error");
+}
+
+TCompiledCatalog::TCompiledCatalog(const std::string& path)
+  : base(0), size(0), entries(0), count(0), mapping(0), mappedSize(0)
+{
+#ifdef _WIN32
+  file = 0;
+  section = 0;
+  HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (h == INVALID_HANDLE_VALUE)
+    Fail("cannot open file");
+  file = h;
+  LARGE_INTEGER len;
+  if (!GetFileSizeEx(h, &len) || len.QuadPart == 0)
+  {
+    Unmap();
+    Fail("cannot map empty file");
+  }
+  section = CreateFileMappingA(h, 0, PAGE_READONLY, 0, 0, 0);
+  if (section)
+    mapping = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+  if (!mapping)
+  {
+    Unmap();
+    Fail("cannot map file");
+  }
+  mappedSize = static_cast<size_t>(len.QuadPart);
+#else
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    Fail("cannot open file");
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    Fail("cannot map empty file");
+  }
+  void* p = mmap(0, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    Fail("cannot map file");
+  mapping = p;
+  mappedSize = static_cast<size_t>(st.st_size);
+#endif
+  try
+  {
+    Attach(static_cast<const unsigned char*>(mapping), mappedSize);
+  }
+  catch (...)
+  {
+    Unmap();
+    throw;
+  }
+}
+
+TCompiledCatalog::TCompiledCatalog(const void* data, size_t len)
+  : base(0), size(0), entries(0), count(0), mapping(0), mappedSize(0)
+{
+#ifdef _WIN32
+  file = 0;
+  section = 0;
+#endif
+  Attach(static_cast<const unsigned char*>(data), len);
+}
+
+TCompiledCatalog::~TCompiledCatalog()
+{
+  Unmap();
+}
+
+void TCompiledCatalog::Unmap()
+{
+#ifdef _WIN32
+  if (mapping)
+    UnmapViewOfFile(mapping);
+  if (section)
+    CloseHandle(section);
+  if (file)
+    CloseHandle(file);
+  file = 0;
+  section = 0;
+#else
+  if (mapping)
+    munmap(mapping, mappedSize);
+#endif
+  mapping = 0;
+  mappedSize = 0;
+}
+
+// проверяются только заголовок и размер массива выражений, чтобы
+// открытие не зависело от числа выражений; каждое выражение проверяется
+// при первом обращении к нему (Check)
+void TCompiledCatalog::Attach(const unsigned char* data, size_t len)
+{
+  if (!IsLittleEndian())
+    Fail("only little-endian hosts are supported");
+  if (reinterpret_cast<uintptr_t>(data) % 8 != 0)
+    Fail("image is not aligned");
+  if (len < sizeof(TCatalogHeader))
+    Fail("file is too short");
+  const TCatalogHeader* h = reinterpret_cast<const TCatalogHeader*>(data);
+  if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0)
+    Fail("bad magic");
+  if (h->version != VERSION)
+    Fail("unsupported version");
+  if (h->size != len || h->entries != sizeof(TCatalogHeader)
+    || (len - h->entries) / sizeof(TCatalogEntry) < h->count)
+    Fail("bad size");
+
+  base = data;
+  size = len;
+  entries = reinterpret_cast<const TCatalogEntry*>(data + h->entries);
+  count = h->count;
+  checked.reset(new std::atomic<unsigned char>[count]());
+}
+
+// проверку одного выражения могут одновременно выполнить несколько
+// потоков: результат у всех один и тот же
+void TCompiledCatalog::Check(size_t i) const
+{
+  const unsigned char state = checked[i].load(std::memory_order_acquire);
+  if (state == ENTRY_VALID)
+    return;
+  if (state == ENTRY_INVALID)
+    Fail("bad entry");
+  const char* error = EntryError(base, size, entries[i]);
+  checked[i].store(error ? ENTRY_INVALID : ENTRY_VALID, std::memory_order_release);
+  if (error)
+    Fail(error);
+}
+
+const char* TCompiledCatalog::Source(size_t i) const
+{
+  Check(i);
+  return reinterpret_cast<const char*>(base + entries[i].source);
+}
+
+const char* TCompiledCatalog::Variable(size_t i, size_t k) const
+{
+  Check(i);
+  const uint64_t* names = reinterpret_cast<const uint64_t*>(base + entries[i].variables);
+  return reinterpret_cast<const char*>(base + names[k]);
+}
+
+double TCompiledCatalog::Calculate(size_t i, const double* values) const
+{
+  Check(i);
+  const TCatalogEntry& e = entries[i];
+  return Execute(base + e.code, reinterpret_cast<const double*>(base + e.constants), values, e.temps, e.depth);
+}
@@ -0,0 +1,239 @@
+// вычисление байт-кода вместе с производными
+
+#include "dual.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+
+// шаг центральной разности относительно |x|: при нем ошибка отбрасывания
+// и ошибка округления одного порядка
+const double SLOPE_STEP = 6.0554544523933395e-06; // cbrt(DBL_EPSILON)
+
+double Step(double x)
+{
+  return SLOPE_STEP * std::fmax(1.0, std::fabs(x));
+}
+
+double Slope(double (*f)(double), double x)
+{
+  const double h = Step(x);
+  return (f(x + h) - f(x - h)) / (2 * h);
+}
+
+// производная f(a, b) по a (byFirst) или по b
+double Slope(double (*f)(double, double), double a, double b, bool byFirst)
+{
+  const double h = Step(byFirst ? a : b);
+  if (byFirst)
+    return (f(a + h, b) - f(a - h, b)) / (2 * h);
+  return (f(a, b + h) - f(a, b - h)) / (2 * h);
+}
+
+} // namespace
+
+// Значения лежат в v, производные значения i - в count элементах g,
+// начиная с i * count; сначала временные ячейки, затем одно неиспользуемое
+// место, чтобы вершина пустого стека была внутри массива, затем стек.
+double ExecuteDual(const TProgram& prog, const double* vars, const size_t* wrt, size_t count, double* gradient)
+{
+  if (prog.code.empty() || prog.code.back() != OP_END)
+    throw std::logic_error("bytecode must end with OP_END");
+  const size_t depth = prog.depth != 0 ? prog.depth : StackDepth(&prog.code[0]);
+  std::vector<double> v(prog.temps + 1 + depth);
+  std::vector<double> g(v.size() * count);
+  double* const d = g.empty() ? 0 : &g[0];
+  size_t n = prog.temps + 1; // первое свободное место в стеке
+
+  for (const unsigned char* pc = &prog.code[0];;)
+  {
+    const unsigned char op = *pc++;
+    size_t operand = 0;
+    if (HasOperand(op))
+    {
+      operand = pc[0] | (pc[1] << 8);
+      pc += 2;
+    }
+    // x - вершина стека, y - значение под ней
+    double& x = v[n - 1];
+    double* dx = d + (n - 1) * count;
+    double* dy = dx - count;
+    switch (op)
+    {
+    case OP_END:
+      for (size_t j = 0; j < count; j++)
+        gradient[j] = dx[j];
+      return x;
+    case OP_CONST:
+      v[n] = prog.constants[operand];
+      for (size_t j = 0; j < count; j++)
+        dx[count + j] = 0.0;
+      n++;
+      break;
+    case OP_VAR:
+      v[n] = vars[operand];
+      for (size_t j = 0; j < count; j++)
+        dx[count + j] = wrt[j] == operand ? 1.0 : 0.0;
+      n++;
+      break;
+    case OP_ADD:
+      v[n - 2] += x;
+      for (size_t j = 0; j < count; j++)
+        dy[j] += dx[j];
+      n--;
+      break;
+    case OP_SUB:
+      v[n - 2] -= x;
+      for (size_t j = 0; j < count; j++)
+        dy[j] -= dx[j];
+      n--;
+      break;
+    case OP_MUL:
+      for (size_t j = 0; j < count; j++)
+        dy[j] = dy[j] * x + v[n - 2] * dx[j];
+      v[n - 2] *= x;
+      n--;
+      break;
+    case OP_DIV:
+    {
+      const double q = v[n - 2] / x;
+      for (size_t j = 0; j < count; j++)
+        dy[j] = (dy[j] - q * dx[j]) / x;
+      v[n - 2] = q;
+      n--;
+      break;
+    }
+    case OP_NEG:
+      x = -x;
+      for (size_t j = 0; j < count; j++)
+        dx[j] = -dx[j];
+      break;
+    case OP_SIN:
+    {
+      const double c = std::cos(x);
+      x = std::sin(x);
+      for (size_t j = 0; j < count; j++)
+        dx[j] *= c;
+      break;
+    }
+    case OP_COS:
+    {
+      const double s = -std::sin(x);
+      x = std::cos(x);
+      for (size_t j = 0; j < count; j++)
+        dx[j] *= s;
+      break;
+    }
+    case OP_LN:
+      for (size_t j = 0; j < count; j++)
+        dx[j] /= x;
+      x = std::log(x);
+      break;
+    case OP_EXP:
+      x = std::exp(x);
+      for (size_t j = 0; j < count; j++)
+        dx[j] *= x;
+      break;
+    case OP_STORE:
+      v[operand] = x;
+      for (size_t j = 0; j < count; j++)
+        d[operand * count + j] = dx[j];
+      break;
+    case OP_LOAD:
+      v[n] = v[operand];
+      for (size_t j = 0; j < count; j++)
+        dx[count + j] = d[operand * count + j];
+      n++;
+      break;
+    case OP_CALL1:
+    {
+      double (*f)(double) = TPostfix::UnaryOperator(static_cast<unsigned char>(operand)).unary;
+      const double s = Slope(f, x);
+      x = f(x);
+      for (size_t j = 0; j < count; j++)
+        dx[j] *= s;
+      break;
+    }
+    case OP_CALL2:
+    {
+      double (*f)(double, double) = TPostfix::BinaryOperator(static_cast<unsigned char>(operand)).binary;
+      const double sa = Slope(f, v[n - 2], x, true);
+      const double sb = Slope(f, v[n - 2], x, false);
+      for (size_t j = 0; j < count; j++)
+        dy[j] = sa * dy[j] + sb * dx[j];
+      v[n - 2] = f(v[n - 2], x);
+      n--;
+      break;
+    }
+    case OP_POW:
+    {
+      const double a = v[n - 2];
+      const double r = std::pow(a, x);
+      for (size_t j = 0; j < count; j++)
+      {
+        double t = 0.0;
+        if (dy[j] != 0.0)
+          t += x * std::pow(a, x - 1) * dy[j];
+        if (dx[j] != 0.0)
+          t += r * std::log(a) * dx[j];
+        dy[j] = t;
+      }
+      v[n - 2] = r;
+      n--;
+      break;
+    }
+    case OP_POWI:
+    {
+      const int e = static_cast<short>(operand);
+      const double s = e == 0 ? 0.0 : e * PowI(x, e - 1);
+      x = PowI(x, e);
+      for (size_t j = 0; j < count; j++)
+        dx[j] *= s;
+      break;
+    }
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+      if (op == OP_LT)
+        v[n - 2] = v[n - 2] < x ? 1.0 : 0.0;
+      else if (op == OP_LE)
+        v[n - 2] = v[n - 2] <= x ? 1.0 : 0.0;
+      else
+        v[n - 2] = v[n - 2] == x ? 1.0 : 0.0;
+      for (size_t j = 0; j < count; j++)
+        dy[j] = 0.0;
+      n--;
+      break;
+    case OP_BOOL:
+      x = x != 0.0 ? 1.0 : 0.0;
+      for (size_t j = 0; j < count; j++)
+        dx[j] = 0.0;
+      break;
+    case OP_JMP:
+      pc += operand;
+      break;
+    case OP_JZ:
+      if (x == 0.0)
+        pc += operand;
+      n--;
+      break;
+    case OP_JZ_OR_POP:
+    case OP_JNZ_OR_POP:
+      if ((x == 0.0) == (op == OP_JZ_OR_POP))
+      {
+        x = op == OP_JZ_OR_POP ? 0.0 : 1.0;
+        for (size_t j = 0; j < count; j++)
+          dx[j] = 0.0;
+        pc += operand;
+      }
+      else
+        n--;
+      break;
+    default:
+      throw std::logic_error("invalid opcode");
+    }
+  }
+}
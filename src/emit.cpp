@@ -0,0 +1,326 @@
+// перевод байт-кода выражения в исходный текст C++
+
+#include "emit.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+
+const char* const KEYWORDS[] =
+{
+  "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break",
+  "case", "catch", "char", "char8_t", "char16_t", "char32_t", "class", "compl", "concept",
+  "const", "consteval", "constexpr", "constinit", "const_cast", "continue", "co_await",
+  "co_return", "co_yield", "decltype", "default", "delete", "do", "double", "dynamic_cast",
+  "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto",
+  "if", "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq",
+  "nullptr", "operator", "or", "or_eq", "private", "protected", "public", "register",
+  "reinterpret_cast", "requires", "return", "short", "signed", "sizeof", "static",
+  "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local",
+  "throw", "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
+  "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq"
+};
+
+bool IsIdentifier(const std::string& s)
+{
+  if (s.empty() || !(std::isalpha(static_cast<unsigned char>(s[0])) || s[0] == '_'))
+    return false;
+  for (size_t i = 1; i < s.size(); i++)
+    if (!(std::isalnum(static_cast<unsigned char>(s[i])) || s[i] == '_'))
+      return false;
+  for (size_t i = 0; i < sizeof(KEYWORDS) / sizeof(KEYWORDS[0]); i++)
+    if (s == KEYWORDS[i])
+      return false;
+  return true;
+}
+
+const char* Operation(unsigned char op)
+{
+  switch (op)
+  {
+  case OP_ADD: return " + ";
+  case OP_SUB: return " - ";
+  case OP_MUL: return " * ";
+  default: return " / ";
+  }
+}
+
+const char* Function(unsigned char op)
+{
+  switch (op)
+  {
+  case OP_SIN: return "std::sin";
+  case OP_COS: return "std::cos";
+  case OP_LN: return "std::log";
+  default: return "std::exp";
+  }
+}
+
+const char* Comparison(unsigned char op)
+{
+  switch (op)
+  {
+  case OP_LT: return " < ";
+  case OP_LE: return " <= ";
+  default: return " == ";
+  }
+}
+
+std::string NewName(size_t& next)
+{
+  std::ostringstream t;
+  t << "t" << next++;
+  return t.str();
+}
+
+// новая промежуточная константа со значением value, возвращает ее имя
+std::string Define(std::ostream& out, const std::string& indent, size_t& next, const std::string& value)
+{
+  const std::string name = NewName(next);
+  out << indent << "const double " << name << " = " << value << ";\n";
+  return name;
+}
+
+bool IsCanonicalNaN(double value)
+{
+  const double canonical = std::numeric_limits<double>::quiet_NaN();
+  return std::memcmp(&value, &canonical, sizeof(value)) == 0;
+}
+
+// незакрытый блок if условной операции: при target блок заканчивается,
+// и его значение присваивается переменной result
+struct TBlock
+{
+  const unsigned char* target;
+  std::string result;
+};
+
+} // namespace
+
+std::string CppLiteral(double value)
+{
+  if (value != value)
+  {
+    if (IsCanonicalNaN(value))
+      return "std::numeric_limits<double>::quiet_NaN()";
+    // знак и содержимое NaN сохраняются только в битах
+    unsigned long long bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    char buf[48];
+    std::snprintf(buf, sizeof(buf), "std::bit_cast<double>(0x%016llXULL)", bits);
+    return buf;
+  }
+  if (value == HUGE_VAL)
+    return "std::numeric_limits<double>::infinity()";
+  if (value == -HUGE_VAL)
+    return "-std::numeric_limits<double>::infinity()";
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.17g", value);
+  std::string s(buf);
+  // без точки и порядка литерал был бы целым, и -0 стал бы +0
+  if (s.find_first_of(".e") == std::string::npos)
+    s += ".0";
+  return s;
+}
+
+void TCppEmitter::Add(const std::string& name, const TPostfix& expr)
+{
+  if (!IsIdentifier(name))
+    throw std::invalid_argument("'" + name + "' is not a valid function name");
+  // у каждой функции два имени в пространстве имен: name и name_vars
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    if (names[i] == name)
+      throw std::invalid_argument("function '" + name + "' is already defined");
+    if (names[i] + "_vars" == name)
+      throw std::invalid_argument("function '" + name + "' collides with structure of function '"
+        + names[i] + "'");
+    if (names[i] == name + "_vars")
+      throw std::invalid_argument("structure of function '" + name + "' collides with function '"
+        + names[i] + "'");
+  }
+  const std::vector<std::string>& vars = expr.GetVariables();
+  for (size_t i = 0; i < vars.size(); i++)
+    if (!IsIdentifier(vars[i]))
+      throw std::invalid_argument("'" + vars[i] + "' is not a valid variable name");
+
+  std::ostringstream out;
+  out << "// " << expr.GetInfix() << "\n";
+  out << "struct " << name << "_vars\n{\n";
+  for (size_t i = 0; i < vars.size(); i++)
+    out << "  double " << vars[i] << ";\n";
+  out << "};\n\n";
+  out << "inline double " << name << "(const " << name << "_vars& v)\n{\n";
+  if (vars.empty())
+    out << "  (void)v;\n";
+
+  // значения стека - имена промежуточных констант или выражения v.x
+  const TProgram& prog = expr.GetProgram();
+  std::vector<std::string> stack, temps(prog.temps);
+  size_t next = 0;
+  // ветви условных операций - блоки if и else
+  std::string indent = "  ";
+  std::vector<TBlock> blocks;
+  bool nanBits = false; // есть NaN, записанный через std::bit_cast
+  for (const unsigned char* pc = &prog.code[0];;)
+  {
+    while (!blocks.empty() && blocks.back().target == pc)
+    {
+      out << indent << blocks.back().result << " = " << stack.back() << ";\n";
+      indent.resize(indent.size() - 2);
+      out << indent << "}\n";
+      stack.back() = blocks.back().result;
+      blocks.pop_back();
+    }
+    if (*pc == OP_END)
+      break;
+
+    const unsigned char op = *pc++;
+    size_t operand = 0;
+    if (HasOperand(op))
+    {
+      operand = pc[0] | (pc[1] << 8);
+      pc += 2;
+    }
+    std::string value;
+    switch (op)
+    {
+    case OP_CONST:
+      if (prog.constants[operand] != prog.constants[operand] && !IsCanonicalNaN(prog.constants[operand]))
+        nanBits = true;
+      stack.push_back(CppLiteral(prog.constants[operand]));
+      continue;
+    case OP_VAR:
+      stack.push_back("v." + vars[operand]);
+      continue;
+    case OP_STORE:
+      temps[operand] = stack.back();
+      continue;
+    case OP_LOAD:
+      stack.push_back(temps[operand]);
+      continue;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    {
+      const std::string b = stack.back();
+      stack.pop_back();
+      value = stack.back() + Operation(op) + b;
+      stack.pop_back();
+      break;
+    }
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    {
+      const std::string b = stack.back();
+      stack.pop_back();
+      value = stack.back() + Comparison(op) + b + " ? 1.0 : 0.0";
+      stack.pop_back();
+      break;
+    }
+    case OP_BOOL:
+      value = stack.back() + " != 0.0 ? 1.0 : 0.0";
+      stack.pop_back();
+      break;
+    case OP_JZ:
+    case OP_JZ_OR_POP:
+    case OP_JNZ_OR_POP:
+    {
+      // у && и || значение при переходе известно заранее
+      const TBlock block = { pc + operand, NewName(next) };
+      out << indent << "double " << block.result
+        << (op == OP_JZ ? "" : op == OP_JZ_OR_POP ? " = 0.0" : " = 1.0") << ";\n";
+      out << indent << "if (" << stack.back() << (op == OP_JNZ_OR_POP ? " == 0.0" : " != 0.0") << ")\n";
+      out << indent << "{\n";
+      indent += "  ";
+      stack.pop_back();
+      blocks.push_back(block);
+      continue;
+    }
+    case OP_JMP:
+      // конец ветви "то" условной операции
+      out << indent << blocks.back().result << " = " << stack.back() << ";\n";
+      stack.pop_back();
+      indent.resize(indent.size() - 2);
+      out << indent << "}\n" << indent << "else\n" << indent << "{\n";
+      indent += "  ";
+      blocks.back().target = pc + operand;
+      continue;
+    case OP_POW:
+    {
+      const std::string b = stack.back();
+      stack.pop_back();
+      value = "std::pow(" + stack.back() + ", " + b + ")";
+      stack.pop_back();
+      break;
+    }
+    case OP_POWI:
+    {
+      // те же умножения, что в PowI
+      const int n = static_cast<short>(operand);
+      unsigned m = static_cast<unsigned>(n < 0 ? -n : n);
+      std::string base = stack.back(), result;
+      stack.pop_back();
+      while (m != 0)
+      {
+        if (m & 1)
+          result = result.empty() ? base : Define(out, indent, next, result + " * " + base);
+        m >>= 1;
+        if (m != 0)
+          base = Define(out, indent, next, base + " * " + base);
+      }
+      if (result.empty())
+        value = "1.0";
+      else if (n < 0)
+        value = "1.0 / " + result;
+      else
+      {
+        stack.push_back(result);
+        continue;
+      }
+      break;
+    }
+    case OP_CALL1:
+    case OP_CALL2:
+      throw std::invalid_argument(std::string("operator '") + static_cast<char>(operand)
+        + "' has no C++ equivalent");
+    case OP_NEG:
+      value = stack.back()[0] == '-' ? "-(" + stack.back() + ")" : "-" + stack.back();
+      stack.pop_back();
+      break;
+    default:
+      value = std::string(Function(op)) + "(" + stack.back() + ")";
+      stack.pop_back();
+      break;
+    }
+    stack.push_back(Define(out, indent, next, value));
+  }
+  out << "  return " << stack.back() << ";\n}\n";
+
+  names.push_back(name);
+  bitCast = bitCast || nanBits;
+  bodies.push_back(out.str());
+}
+
+std::string TCppEmitter::Header(const std::string& guard, const std::string& ns) const
+{
+  std::ostringstream out;
+  out << "// generated by postfix --emit-cpp, do not edit\n"
+    "// results match TPostfix::Calculate bit for bit when compiled\n"
+    "// without -ffast-math and with -ffp-contract=off\n\n";
+  out << "#ifndef " << guard << "\n#define " << guard << "\n\n";
+  out << (bitCast ? "#include <bit>\n" : "") << "#include <cmath>\n#include <limits>\n\n";
+  out << "namespace " << ns << "\n{\n";
+  for (size_t i = 0; i < bodies.size(); i++)
+    out << "\n" << bodies[i];
+  out << "\n} // namespace " << ns << "\n\n#endif\n";
+  return out.str();
+}
@@ -0,0 +1,444 @@
+// генерация машинного кода x86-64 для байт-кода выражения
+
+#include "jit.h"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#ifdef ARITHMETIC_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+#ifdef ARITHMETIC_JIT
+
+// те же функции стандартной библиотеки, что вызывает интерпретатор
+double Sin(double x) { return std::sin(x); }
+double Cos(double x) { return std::cos(x); }
+double Log(double x) { return std::log(x); }
+double Exp(double x) { return std::exp(x); }
+double Pow(double x, double y) { return std::pow(x, y); }
+
+// номера регистров общего назначения
+enum TRegister
+{
+  RAX = 0,
+  RSP = 4,
+  RBX = 3,
+  R12 = 12
+};
+
+const unsigned SCRATCH = 15; // xmm15
+
+const unsigned long long ONE = 0x3FF0000000000000ull; // 1.0
+
+// коды условных переходов 0F 8x
+enum TCondition
+{
+  CC_ALWAYS = 0,
+  CC_EQUAL = 0x84,
+  CC_NOT_EQUAL = 0x85,
+  CC_PARITY = 0x8A // результат сравнения с NaN
+};
+
+class TAssembler
+{
+  std::vector<unsigned char> code;
+
+  void Byte(unsigned b) { code.push_back(static_cast<unsigned char>(b)); }
+
+  void Imm32(unsigned v)
+  {
+    for (int i = 0; i < 4; i++)
+      Byte((v >> (8 * i)) & 0xFF);
+  }
+
+  // prefix [REX] 0F op modrm: операция над двумя регистрами xmm
+  void RegReg(unsigned prefix, unsigned op, unsigned dst, unsigned src)
+  {
+    Byte(prefix);
+    if (dst >= 8 || src >= 8)
+      Byte(0x40 | ((dst >> 3) << 2) | (src >> 3));
+    Byte(0x0F);
+    Byte(op);
+    Byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+  }
+
+  // F2 [REX] 0F op modrm [SIB] disp32: movsd с операндом [base + disp]
+  void RegMem(unsigned op, unsigned xmm, unsigned base, size_t disp)
+  {
+    Byte(0xF2);
+    if (xmm >= 8 || base >= 8)
+      Byte(0x40 | ((xmm >> 3) << 2) | (base >> 3));
+    Byte(0x0F);
+    Byte(op);
+    Byte(0x80 | ((xmm & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+      Byte(0x24);
+    Imm32(static_cast<unsigned>(disp));
+  }
+
+public:
+  // push rbx; push r12; push rbp; mov rbp, rsp; sub rsp, frame;
+  // mov rbx, rdi; mov r12, rsi
+  void Prologue(size_t frame)
+  {
+    Byte(0x53);
+    Byte(0x41); Byte(0x54);
+    Byte(0x55);
+    Byte(0x48); Byte(0x89); Byte(0xE5);
+    Byte(0x48); Byte(0x81); Byte(0xEC); Imm32(static_cast<unsigned>(frame));
+    Byte(0x48); Byte(0x89); Byte(0xFB);
+    Byte(0x49); Byte(0x89); Byte(0xF4);
+  }
+
+  // mov rsp, rbp; pop rbp; pop r12; pop rbx; ret
+  void Epilogue()
+  {
+    Byte(0x48); Byte(0x89); Byte(0xEC);
+    Byte(0x5D);
+    Byte(0x41); Byte(0x5C);
+    Byte(0x5B);
+    Byte(0xC3);
+  }
+
+  void Load(unsigned xmm, unsigned base, size_t disp) { RegMem(0x10, xmm, base, disp); }
+  void Store(unsigned base, size_t disp, unsigned xmm) { RegMem(0x11, xmm, base, disp); }
+
+  // addsd, subsd, mulsd, divsd
+  void Arithmetic(unsigned char op, unsigned dst, unsigned src)
+  {
+    static const unsigned char CODES[] = { 0x58, 0x5C, 0x59, 0x5E };
+    RegReg(0xF2, CODES[op - OP_ADD], dst, src);
+  }
+
+  // movapd dst, src
+  void Move(unsigned dst, unsigned src)
+  {
+    if (dst != src)
+      RegReg(0x66, 0x28, dst, src);
+  }
+
+  // mov rax, bits; movq xmm15, rax
+  void LoadScratch(unsigned long long bits)
+  {
+    Byte(0x48); Byte(0xB8);
+    Imm32(static_cast<unsigned>(bits));
+    Imm32(static_cast<unsigned>(bits >> 32));
+    Byte(0x66); Byte(0x4C); Byte(0x0F); Byte(0x6E); Byte(0xC0 | ((SCRATCH & 7) << 3) | RAX);
+  }
+
+  // xorpd xmm, xmm
+  void Zero(unsigned xmm) { RegReg(0x66, 0x57, xmm, xmm); }
+
+  // cmpltsd, cmplesd, cmpeqsd, затем andpd с 1.0: маска сравнения
+  // превращается в 1 или 0
+  void Compare(unsigned char op, unsigned dst, unsigned src)
+  {
+    RegReg(0xF2, 0xC2, dst, src);
+    Byte(op == OP_LT ? 1 : op == OP_LE ? 2 : 0);
+    LoadScratch(ONE);
+    RegReg(0x66, 0x54, dst, SCRATCH);
+  }
+
+  // xmm != 0: cmpneqsd с нулем верен и для NaN
+  void Bool(unsigned xmm)
+  {
+    Zero(SCRATCH);
+    RegReg(0xF2, 0xC2, xmm, SCRATCH);
+    Byte(4);
+    LoadScratch(ONE);
+    RegReg(0x66, 0x54, xmm, SCRATCH);
+  }
+
+  // ucomisd xmm, 0: для NaN устанавливаются ZF и PF
+  void TestZero(unsigned xmm)
+  {
+    Zero(SCRATCH);
+    RegReg(0x66, 0x2E, xmm, SCRATCH);
+  }
+
+  // jmp или jcc с 32-битным смещением; возвращает место смещения,
+  // которое заполняет Patch
+  size_t Jump(TCondition cc)
+  {
+    if (cc == CC_ALWAYS)
+      Byte(0xE9);
+    else
+    {
+      Byte(0x0F);
+      Byte(cc);
+    }
+    Imm32(0);
+    return code.size() - 4;
+  }
+
+  // переход, смещение которого записано в at, ведет в текущее место
+  void Patch(size_t at)
+  {
+    const unsigned rel = static_cast<unsigned>(code.size() - (at + 4));
+    for (int i = 0; i < 4; i++)
+      code[at + i] = static_cast<unsigned char>((rel >> (8 * i)) & 0xFF);
+  }
+
+  // смена знака: xorpd со знаковым битом, как у -x в интерпретаторе
+  void Negate(unsigned xmm)
+  {
+    LoadScratch(0x8000000000000000ull);
+    RegReg(0x66, 0x57, xmm, SCRATCH);
+  }
+
+  // x^n теми же умножениями, что и PowI
+  void Power(unsigned xmm, int n)
+  {
+    unsigned m = static_cast<unsigned>(n < 0 ? -n : n);
+    if (m == 0)
+    {
+      LoadScratch(ONE);
+      Move(xmm, SCRATCH);
+      return;
+    }
+    // основание - в xmm15, результат - в xmm; умножение 1.0 на первый
+    // множитель точное, поэтому вместо него - копирование
+    Move(SCRATCH, xmm);
+    bool first = true;
+    while (m != 0)
+    {
+      if (m & 1)
+      {
+        if (first)
+          Move(xmm, SCRATCH);
+        else
+          Arithmetic(OP_MUL, xmm, SCRATCH);
+        first = false;
+      }
+      m >>= 1;
+      if (m != 0)
+        Arithmetic(OP_MUL, SCRATCH, SCRATCH);
+    }
+    if (n < 0)
+    {
+      LoadScratch(ONE);
+      Arithmetic(OP_DIV, SCRATCH, xmm);
+      Move(xmm, SCRATCH);
+    }
+  }
+
+  // mov rax, fn; call rax
+  template <class TFunction>
+  void Call(TFunction fn)
+  {
+    unsigned long long address;
+    std::memcpy(&address, &fn, sizeof(address));
+    Byte(0x48); Byte(0xB8);
+    Imm32(static_cast<unsigned>(address));
+    Imm32(static_cast<unsigned>(address >> 32));
+    Byte(0xFF); Byte(0xD0);
+  }
+
+  const std::vector<unsigned char>& Code() const { return code; }
+};
+
+// кадр: временные ячейки, затем место для сохранения регистров стека
+bool Generate(const TProgram& prog, size_t depth, TAssembler& a)
+{
+  const size_t spill = prog.temps * sizeof(double);
+  size_t frame = spill + TJitCode::MAX_DEPTH * sizeof(double);
+  frame = (frame + 15) & ~static_cast<size_t>(15);
+  if (frame > 0x7FFFFFFF || depth > TJitCode::MAX_DEPTH)
+    return false;
+
+  a.Prologue(frame);
+  unsigned top = 0; // число значений в стеке
+  // переходы вперед: место смещения в машинном коде по месту в байт-коде,
+  // куда ведет переход, и число значений в стеке там
+  std::multimap<const unsigned char*, size_t> patches;
+  std::map<const unsigned char*, unsigned> labels;
+  for (const unsigned char* pc = &prog.code[0];;)
+  {
+    // значения стека лежат в регистрах по номеру места в стеке, поэтому
+    // после перехода значения уже там, где их ждет код
+    const std::map<const unsigned char*, unsigned>::const_iterator label = labels.find(pc);
+    if (label != labels.end())
+      top = label->second;
+    for (std::multimap<const unsigned char*, size_t>::iterator p = patches.lower_bound(pc);
+      p != patches.end() && p->first == pc; ++p)
+      a.Patch(p->second);
+    patches.erase(pc);
+    if (*pc == OP_END)
+      break;
+
+    const unsigned char op = *pc++;
+    size_t operand = 0;
+    if (HasOperand(op))
+    {
+      operand = pc[0] | (pc[1] << 8);
+      pc += 2;
+    }
+    switch (op)
+    {
+    case OP_CONST: a.Load(top++, R12, operand * sizeof(double)); break;
+    case OP_VAR: a.Load(top++, RBX, operand * sizeof(double)); break;
+    case OP_LOAD: a.Load(top++, RSP, operand * sizeof(double)); break;
+    case OP_STORE: a.Store(RSP, operand * sizeof(double), top - 1); break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+      a.Arithmetic(op, top - 2, top - 1);
+      top--;
+      break;
+    case OP_NEG: a.Negate(top - 1); break;
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+      a.Compare(op, top - 2, top - 1);
+      top--;
+      break;
+    case OP_BOOL: a.Bool(top - 1); break;
+    case OP_JMP:
+      labels[pc + operand] = top;
+      patches.insert(std::make_pair(pc + operand, a.Jump(CC_ALWAYS)));
+      break;
+    case OP_JZ:
+    {
+      // переход, если условие равно 0, но не NaN
+      a.TestZero(top - 1);
+      top--;
+      labels[pc + operand] = top;
+      const size_t unordered = a.Jump(CC_PARITY);
+      patches.insert(std::make_pair(pc + operand, a.Jump(CC_EQUAL)));
+      a.Patch(unordered);
+      break;
+    }
+    case OP_JZ_OR_POP:
+    {
+      a.TestZero(top - 1);
+      labels[pc + operand] = top;
+      const size_t unordered = a.Jump(CC_PARITY);
+      const size_t nonzero = a.Jump(CC_NOT_EQUAL);
+      a.Zero(top - 1); // -0 становится +0
+      patches.insert(std::make_pair(pc + operand, a.Jump(CC_ALWAYS)));
+      a.Patch(unordered);
+      a.Patch(nonzero);
+      top--;
+      break;
+    }
+    case OP_JNZ_OR_POP:
+    {
+      a.TestZero(top - 1);
+      labels[pc + operand] = top;
+      const size_t unordered = a.Jump(CC_PARITY);
+      const size_t zero = a.Jump(CC_EQUAL);
+      a.Patch(unordered);
+      a.LoadScratch(ONE);
+      a.Move(top - 1, SCRATCH);
+      patches.insert(std::make_pair(pc + operand, a.Jump(CC_ALWAYS)));
+      a.Patch(zero);
+      top--;
+      break;
+    }
+    case OP_POWI: a.Power(top - 1, static_cast<short>(operand)); break;
+    case OP_SIN:
+    case OP_COS:
+    case OP_LN:
+    case OP_EXP:
+    case OP_CALL1:
+    {
+      // все регистры xmm портятся вызовом
+      for (unsigned i = 0; i + 1 < top; i++)
+        a.Store(RSP, spill + i * sizeof(double), i);
+      a.Move(0, top - 1);
+      if (op == OP_CALL1)
+        a.Call(TPostfix::UnaryOperator(static_cast<unsigned char>(operand)).unary);
+      else
+        a.Call(op == OP_SIN ? Sin : op == OP_COS ? Cos : op == OP_LN ? Log : Exp);
+      a.Move(top - 1, 0);
+      for (unsigned i = 0; i + 1 < top; i++)
+        a.Load(i, RSP, spill + i * sizeof(double));
+      break;
+    }
+    case OP_CALL2:
+    case OP_POW:
+    {
+      // аргументы - в xmm0 и xmm1
+      for (unsigned i = 0; i + 2 < top; i++)
+        a.Store(RSP, spill + i * sizeof(double), i);
+      a.Move(0, top - 2);
+      a.Move(1, top - 1);
+      if (op == OP_POW)
+        a.Call(Pow);
+      else
+        a.Call(TPostfix::BinaryOperator(static_cast<unsigned char>(operand)).binary);
+      top--;
+      a.Move(top - 1, 0);
+      for (unsigned i = 0; i + 1 < top; i++)
+        a.Load(i, RSP, spill + i * sizeof(double));
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  a.Epilogue();
+  return true;
+}
+
+#endif
+
+} // namespace
+
+const size_t TJitCode::MAX_DEPTH;
+
+bool TJitCode::Supported()
+{
+#ifdef ARITHMETIC_JIT
+  return true;
+#else
+  return false;
+#endif
+}
+
+TJitCode::TJitCode(void* mem, size_t sz) : memory(mem), size(sz)
+{
+  std::memcpy(&function, &memory, sizeof(function));
+}
+
+TJitCode::~TJitCode()
+{
+#ifdef ARITHMETIC_JIT
+  munmap(memory, size);
+#endif
+}
+
+std::shared_ptr<const TJitCode> TJitCode::Compile(const TProgram& prog)
+{
+#ifdef ARITHMETIC_JIT
+  const size_t depth = prog.depth != 0 ? prog.depth : StackDepth(&prog.code[0]);
+  TAssembler a;
+  if (!Generate(prog, depth, a))
+    return std::shared_ptr<const TJitCode>();
+
+  // страница сначала доступна для записи, затем только для выполнения
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t size = (a.Code().size() + page - 1) / page * page;
+  void* mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return std::shared_ptr<const TJitCode>();
+  std::memcpy(mem, &a.Code()[0], a.Code().size());
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(mem, size);
+    return std::shared_ptr<const TJitCode>();
+  }
+  return std::shared_ptr<const TJitCode>(new TJitCode(mem, size));
+#else
+  (void)prog;
+  return std::shared_ptr<const TJitCode>();
+#endif
+}
@@ -0,0 +1,140 @@
+// пул потоков с перехватом задач
+
+#include "pool.h"
+
+TThreadPool::TThreadPool(unsigned workers)
+  : generation(0), stop(false), task(0), context(0), remaining(0), steals(0)
+{
+  if (workers == 0)
+    workers = std::thread::hardware_concurrency();
+  if (workers == 0)
+    workers = 1;
+  for (unsigned w = 0; w < workers; w++)
+    queues.push_back(std::unique_ptr<TQueue>(new TQueue));
+  for (unsigned w = 1; w < workers; w++)
+    threads.push_back(std::thread(&TThreadPool::Wait, this, w));
+}
+
+TThreadPool::~TThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  start.notify_all();
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+bool TThreadPool::Pop(unsigned worker, size_t& index)
+{
+  TQueue& q = *queues[worker];
+  std::lock_guard<std::mutex> guard(q.lock);
+  if (q.tasks.empty())
+    return false;
+  index = q.tasks.front();
+  q.tasks.pop_front();
+  return true;
+}
+
+// чужие очереди просматриваются по кругу начиная со следующей, задача
+// берется из конца - дальше всего от той, которую выполняет владелец
+bool TThreadPool::Steal(unsigned worker, size_t& index)
+{
+  const size_t count = queues.size();
+  for (size_t k = 1; k < count; k++)
+  {
+    TQueue& q = *queues[(worker + k) % count];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (!q.tasks.empty())
+    {
+      index = q.tasks.back();
+      q.tasks.pop_back();
+      steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+// задачи не порождают новых, поэтому исполнитель, не нашедший задачи ни
+// в одной очереди, завершает работу над вызовом Run
+void TThreadPool::Work(unsigned worker)
+{
+  size_t index;
+  while (Pop(worker, index) || Steal(worker, index))
+  {
+    // task и context записаны до заполнения очередей, задача взята из
+    // очереди под ее мьютексом
+    try
+    {
+      task(context, index);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!error)
+        error = std::current_exception();
+    }
+    if (--remaining == 0)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      done.notify_all();
+    }
+  }
+}
+
+void TThreadPool::Wait(unsigned worker)
+{
+  unsigned long long seen = 0;
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      while (!stop && generation == seen)
+        start.wait(guard);
+      if (stop)
+        return;
+      seen = generation;
+    }
+    Work(worker);
+  }
+}
+
+void TThreadPool::Run(size_t count, TTask t, void* c)
+{
+  if (count == 0)
+    return;
+  task = t;
+  context = c;
+  error = std::exception_ptr();
+  steals = 0;
+  remaining = count;
+
+  const size_t workers = queues.size();
+  for (size_t w = 0; w < workers; w++)
+  {
+    const size_t begin = count / workers * w + (w < count % workers ? w : count % workers);
+    const size_t end = begin + count / workers + (w < count % workers ? 1 : 0);
+    std::lock_guard<std::mutex> guard(queues[w]->lock);
+    for (size_t i = begin; i < end; i++)
+      queues[w]->tasks.push_back(i);
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    generation++;
+  }
+  start.notify_all();
+
+  Work(0);
+  std::exception_ptr e;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    while (remaining != 0)
+      done.wait(guard);
+    e = error;
+    error = std::exception_ptr();
+  }
+  if (e)
+    std::rethrow_exception(e);
+}
@@ -0,0 +1,592 @@
+// векторные ядра арифметических операций и выбор уровня по процессору
+
+#include "simd.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef ARITHMETIC_SIMD
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+void AddScalar(double* y, const double* x, size_t n) { for (size_t k = 0; k < n; k++) y[k] += x[k]; }
+void SubScalar(double* y, const double* x, size_t n) { for (size_t k = 0; k < n; k++) y[k] -= x[k]; }
+void MulScalar(double* y, const double* x, size_t n) { for (size_t k = 0; k < n; k++) y[k] *= x[k]; }
+void DivScalar(double* y, const double* x, size_t n) { for (size_t k = 0; k < n; k++) y[k] /= x[k]; }
+void NegScalar(double* x, size_t n) { for (size_t k = 0; k < n; k++) x[k] = -x[k]; }
+
+void AddScalar(float* y, const float* x, size_t n) { for (size_t k = 0; k < n; k++) y[k] += x[k]; }
+void SubScalar(float* y, const float* x, size_t n) { for (size_t k = 0; k < n; k++) y[k] -= x[k]; }
+void MulScalar(float* y, const float* x, size_t n) { for (size_t k = 0; k < n; k++) y[k] *= x[k]; }
+void DivScalar(float* y, const float* x, size_t n) { for (size_t k = 0; k < n; k++) y[k] /= x[k]; }
+void NegScalar(float* x, size_t n) { for (size_t k = 0; k < n; k++) x[k] = -x[k]; }
+
+const TSimdKernels SCALAR_KERNELS = { SIMD_SCALAR, AddScalar, SubScalar, MulScalar, DivScalar, NegScalar };
+const TSimdFloatKernels SCALAR_FLOAT_KERNELS = { SIMD_SCALAR, AddScalar, SubScalar, MulScalar, DivScalar, NegScalar };
+
+#ifdef ARITHMETIC_SIMD
+
+// Ядра разных уровней отличаются только шириной вектора и интринсиками,
+// поэтому порождаются макросами. Смена знака - xor со знаковым битом,
+// как и у скалярного -x (вычитание из -0 изменило бы NaN).
+#define SIMD_BINARY(NAME, TYPE, TARGET, WIDTH, LOAD, STORE, OP, SCALAR_OP)   \
+  __attribute__((target(TARGET))) void NAME(TYPE* y, const TYPE* x, size_t n) \
+  {                                                                          \
+    size_t k = 0;                                                            \
+    for (; k + WIDTH <= n; k += WIDTH)                                       \
+      STORE(y + k, OP(LOAD(y + k), LOAD(x + k)));                            \
+    for (; k < n; k++)                                                       \
+      y[k] SCALAR_OP x[k];                                                   \
+  }
+
+#define SIMD_KERNELS(SUFFIX, TYPE, TARGET, WIDTH, PREFIX, T)                                             \
+  SIMD_BINARY(Add##SUFFIX, TYPE, TARGET, WIDTH, PREFIX##_loadu_##T, PREFIX##_storeu_##T, PREFIX##_add_##T, +=) \
+  SIMD_BINARY(Sub##SUFFIX, TYPE, TARGET, WIDTH, PREFIX##_loadu_##T, PREFIX##_storeu_##T, PREFIX##_sub_##T, -=) \
+  SIMD_BINARY(Mul##SUFFIX, TYPE, TARGET, WIDTH, PREFIX##_loadu_##T, PREFIX##_storeu_##T, PREFIX##_mul_##T, *=) \
+  SIMD_BINARY(Div##SUFFIX, TYPE, TARGET, WIDTH, PREFIX##_loadu_##T, PREFIX##_storeu_##T, PREFIX##_div_##T, /=)
+
+SIMD_KERNELS(Sse2, double, "sse2", 2, _mm, pd)
+SIMD_KERNELS(Avx2, double, "avx2", 4, _mm256, pd)
+SIMD_KERNELS(Avx512, double, "avx512f", 8, _mm512, pd)
+SIMD_KERNELS(Sse2, float, "sse2", 4, _mm, ps)
+SIMD_KERNELS(Avx2, float, "avx2", 8, _mm256, ps)
+SIMD_KERNELS(Avx512, float, "avx512f", 16, _mm512, ps)
+
+#undef SIMD_KERNELS
+#undef SIMD_BINARY
+
+__attribute__((target("sse2"))) void NegSse2(double* x, size_t n)
+{
+  const __m128d sign = _mm_set1_pd(-0.0);
+  size_t k = 0;
+  for (; k + 2 <= n; k += 2)
+    _mm_storeu_pd(x + k, _mm_xor_pd(_mm_loadu_pd(x + k), sign));
+  for (; k < n; k++)
+    x[k] = -x[k];
+}
+
+__attribute__((target("avx2"))) void NegAvx2(double* x, size_t n)
+{
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  size_t k = 0;
+  for (; k + 4 <= n; k += 4)
+    _mm256_storeu_pd(x + k, _mm256_xor_pd(_mm256_loadu_pd(x + k), sign));
+  for (; k < n; k++)
+    x[k] = -x[k];
+}
+
+// в AVX-512F нет xor для double (он в AVX-512DQ), поэтому xor целый
+__attribute__((target("avx512f"))) void NegAvx512(double* x, size_t n)
+{
+  const __m512i sign = _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ull));
+  size_t k = 0;
+  for (; k + 8 <= n; k += 8)
+  {
+    const __m512i v = _mm512_castpd_si512(_mm512_loadu_pd(x + k));
+    _mm512_storeu_pd(x + k, _mm512_castsi512_pd(_mm512_xor_si512(v, sign)));
+  }
+  for (; k < n; k++)
+    x[k] = -x[k];
+}
+
+__attribute__((target("sse2"))) void NegSse2(float* x, size_t n)
+{
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  size_t k = 0;
+  for (; k + 4 <= n; k += 4)
+    _mm_storeu_ps(x + k, _mm_xor_ps(_mm_loadu_ps(x + k), sign));
+  for (; k < n; k++)
+    x[k] = -x[k];
+}
+
+__attribute__((target("avx2"))) void NegAvx2(float* x, size_t n)
+{
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  size_t k = 0;
+  for (; k + 8 <= n; k += 8)
+    _mm256_storeu_ps(x + k, _mm256_xor_ps(_mm256_loadu_ps(x + k), sign));
+  for (; k < n; k++)
+    x[k] = -x[k];
+}
+
+__attribute__((target("avx512f"))) void NegAvx512(float* x, size_t n)
+{
+  const __m512i sign = _mm512_set1_epi32(static_cast<int>(0x80000000u));
+  size_t k = 0;
+  for (; k + 16 <= n; k += 16)
+  {
+    const __m512i v = _mm512_castps_si512(_mm512_loadu_ps(x + k));
+    _mm512_storeu_ps(x + k, _mm512_castsi512_ps(_mm512_xor_si512(v, sign)));
+  }
+  for (; k < n; k++)
+    x[k] = -x[k];
+}
+
+const TSimdKernels SSE2_KERNELS = { SIMD_SSE2, AddSse2, SubSse2, MulSse2, DivSse2, NegSse2 };
+const TSimdKernels AVX2_KERNELS = { SIMD_AVX2, AddAvx2, SubAvx2, MulAvx2, DivAvx2, NegAvx2 };
+const TSimdKernels AVX512_KERNELS = { SIMD_AVX512, AddAvx512, SubAvx512, MulAvx512, DivAvx512, NegAvx512 };
+const TSimdFloatKernels SSE2_FLOAT_KERNELS = { SIMD_SSE2, AddSse2, SubSse2, MulSse2, DivSse2, NegSse2 };
+const TSimdFloatKernels AVX2_FLOAT_KERNELS = { SIMD_AVX2, AddAvx2, SubAvx2, MulAvx2, DivAvx2, NegAvx2 };
+const TSimdFloatKernels AVX512_FLOAT_KERNELS = { SIMD_AVX512, AddAvx512, SubAvx512, MulAvx512, DivAvx512, NegAvx512 };
+
+#endif
+
+// Многочлены и приведение аргумента - как в fdlibm, кроме exp и ln
+// точности MATH_FAST: их коэффициенты получены интерполяцией в узлах
+// Чебышева. Округление до целого - прибавлением и вычитанием 1.5 * 2^52,
+// тогда младшие биты суммы - само целое (так же делает и векторный код,
+// где нет перевода double в int64).
+
+const double ROUND_MAGIC = 6755399441055744.0;
+
+const double EXP_LIMIT = 708.0;
+const double INV_LN2 = 1.44269504088896338700e+00;
+const double LN2 = 6.93147180559945286227e-01;
+const double LN2_HI = 6.93147180369123816490e-01;
+const double LN2_LO = 1.90821492927058770002e-10;
+const double EXP_P[] =
+{
+  1.66666666666666019037e-01, -2.77777777770155933842e-03, 6.61375632143793436117e-05,
+  -1.65339022054652515390e-06, 4.13813679705723846039e-08
+};
+const double EXP_FAST[] =
+{
+  1.0, 1.0000000000000067, 0.5000000000000006, 0.16666666666554406, 0.04166666666657314,
+  0.008333333385667782, 0.0013888888932488599, 0.00019841170270440067, 2.4801504346997686e-05,
+  2.764018079620985e-06, 2.7626357241447223e-07
+};
+
+const double SQRT2 = 1.41421356237309504880e+00;
+const double LOG_LG[] =
+{
+  6.666666666666735130e-01, 3.999999999940941908e-01, 2.857142874366239149e-01, 2.222219843214978396e-01,
+  1.818357216161805012e-01, 1.531383769920937332e-01, 1.479819860511658591e-01
+};
+const double LOG_FAST[] =
+{
+  0.666666666666667, 0.39999999999899505, 0.28571428625975487, 0.2222221113479508,
+  0.18182889125261723, 0.15331721600556042, 0.14616449685043406
+};
+
+const double TRIG_LIMIT = 1e5;
+const double TWO_OVER_PI = 6.36619772367581382433e-01;
+const double PIO2_1 = 1.57079632673412561417e+00;  // старшие 33 бита pi/2
+const double PIO2_2 = 6.07710050630396597660e-11;  // следующие 33 бита
+const double PIO2_2T = 2.02226624879595063154e-21; // pi/2 - PIO2_1 - PIO2_2
+const double SIN_S[] =
+{
+  -1.66666666666666324348e-01, 8.33333333332248946124e-03, -1.98412698298579493134e-04,
+  2.75573137070700676789e-06, -2.50507602534068634195e-08, 1.58969099521155010221e-10
+};
+const double COS_C[] =
+{
+  4.16666666666666019037e-02, -1.38888888888741095749e-03, 2.48015872894767294178e-05,
+  -2.75573143513906633035e-07, 2.08757232129817482790e-09, -1.13596475577881948265e-11
+};
+
+unsigned long long Bits(double x)
+{
+  unsigned long long b;
+  std::memcpy(&b, &x, sizeof(b));
+  return b;
+}
+
+double FromBits(unsigned long long b)
+{
+  double x;
+  std::memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+// Функции для одного значения; векторные варианты ниже повторяют их
+// операция в операцию. Аргументы вне диапазона многочлена отдаются
+// стандартной библиотеке.
+template <bool PRECISE>
+double Exp(double x)
+{
+  if (!(std::fabs(x) <= EXP_LIMIT))
+    return std::exp(x);
+  const double t = x * INV_LN2 + ROUND_MAGIC;
+  const double k = t - ROUND_MAGIC;
+  const unsigned long long n = Bits(t) - Bits(ROUND_MAGIC);
+  // k * LN2_HI точно: у LN2_HI 32 значащих бита, |k| < 2^10
+  const double hi = x - k * LN2_HI;
+  const double lo = k * LN2_LO;
+  const double r = hi - lo;
+  double y;
+  if (PRECISE)
+  {
+    const double z = r * r;
+    const double c = r - z * (EXP_P[0] + z * (EXP_P[1] + z * (EXP_P[2] + z * (EXP_P[3] + z * EXP_P[4]))));
+    y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+  }
+  else
+  {
+    y = EXP_FAST[10];
+    for (int i = 9; i >= 0; i--)
+      y = y * r + EXP_FAST[i];
+  }
+  return y * FromBits((n + 1023) << 52);
+}
+
+template <bool PRECISE>
+double Log(double x)
+{
+  if (!(x >= DBL_MIN && x <= DBL_MAX))
+    return std::log(x);
+  // x = 2^e * m, m в [sqrt(2)/2, sqrt(2)]
+  const unsigned long long b = Bits(x);
+  double m = FromBits((b & 0x000FFFFFFFFFFFFFull) | 0x3FF0000000000000ull);
+  long long e = static_cast<long long>(b >> 52) - 1023;
+  const bool big = m > SQRT2;
+  m = big ? m * 0.5 : m;
+  e += big ? 1 : 0;
+  const double k = static_cast<double>(e);
+  // ln(m) = 2 atanh(s), s = f / (2 + f)
+  const double f = m - 1.0;
+  const double s = f / (2.0 + f);
+  const double z = s * s;
+  if (PRECISE)
+  {
+    const double w = z * z;
+    const double t1 = w * (LOG_LG[1] + w * (LOG_LG[3] + w * LOG_LG[5]));
+    const double t2 = z * (LOG_LG[0] + w * (LOG_LG[2] + w * (LOG_LG[4] + w * LOG_LG[6])));
+    const double hfsq = 0.5 * f * f;
+    return k * LN2_HI - ((hfsq - (s * (hfsq + (t2 + t1)) + k * LN2_LO)) - f);
+  }
+  double q = LOG_FAST[6];
+  for (int i = 5; i >= 0; i--)
+    q = q * z + LOG_FAST[i];
+  return k * LN2 + s * (2.0 + z * q);
+}
+
+// quarter = 0 - sin(x), 1 - cos(x) = sin(x + pi/2)
+template <bool PRECISE>
+double SinCos(double x, unsigned quarter)
+{
+  if (!(std::fabs(x) <= TRIG_LIMIT))
+    return quarter ? std::cos(x) : std::sin(x);
+  // x = q * pi/2 + r + y, |r| <= pi/4; PRECISE хранит и поправку y
+  const double t = x * TWO_OVER_PI + ROUND_MAGIC;
+  const double q = t - ROUND_MAGIC;
+  const unsigned long long n = Bits(t) + quarter;
+  const double r0 = x - q * PIO2_1;
+  double r, y;
+  if (PRECISE)
+  {
+    double w = q * PIO2_2;
+    const double r1 = r0 - w;
+    w = q * PIO2_2T - ((r0 - r1) - w);
+    r = r1 - w;
+    y = (r1 - r) - w;
+  }
+  else
+  {
+    r = (r0 - q * PIO2_2) - q * PIO2_2T;
+    y = 0.0;
+  }
+  const double z = r * r;
+  const double ps = SIN_S[1] + z * (SIN_S[2] + z * (SIN_S[3] + z * (SIN_S[4] + z * SIN_S[5])));
+  const double pc = z * (COS_C[0] + z * (COS_C[1] + z * (COS_C[2] + z * (COS_C[3] + z * (COS_C[4] + z * COS_C[5])))));
+  double s, c;
+  if (PRECISE)
+  {
+    const double v = z * r;
+    s = r - ((z * (0.5 * y - v * ps) - y) - v * SIN_S[0]);
+    const double hz = 0.5 * z;
+    const double w = 1.0 - hz;
+    c = w + (((1.0 - w) - hz) + (z * pc - r * y));
+  }
+  else
+  {
+    // r + v * p, но так, чтобы у sin(-0) остался знак
+    s = r - (0.0 - z * r * (SIN_S[0] + z * ps));
+    c = (1.0 - 0.5 * z) + z * pc;
+  }
+  // нечетная четверть - косинус, четверти 2 и 3 - со сменой знака
+  return FromBits(Bits((n & 1) ? c : s) ^ ((n & 2) << 62));
+}
+
+template <bool PRECISE> double Sin(double x) { return SinCos<PRECISE>(x, 0); }
+template <bool PRECISE> double Cos(double x) { return SinCos<PRECISE>(x, 1); }
+
+template <double (*F)(double)>
+void Apply(double* x, size_t n)
+{
+  for (size_t k = 0; k < n; k++)
+    x[k] = F(x[k]);
+}
+
+double LibmSin(double x) { return std::sin(x); }
+double LibmCos(double x) { return std::cos(x); }
+double LibmLog(double x) { return std::log(x); }
+double LibmExp(double x) { return std::exp(x); }
+
+const TMathKernels LIBM_KERNELS =
+{
+  MATH_LIBM, SIMD_SCALAR, Apply<LibmSin>, Apply<LibmCos>, Apply<LibmLog>, Apply<LibmExp>
+};
+const TMathKernels PRECISE_KERNELS =
+{
+  MATH_PRECISE, SIMD_SCALAR, Apply<Sin<true> >, Apply<Cos<true> >, Apply<Log<true> >, Apply<Exp<true> >
+};
+const TMathKernels FAST_KERNELS =
+{
+  MATH_FAST, SIMD_SCALAR, Apply<Sin<false> >, Apply<Cos<false> >, Apply<Log<false> >, Apply<Exp<false> >
+};
+
+#ifdef ARITHMETIC_SIMD
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET inline __m256d Set(double x) { return _mm256_set1_pd(x); }
+AVX2_TARGET inline __m256d Add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+AVX2_TARGET inline __m256d Sub(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+AVX2_TARGET inline __m256d Mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+AVX2_TARGET inline __m256d Div(__m256d a, __m256d b) { return _mm256_div_pd(a, b); }
+AVX2_TARGET inline __m256d Abs(__m256d a) { return _mm256_andnot_pd(Set(-0.0), a); }
+AVX2_TARGET inline __m256i AsInt(__m256d a) { return _mm256_castpd_si256(a); }
+AVX2_TARGET inline __m256d AsDouble(__m256i a) { return _mm256_castsi256_pd(a); }
+AVX2_TARGET inline __m256i SetInt(long long x) { return _mm256_set1_epi64x(x); }
+
+// ядра TExp, TLog, TSin, TCos: Special - маска значений, которые
+// вычисляет стандартная библиотека, Vector - многочлен, как в Exp, Log,
+// SinCos, Scalar - скалярный вариант для хвоста
+template <bool PRECISE>
+struct TExp
+{
+  static double Scalar(double x) { return Exp<PRECISE>(x); }
+  static double Libm(double x) { return std::exp(x); }
+  AVX2_TARGET static __m256d Special(__m256d x) { return _mm256_cmp_pd(Abs(x), Set(EXP_LIMIT), _CMP_NLE_UQ); }
+
+  AVX2_TARGET static __m256d Vector(__m256d x)
+  {
+    const __m256d t = Add(Mul(x, Set(INV_LN2)), Set(ROUND_MAGIC));
+    const __m256d k = Sub(t, Set(ROUND_MAGIC));
+    const __m256i n = _mm256_sub_epi64(AsInt(t), AsInt(Set(ROUND_MAGIC)));
+    const __m256d hi = Sub(x, Mul(k, Set(LN2_HI)));
+    const __m256d lo = Mul(k, Set(LN2_LO));
+    const __m256d r = Sub(hi, lo);
+    __m256d y;
+    if (PRECISE)
+    {
+      const __m256d z = Mul(r, r);
+      __m256d p = Set(EXP_P[4]);
+      for (int i = 3; i >= 0; i--)
+        p = Add(Set(EXP_P[i]), Mul(z, p));
+      const __m256d c = Sub(r, Mul(z, p));
+      y = Sub(Set(1.0), Sub(Sub(lo, Div(Mul(r, c), Sub(Set(2.0), c))), hi));
+    }
+    else
+    {
+      y = Set(EXP_FAST[10]);
+      for (int i = 9; i >= 0; i--)
+        y = Add(Mul(y, r), Set(EXP_FAST[i]));
+    }
+    return Mul(y, AsDouble(_mm256_slli_epi64(_mm256_add_epi64(n, SetInt(1023)), 52)));
+  }
+};
+
+template <bool PRECISE>
+struct TLog
+{
+  static double Scalar(double x) { return Log<PRECISE>(x); }
+  static double Libm(double x) { return std::log(x); }
+
+  AVX2_TARGET static __m256d Special(__m256d x)
+  {
+    return _mm256_or_pd(_mm256_cmp_pd(x, Set(DBL_MIN), _CMP_NGE_UQ), _mm256_cmp_pd(x, Set(DBL_MAX), _CMP_NLE_UQ));
+  }
+
+  AVX2_TARGET static __m256d Vector(__m256d x)
+  {
+    const __m256i b = AsInt(x);
+    __m256d m = AsDouble(_mm256_or_si256(_mm256_and_si256(b, SetInt(0x000FFFFFFFFFFFFFll)),
+      SetInt(0x3FF0000000000000ll)));
+    __m256i e = _mm256_sub_epi64(_mm256_srli_epi64(b, 52), SetInt(1023));
+    const __m256d big = _mm256_cmp_pd(m, Set(SQRT2), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, Mul(m, Set(0.5)), big);
+    // маска - это -1 в каждом 64-битном слове
+    e = _mm256_sub_epi64(e, AsInt(big));
+    const __m256d k = Sub(AsDouble(_mm256_add_epi64(e, AsInt(Set(ROUND_MAGIC)))), Set(ROUND_MAGIC));
+    const __m256d f = Sub(m, Set(1.0));
+    const __m256d s = Div(f, Add(Set(2.0), f));
+    const __m256d z = Mul(s, s);
+    if (PRECISE)
+    {
+      const __m256d w = Mul(z, z);
+      const __m256d t1 = Mul(w, Add(Set(LOG_LG[1]), Mul(w, Add(Set(LOG_LG[3]), Mul(w, Set(LOG_LG[5]))))));
+      const __m256d t2 = Mul(z, Add(Set(LOG_LG[0]), Mul(w, Add(Set(LOG_LG[2]),
+        Mul(w, Add(Set(LOG_LG[4]), Mul(w, Set(LOG_LG[6]))))))));
+      const __m256d hfsq = Mul(Mul(Set(0.5), f), f);
+      return Sub(Mul(k, Set(LN2_HI)),
+        Sub(Sub(hfsq, Add(Mul(s, Add(hfsq, Add(t2, t1))), Mul(k, Set(LN2_LO)))), f));
+    }
+    __m256d q = Set(LOG_FAST[6]);
+    for (int i = 5; i >= 0; i--)
+      q = Add(Mul(q, z), Set(LOG_FAST[i]));
+    return Add(Mul(k, Set(LN2)), Mul(s, Add(Set(2.0), Mul(z, q))));
+  }
+};
+
+template <bool PRECISE, unsigned QUARTER>
+struct TSinCos
+{
+  static double Scalar(double x) { return SinCos<PRECISE>(x, QUARTER); }
+  static double Libm(double x) { return QUARTER ? std::cos(x) : std::sin(x); }
+  AVX2_TARGET static __m256d Special(__m256d x) { return _mm256_cmp_pd(Abs(x), Set(TRIG_LIMIT), _CMP_NLE_UQ); }
+
+  AVX2_TARGET static __m256d Vector(__m256d x)
+  {
+    const __m256d t = Add(Mul(x, Set(TWO_OVER_PI)), Set(ROUND_MAGIC));
+    const __m256d q = Sub(t, Set(ROUND_MAGIC));
+    const __m256i n = _mm256_add_epi64(AsInt(t), SetInt(QUARTER));
+    const __m256d r0 = Sub(x, Mul(q, Set(PIO2_1)));
+    __m256d r, y;
+    if (PRECISE)
+    {
+      __m256d w = Mul(q, Set(PIO2_2));
+      const __m256d r1 = Sub(r0, w);
+      w = Sub(Mul(q, Set(PIO2_2T)), Sub(Sub(r0, r1), w));
+      r = Sub(r1, w);
+      y = Sub(Sub(r1, r), w);
+    }
+    else
+    {
+      r = Sub(Sub(r0, Mul(q, Set(PIO2_2))), Mul(q, Set(PIO2_2T)));
+      y = Set(0.0);
+    }
+    const __m256d z = Mul(r, r);
+    __m256d ps = Set(SIN_S[5]);
+    for (int i = 4; i >= 1; i--)
+      ps = Add(Set(SIN_S[i]), Mul(z, ps));
+    __m256d pc = Set(COS_C[5]);
+    for (int i = 4; i >= 0; i--)
+      pc = Add(Set(COS_C[i]), Mul(z, pc));
+    pc = Mul(z, pc);
+    __m256d s, c;
+    if (PRECISE)
+    {
+      const __m256d v = Mul(z, r);
+      s = Sub(r, Sub(Sub(Mul(z, Sub(Mul(Set(0.5), y), Mul(v, ps))), y), Mul(v, Set(SIN_S[0]))));
+      const __m256d hz = Mul(Set(0.5), z);
+      const __m256d w = Sub(Set(1.0), hz);
+      c = Add(w, Add(Sub(Sub(Set(1.0), w), hz), Sub(Mul(z, pc), Mul(r, y))));
+    }
+    else
+    {
+      s = Sub(r, Sub(Set(0.0), Mul(Mul(z, r), Add(Set(SIN_S[0]), Mul(z, ps)))));
+      c = Add(Sub(Set(1.0), Mul(Set(0.5), z)), Mul(z, pc));
+    }
+    const __m256d odd = AsDouble(_mm256_cmpeq_epi64(_mm256_and_si256(n, SetInt(1)), SetInt(1)));
+    const __m256i sign = _mm256_slli_epi64(_mm256_and_si256(n, SetInt(2)), 62);
+    return AsDouble(_mm256_xor_si256(AsInt(_mm256_blendv_pd(s, c, odd)), sign));
+  }
+};
+
+template <class TFunction>
+AVX2_TARGET void ApplyAvx2(double* x, size_t n)
+{
+  size_t k = 0;
+  for (; k + 4 <= n; k += 4)
+  {
+    const __m256d v = _mm256_loadu_pd(x + k);
+    const int special = _mm256_movemask_pd(TFunction::Special(v));
+    double saved[4];
+    if (special != 0)
+      _mm256_storeu_pd(saved, v);
+    _mm256_storeu_pd(x + k, TFunction::Vector(v));
+    if (special != 0)
+      for (int j = 0; j < 4; j++)
+        if (special & (1 << j))
+          x[k + j] = TFunction::Libm(saved[j]);
+  }
+  for (; k < n; k++)
+    x[k] = TFunction::Scalar(x[k]);
+}
+
+#undef AVX2_TARGET
+
+const TMathKernels PRECISE_AVX2_KERNELS =
+{
+  MATH_PRECISE, SIMD_AVX2, ApplyAvx2<TSinCos<true, 0> >, ApplyAvx2<TSinCos<true, 1> >,
+  ApplyAvx2<TLog<true> >, ApplyAvx2<TExp<true> >
+};
+const TMathKernels FAST_AVX2_KERNELS =
+{
+  MATH_FAST, SIMD_AVX2, ApplyAvx2<TSinCos<false, 0> >, ApplyAvx2<TSinCos<false, 1> >,
+  ApplyAvx2<TLog<false> >, ApplyAvx2<TExp<false> >
+};
+
+#endif
+
+TSimdLevel DetectSimd()
+{
+#ifdef ARITHMETIC_SIMD
+  // __builtin_cpu_supports учитывает и то, сохраняет ли ОС регистры AVX
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+  return SIMD_SSE2;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+} // namespace
+
+TSimdLevel SimdSupported()
+{
+  static const TSimdLevel level = DetectSimd();
+  return level;
+}
+
+const TSimdKernels& SimdKernels(TSimdLevel level)
+{
+  if (level > SimdSupported())
+    throw std::invalid_argument("SIMD level is not supported");
+  switch (level)
+  {
+#ifdef ARITHMETIC_SIMD
+  case SIMD_SSE2: return SSE2_KERNELS;
+  case SIMD_AVX2: return AVX2_KERNELS;
+  case SIMD_AVX512: return AVX512_KERNELS;
+#endif
+  default: return SCALAR_KERNELS;
+  }
+}
+
+const TSimdFloatKernels& SimdFloatKernels(TSimdLevel level)
+{
+  if (level > SimdSupported())
+    throw std::invalid_argument("SIMD level is not supported");
+  switch (level)
+  {
+#ifdef ARITHMETIC_SIMD
+  case SIMD_SSE2: return SSE2_FLOAT_KERNELS;
+  case SIMD_AVX2: return AVX2_FLOAT_KERNELS;
+  case SIMD_AVX512: return AVX512_FLOAT_KERNELS;
+#endif
+  default: return SCALAR_FLOAT_KERNELS;
+  }
+}
+
+const TMathKernels& MathKernels(TMathAccuracy accuracy, TSimdLevel level)
+{
+  if (level > SimdSupported())
+    throw std::invalid_argument("SIMD level is not supported");
+  if (accuracy == MATH_LIBM)
+    return LIBM_KERNELS;
+#ifdef ARITHMETIC_SIMD
+  if (level >= SIMD_AVX2)
+    return accuracy == MATH_PRECISE ? PRECISE_AVX2_KERNELS : FAST_AVX2_KERNELS;
+#endif
+  return accuracy == MATH_PRECISE ? PRECISE_KERNELS : FAST_KERNELS;
+}
@@ -0,0 +1,447 @@
+// построение, упрощение и обход дерева арифметического выражения
+
+#include "tree.h"
+#include "stack.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+// те же операции, что выполняет интерпретатор байт-кода;
+// symbol - операнд: символ операции для OP_CALL1 и OP_CALL2,
+// показатель для OP_POWI
+double Apply(unsigned char op, unsigned int symbol, double a, double b)
+{
+  switch (op)
+  {
+  case OP_CALL1: return TPostfix::UnaryOperator(static_cast<unsigned char>(symbol)).unary(a);
+  case OP_CALL2: return TPostfix::BinaryOperator(static_cast<unsigned char>(symbol)).binary(a, b);
+  case OP_POW: return std::pow(a, b);
+  case OP_POWI: return PowI(a, static_cast<short>(symbol));
+  case OP_LT: return a < b ? 1.0 : 0.0;
+  case OP_LE: return a <= b ? 1.0 : 0.0;
+  case OP_EQ: return a == b ? 1.0 : 0.0;
+  case OP_BOOL: return a != 0.0 ? 1.0 : 0.0;
+  case OP_JZ_OR_POP: return a == 0.0 ? 0.0 : b;
+  case OP_JNZ_OR_POP: return a != 0.0 ? 1.0 : b;
+  case OP_ADD: return a + b;
+  case OP_SUB: return a - b;
+  case OP_MUL: return a * b;
+  case OP_DIV: return a / b;
+  case OP_NEG: return -a;
+  case OP_SIN: return std::sin(a);
+  case OP_COS: return std::cos(a);
+  case OP_LN: return std::log(a);
+  default: return std::exp(a);
+  }
+}
+
+unsigned long long Bits(double value)
+{
+  unsigned long long bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// результат операции - всегда 1 или 0
+bool IsBoolean(unsigned char op)
+{
+  return op == OP_LT || op == OP_LE || op == OP_EQ || op == OP_BOOL || op == OP_JZ_OR_POP
+    || op == OP_JNZ_OR_POP;
+}
+
+// незаконченная условная операция при построении дерева по байт-коду
+struct TBranch
+{
+  const unsigned char* target; // куда ведет переход
+  unsigned char op;            // OP_JZ, OP_JZ_OR_POP или OP_JNZ_OR_POP
+  unsigned int first;          // условие или левый операнд
+  unsigned int then;           // ветвь "то" у OP_JZ после OP_JMP
+};
+
+// действие при обходе дерева в Emit
+enum TEmitAction
+{
+  EMIT_VISIT,        // вывести узел
+  EMIT_FINISH,       // дети узла выведены, вывести его операцию
+  EMIT_OPEN_BRANCH,  // начало ветви, которая вычисляется не всегда
+  EMIT_CLOSE_BRANCH,
+  EMIT_OUTPUT        // код очередного выражения закончен
+};
+
+struct TEmitItem
+{
+  unsigned int node;
+  TEmitAction action;
+};
+
+} // namespace
+
+const unsigned int TExprTree::NO_NODE;
+
+size_t TExprTree::TNodeHash::operator()(const TNode& n) const
+{
+  unsigned long long h = n.op;
+  h = h * 0x9E3779B97F4A7C15ull + n.left;
+  h = h * 0x9E3779B97F4A7C15ull + n.right;
+  h = h * 0x9E3779B97F4A7C15ull + n.cond;
+  h = h * 0x9E3779B97F4A7C15ull + n.slot;
+  h = h * 0x9E3779B97F4A7C15ull + Bits(n.value);
+  return static_cast<size_t>(h ^ (h >> 32));
+}
+
+bool TExprTree::TNodeEqual::operator()(const TNode& a, const TNode& b) const
+{
+  return a.op == b.op && a.left == b.left && a.right == b.right && a.cond == b.cond && a.slot == b.slot
+    && Bits(a.value) == Bits(b.value);
+}
+
+TExprTree::TExprTree(const TProgram& prog, unsigned f) : flags(f), shared(0)
+{
+  nodes.reserve(prog.code.size());
+  Append(prog, std::vector<unsigned int>());
+}
+
+TExprTree::TExprTree(unsigned f) : flags(f), shared(0)
+{
+}
+
+// пустой slots - переменные не перенумеровываются
+unsigned int TExprTree::Append(const TProgram& prog, const std::vector<unsigned int>& slots)
+{
+  std::vector<unsigned int> temps(prog.temps, NO_NODE);
+  TStack<unsigned int> st;
+  // переходы вложены друг в друга, последний ведет ближе всех
+  std::vector<TBranch> branches;
+  for (const unsigned char* pc = &prog.code[0];;)
+  {
+    while (!branches.empty() && branches.back().target == pc)
+    {
+      const TBranch b = branches.back();
+      branches.pop_back();
+      const unsigned int last = st.Pop();
+      if (b.op == OP_JZ)
+        st.Push(Make(OP_JZ, b.then, last, 0, b.first));
+      else
+        st.Push(Make(b.op, b.first, last, 0));
+    }
+    if (*pc == OP_END)
+      break;
+
+    const unsigned char op = *pc++;
+    unsigned int operand = 0;
+    if (HasOperand(op))
+    {
+      operand = pc[0] | (pc[1] << 8);
+      pc += 2;
+    }
+    if (op == OP_JMP)
+    {
+      if (branches.empty() || branches.back().op != OP_JZ || branches.back().target != pc)
+        throw std::logic_error("unstructured jump in bytecode");
+      branches.back().then = st.Pop();
+      branches.back().target = pc + operand;
+    }
+    else if (IsJump(op))
+    {
+      const TBranch b = { pc + operand, op, st.Pop(), NO_NODE };
+      branches.push_back(b);
+    }
+    else if (op == OP_CONST)
+      st.Push(Constant(prog.constants[operand]));
+    else if (op == OP_VAR)
+      st.Push(Add(OP_VAR, NO_NODE, NO_NODE, slots.empty() ? operand : slots[operand], 0.0));
+    else if (op == OP_STORE)
+      temps[operand] = st.Top();
+    else if (op == OP_LOAD)
+      st.Push(temps[operand]);
+    else if (IsBinary(op))
+    {
+      const unsigned int right = st.Pop();
+      const unsigned int left = st.Pop();
+      st.Push(Make(op, left, right, operand));
+    }
+    else
+      st.Push(Make(op, st.Pop(), NO_NODE, operand));
+  }
+  roots.push_back(st.Pop());
+  return roots.back();
+}
+
+unsigned int TExprTree::Add(unsigned char op, unsigned int left, unsigned int right, unsigned int slot, double value,
+  unsigned int cond)
+{
+  TNode n;
+  n.op = op;
+  n.left = left;
+  n.right = right;
+  n.cond = cond;
+  n.slot = slot;
+  n.value = value;
+  const unsigned int index = static_cast<unsigned int>(nodes.size());
+  if (flags & OPT_CSE)
+  {
+    std::pair<std::unordered_map<TNode, unsigned int, TNodeHash, TNodeEqual>::iterator, bool> r =
+      known.insert(std::make_pair(n, index));
+    if (!r.second)
+    {
+      shared++;
+      return r.first->second;
+    }
+  }
+  nodes.push_back(n);
+  return index;
+}
+
+unsigned int TExprTree::Constant(double value)
+{
+  return Add(OP_CONST, NO_NODE, NO_NODE, 0, value);
+}
+
+unsigned int TExprTree::Make(unsigned char op, unsigned int left, unsigned int right, unsigned int slot,
+  unsigned int cond)
+{
+  if (flags & OPT_FOLD)
+  {
+    const unsigned int s = Simplify(op, left, right, slot, cond);
+    if (s != NO_NODE)
+      return s;
+  }
+  return Add(op, left, right, slot, 0.0, cond);
+}
+
+// Свертка констант и удаление тождественных операций. Заменяются только
+// операции, результат которых не меняется ни при каком значении x:
+// x*1, 1*x, x/1, x-0, --x. Исключение - x+0 и 0+x: для x = -0 результат
+// +0 вместо -0 (при сравнении они равны). x-x не заменяется на 0,
+// так как для бесконечности и NaN результат - NaN. Зарегистрированные
+// операции считаются чистыми функциями и тоже сворачиваются. Условная
+// операция с известным условием заменяется выбранной ветвью.
+unsigned int TExprTree::Simplify(unsigned char op, unsigned int left, unsigned int right, unsigned int slot,
+  unsigned int cond)
+{
+  const TNode& l = nodes[left];
+  if (op == OP_JZ)
+  {
+    if (nodes[cond].op == OP_CONST)
+      return nodes[cond].value != 0.0 ? left : right;
+    return left == right ? left : NO_NODE;
+  }
+  if (op == OP_JZ_OR_POP || op == OP_JNZ_OR_POP)
+  {
+    if (l.op != OP_CONST)
+      return NO_NODE;
+    // правая часть уже 0 или 1
+    if ((l.value != 0.0) == (op == OP_JZ_OR_POP))
+      return right;
+    return Constant(op == OP_JZ_OR_POP ? 0.0 : 1.0);
+  }
+  if (!IsBinary(op))
+  {
+    if (l.op == OP_CONST)
+      return Constant(Apply(op, slot, l.value, 0.0));
+    if (op == OP_NEG && l.op == OP_NEG)
+      return l.left;
+    if (op == OP_BOOL && IsBoolean(l.op))
+      return left;
+    return NO_NODE;
+  }
+
+  const TNode& r = nodes[right];
+  if (l.op == OP_CONST && r.op == OP_CONST)
+    return Constant(Apply(op, slot, l.value, r.value));
+  // x + (-0) и x - (+0) равны x при любом x, а x + (+0) при x = -0
+  // дает +0, поэтому важен знак нуля
+  const bool leftMinusZero = l.op == OP_CONST && l.value == 0.0 && std::signbit(l.value);
+  const bool rightMinusZero = r.op == OP_CONST && r.value == 0.0 && std::signbit(r.value);
+  const bool rightPlusZero = r.op == OP_CONST && r.value == 0.0 && !std::signbit(r.value);
+  const bool leftOne = l.op == OP_CONST && l.value == 1.0;
+  const bool rightOne = r.op == OP_CONST && r.value == 1.0;
+  switch (op)
+  {
+  case OP_ADD:
+    if (rightMinusZero)
+      return left;
+    if (leftMinusZero)
+      return right;
+    break;
+  case OP_SUB:
+    if (rightPlusZero)
+      return left;
+    break;
+  case OP_MUL:
+    if (rightOne)
+      return left;
+    if (leftOne)
+      return right;
+    break;
+  case OP_DIV:
+    if (rightOne)
+      return left;
+    break;
+  case OP_POW:
+    // показатель стал целой константой после свертки, например x^(-2):
+    // то же, что TProgramBuilder::Power делает для записанного числа
+    if (r.op == OP_CONST && r.value == std::floor(r.value) && std::fabs(r.value) <= POWI_LIMIT)
+      return Add(OP_POWI, left, NO_NODE, static_cast<unsigned short>(static_cast<int>(r.value)), 0.0);
+    break;
+  }
+  return NO_NODE;
+}
+
+size_t TExprTree::Reachable() const
+{
+  std::vector<bool> seen(nodes.size(), false);
+  TStack<unsigned int> st;
+  for (size_t r = 0; r < roots.size(); r++)
+    st.Push(roots[r]);
+  size_t count = 0;
+  while (!st.IsEmpty())
+  {
+    const unsigned int i = st.Pop();
+    if (seen[i])
+      continue;
+    seen[i] = true;
+    count++;
+    if (nodes[i].cond != NO_NODE)
+      st.Push(nodes[i].cond);
+    if (nodes[i].left != NO_NODE)
+      st.Push(nodes[i].left);
+    if (nodes[i].right != NO_NODE)
+      st.Push(nodes[i].right);
+  }
+  return count;
+}
+
+TProgram TExprTree::Emit(std::vector<size_t>* ends) const
+{
+  if (roots.size() != 1 && !ends)
+    throw std::logic_error("several expressions need their code ends");
+  // число ссылок на каждый узел из достижимых узлов; корень, который
+  // одновременно часть другого выражения или корень еще одного, тоже
+  // используется несколько раз
+  std::vector<unsigned int> uses(nodes.size(), 0);
+  {
+    std::vector<bool> seen(nodes.size(), false);
+    TStack<unsigned int> st;
+    for (size_t r = 0; r < roots.size(); r++)
+    {
+      uses[roots[r]]++;
+      st.Push(roots[r]);
+    }
+    while (!st.IsEmpty())
+    {
+      const unsigned int i = st.Pop();
+      if (seen[i])
+        continue;
+      seen[i] = true;
+      const unsigned int children[] = { nodes[i].cond, nodes[i].left, nodes[i].right };
+      for (size_t k = 0; k < 3; k++)
+        if (children[k] != NO_NODE)
+        {
+          uses[children[k]]++;
+          st.Push(children[k]);
+        }
+    }
+  }
+
+  TProgramBuilder builder;
+  const size_t NO_TEMP = static_cast<size_t>(-1);
+  std::vector<size_t> temp(nodes.size(), NO_TEMP);
+  // узлы, сохраненные в ячейки, в порядке сохранения, и число таких
+  // узлов в начале каждой открытой ветви: после ветви ее ячейки забываются
+  std::vector<unsigned int> saved;
+  TStack<size_t> branches;
+  TStack<TEmitItem> st;
+  for (size_t r = roots.size(); r-- > 0;)
+  {
+    const TEmitItem output = { roots[r], EMIT_OUTPUT };
+    const TEmitItem visit = { roots[r], EMIT_VISIT };
+    if (ends)
+      st.Push(output);
+    st.Push(visit);
+  }
+  while (!st.IsEmpty())
+  {
+    const TEmitItem item = st.Pop();
+    const unsigned int i = item.node;
+    const TNode& n = nodes[i];
+    if (item.action == EMIT_OUTPUT)
+    {
+      ends->push_back(builder.Output());
+      continue;
+    }
+    if (item.action == EMIT_OPEN_BRANCH)
+    {
+      branches.Push(saved.size());
+      continue;
+    }
+    if (item.action == EMIT_CLOSE_BRANCH)
+    {
+      const size_t mark = branches.Pop();
+      for (size_t k = mark; k < saved.size(); k++)
+        temp[saved[k]] = NO_TEMP;
+      saved.resize(mark);
+      continue;
+    }
+    if (temp[i] != NO_TEMP)
+    {
+      builder.Emit(OP_LOAD, temp[i]);
+      continue;
+    }
+    if (item.action == EMIT_VISIT && n.left != NO_NODE)
+    {
+      // в стек в обратном порядке: условие, левый, правый ребенок
+      const TEmitItem finish = { i, EMIT_FINISH };
+      const TEmitItem left = { n.left, EMIT_VISIT };
+      const TEmitItem right = { n.right, EMIT_VISIT };
+      const TEmitItem open = { i, EMIT_OPEN_BRANCH };
+      const TEmitItem close = { i, EMIT_CLOSE_BRANCH };
+      const bool lazy = IsJump(n.op);
+      st.Push(finish);
+      if (n.right != NO_NODE)
+      {
+        if (lazy)
+          st.Push(close);
+        st.Push(right);
+        if (lazy)
+          st.Push(open);
+      }
+      if (n.op == OP_JZ)
+        st.Push(close);
+      st.Push(left);
+      if (n.op == OP_JZ)
+      {
+        const TEmitItem condition = { n.cond, EMIT_VISIT };
+        st.Push(open);
+        st.Push(condition);
+      }
+      continue;
+    }
+    if (n.op == OP_CONST)
+      builder.Constant(n.value);
+    else if (n.op == OP_VAR)
+      builder.Emit(OP_VAR, n.slot);
+    else
+    {
+      if (n.op == OP_JZ)
+        builder.Select();
+      else if (IsJump(n.op))
+        builder.ShortCircuit(n.op);
+      else if (HasOperand(n.op))
+        builder.Emit(n.op, n.slot);
+      else
+        builder.Emit(n.op);
+      // загрузка переменной или константы не дороже загрузки из ячейки
+      if (uses[i] > 1)
+      {
+        temp[i] = builder.Temp();
+        builder.Emit(OP_STORE, temp[i]);
+        saved.push_back(i);
+      }
+    }
+  }
+  return builder.Finish();
+}
@@ -1,3 +1,1706 @@
-//     
+// тесты для вычисления арифметических выражений
 
-#include <gtest.h>
\ No newline at end of file
+#include "arithmetic.h"
+#include "batch.h"
+#include "jit.h"
+#include "simd.h"
+#include <gtest.h>
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// генератор случайных корректных выражений от переменных a, b, c, d
+class TRandomExpression
+{
+  unsigned seed;
+
+  unsigned Next(unsigned n)
+  {
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 16) % n;
+  }
+
+public:
+  explicit TRandomExpression(unsigned s) : seed(s) {}
+
+  std::string Make(int depth)
+  {
+    static const char* const LEAVES[] = { "a", "b", "c", "d", "0", "1", "2.5", "0.1" };
+    static const char* const OPERATIONS[] = { "+", "-", "*", "/", "^", "<", "<=", "==", "&&", "||" };
+    static const char* const FUNCTIONS[] = { "sin", "cos", "ln", "exp" };
+    const unsigned kind = depth <= 0 ? 0 : Next(9);
+    if (kind < 2)
+      return LEAVES[Next(8)];
+    if (kind == 2)
+      return "(-" + Make(depth - 1) + ")";
+    if (kind == 3)
+      return std::string(FUNCTIONS[Next(4)]) + "(" + Make(depth - 1) + ")";
+    if (kind == 4)
+      return "(" + Make(depth - 1) + OPERATIONS[Next(10)] + Make(depth - 1) + ")";
+    if (kind == 5)
+      return "(" + Make(depth - 1) + " ? " + Make(depth - 1) + " : " + Make(depth - 1) + ")";
+    return Make(depth - 1) + OPERATIONS[Next(10)] + Make(depth - 1);
+  }
+};
+
+// одинаковые результаты; NaN равен NaN
+bool Same(double x, double y)
+{
+  return x == y || (x != x && y != y);
+}
+
+double Mod(double a, double b) { return std::fmod(a, b); }
+double Minus(double a, double b) { return a - b; }
+double Root(double a) { return std::sqrt(a); }
+
+// число вызовов Counted: проверка того, что ветвь не вычислялась
+int calls = 0;
+double Counted(double a) { calls++; return a; }
+
+// значения, на которых операции IEEE ведут себя по-особому, вперемешку
+// с обычными; у NaN разные полезные данные и знаки
+std::vector<double> SpecialValues(size_t n, unsigned seed)
+{
+  const unsigned long long nans[] = { 0x7FF8000000000001ull, 0xFFF8000000000abcull, 0x7FF0000000000123ull };
+  std::vector<double> values;
+  for (size_t k = 0; k < n; k++)
+  {
+    seed = seed * 1103515245u + 12345u;
+    const unsigned kind = (seed >> 16) % 10;
+    double v = std::ldexp(static_cast<double>(seed >> 8), static_cast<int>(seed % 64) - 40);
+    if (kind == 0)
+      std::memcpy(&v, &nans[(seed >> 4) % 3], sizeof(v));
+    else if (kind == 1)
+      v = (seed & 1) ? 0.0 : -0.0;
+    else if (kind == 2)
+      v = (seed & 1) ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::denorm_min() * 3;
+    else if (kind == 3)
+      v = std::numeric_limits<double>::max();
+    values.push_back((seed & 2) ? -v : v);
+  }
+  return values;
+}
+
+// побитное совпадение; у NaN полезные данные не сравниваются: какой из
+// двух NaN-операндов попадет в результат, IEEE не определяет
+template <class T>
+bool SameBits(const std::vector<T>& x, const std::vector<T>& y)
+{
+  if (x.size() != y.size())
+    return false;
+  for (size_t k = 0; k < x.size(); k++)
+    if (std::memcmp(&x[k], &y[k], sizeof(T)) != 0 && !(x[k] != x[k] && y[k] != y[k]))
+      return false;
+  return true;
+}
+
+// ошибка в ulp относительно значения, вычисленного в long double
+double UlpError(double y, long double exact)
+{
+  const double d = static_cast<double>(exact);
+  if (std::isinf(d) || d == 0.0)
+    return y == d ? 0.0 : 1e300;
+  const double ulp = std::nextafter(std::fabs(d), std::numeric_limits<double>::infinity()) - std::fabs(d);
+  return static_cast<double>(std::fabs(static_cast<long double>(y) - exact) / ulp);
+}
+
+// наибольшая ошибка ядер точности accuracy на аргументах из рабочих
+// диапазонов, в том числе рядом с кратными pi/2
+double MaxUlpError(TMathAccuracy accuracy, TSimdLevel level, int function)
+{
+  const TMathKernels& kernels = MathKernels(accuracy, level);
+  void (*const f[])(double*, size_t) = { kernels.sin, kernels.cos, kernels.ln, kernels.exp };
+  std::vector<double> x;
+  unsigned seed = 17;
+  for (int i = 0; i < 20000; i++)
+  {
+    seed = seed * 1103515245u + 12345u;
+    const double u = (seed >> 8) / 16777216.0;
+    if (function < 2)
+      x.push_back(i % 2 ? (u - 0.5) * 200 : (u - 0.5) * 2e5);
+    else if (function == 2)
+      x.push_back(i % 2 ? std::pow(10.0, (u - 0.5) * 600) : 1.0 + (u - 0.5) * 1e-3);
+    else
+      x.push_back((u - 0.5) * 1416);
+  }
+  for (int k = 1; k < 60000; k += 7)
+    x.push_back(static_cast<double>(k * 1.57079632679489661923132169163975144L));
+  std::vector<double> y(x);
+  f[function](&y[0], y.size());
+  double worst = 0;
+  for (size_t i = 0; i < x.size(); i++)
+  {
+    const long double a = x[i];
+    const long double exact = function == 0 ? std::sin(a) : function == 1 ? std::cos(a) : function == 2 ? std::log(a) : std::exp(a);
+    worst = std::fmax(worst, UlpError(y[i], exact));
+  }
+  return worst;
+}
+
+std::vector<double> Slots(const TPostfix& p, const double* values)
+{
+  std::vector<double> slots;
+  for (size_t v = 0; v < p.GetVariables().size(); v++)
+    slots.push_back(values[p.GetVariables()[v][0] - 'a']);
+  if (slots.empty())
+    slots.push_back(0);
+  return slots;
+}
+
+} // namespace
+
+TEST(TPostfix, can_create_postfix)
+{
+  ASSERT_NO_THROW(TPostfix p("a+b"));
+}
+
+TEST(TPostfix, can_get_infix)
+{
+  TPostfix p("a + b");
+
+  EXPECT_EQ("a + b", p.GetInfix());
+}
+
+TEST(TPostfix, splits_expression_into_lexemes)
+{
+  TPostfix p("sin(x1) * 2.5");
+  const std::vector<TLexeme>& lex = p.GetLexemes();
+
+  ASSERT_EQ(6u, lex.size());
+  EXPECT_EQ(LEX_FUNCTION, lex[0].type);
+  EXPECT_EQ(LEX_LEFT_BRACKET, lex[1].type);
+  EXPECT_EQ(LEX_VARIABLE, lex[2].type);
+  EXPECT_EQ("x1", lex[2].text);
+  EXPECT_EQ(LEX_RIGHT_BRACKET, lex[3].type);
+  EXPECT_EQ(LEX_OPERATION, lex[4].type);
+  EXPECT_EQ(LEX_NUMBER, lex[5].type);
+  EXPECT_EQ(2.5, lex[5].value);
+  EXPECT_EQ(10u, lex[5].pos);
+}
+
+TEST(TPostfix, can_parse_number_with_exponent)
+{
+  TPostfix p("1.5e3");
+
+  EXPECT_EQ(1500.0, p.GetLexemes()[0].value);
+}
+
+TEST(TPostfix, minus_at_start_and_after_bracket_is_unary)
+{
+  TPostfix p("-a-(-b)");
+  const std::vector<TLexeme>& lex = p.GetLexemes();
+
+  EXPECT_EQ(LEX_UNARY_MINUS, lex[0].type);
+  EXPECT_EQ(LEX_OPERATION, lex[2].type);
+  EXPECT_EQ(LEX_UNARY_MINUS, lex[4].type);
+}
+
+TEST(TPostfix, collects_variables_once_in_order_of_appearance)
+{
+  TPostfix p("b*a+b");
+
+  ASSERT_EQ(2u, p.GetVariables().size());
+  EXPECT_EQ("b", p.GetVariables()[0]);
+  EXPECT_EQ("a", p.GetVariables()[1]);
+}
+
+TEST(TPostfix, throws_on_invalid_character_with_its_position)
+{
+  try
+  {
+    TPostfix p("a + $b");
+    FAIL();
+  }
+  catch (const TExpressionError& e)
+  {
+    EXPECT_EQ(4u, e.Position());
+  }
+}
+
+TEST(TPostfix, throws_on_empty_expression)
+{
+  ASSERT_THROW(TPostfix p("   "), TExpressionError);
+}
+
+TEST(TPostfix, throws_on_unmatched_right_bracket_with_its_position)
+{
+  try
+  {
+    TPostfix p("(a+b))");
+    FAIL();
+  }
+  catch (const TExpressionError& e)
+  {
+    EXPECT_EQ(5u, e.Position());
+  }
+}
+
+TEST(TPostfix, throws_on_unmatched_left_bracket_with_its_position)
+{
+  try
+  {
+    TPostfix p("a*((b+c)");
+    FAIL();
+  }
+  catch (const TExpressionError& e)
+  {
+    EXPECT_EQ(2u, e.Position());
+  }
+}
+
+TEST(TPostfix, bracket_pairs_are_stored_in_both_directions)
+{
+  TPostfix p("((a)+b)*(c)");
+
+  EXPECT_EQ(6u, p.GetPair(0));
+  EXPECT_EQ(0u, p.GetPair(6));
+  EXPECT_EQ(3u, p.GetPair(1));
+  EXPECT_EQ(1u, p.GetPair(3));
+  EXPECT_EQ(10u, p.GetPair(8));
+  EXPECT_EQ(TPostfix::NO_PAIR, p.GetPair(2));
+}
+
+TEST(TPostfix, can_get_subexpression_by_any_bracket)
+{
+  TPostfix p("2*(a + (b-c))");
+
+  EXPECT_EQ("a + (b-c)", p.GetSubexpression(2));
+  EXPECT_EQ("a + (b-c)", p.GetSubexpression(p.GetPair(2)));
+  EXPECT_EQ("b-c", p.GetSubexpression(5));
+}
+
+TEST(TPostfix, throws_when_get_subexpression_of_not_bracket)
+{
+  TPostfix p("(a)");
+
+  ASSERT_ANY_THROW(p.GetSubexpression(1));
+}
+
+TEST(TPostfix, can_convert_to_postfix)
+{
+  TPostfix p("a+b*(c-d)/e");
+
+  EXPECT_EQ("a b c d - * e / +", p.GetPostfix());
+}
+
+TEST(TPostfix, postfix_of_unary_minus_and_function)
+{
+  TPostfix p("-sin(a+b)*c");
+
+  EXPECT_EQ("a b + sin ~ c *", p.GetPostfix());
+}
+
+TEST(TPostfix, operations_of_equal_priority_are_left_associative)
+{
+  TPostfix p("a-b-c");
+
+  EXPECT_EQ("a b - c -", p.GetPostfix());
+}
+
+TEST(TPostfix, can_calculate_expression_with_numbers)
+{
+  TPostfix p("(1+2)*3-8/4");
+
+  EXPECT_EQ(7.0, p.Calculate(std::map<std::string, double>()));
+}
+
+TEST(TPostfix, can_calculate_expression_with_variables)
+{
+  TPostfix p("a*(b-c)");
+  std::map<std::string, double> v;
+  v["a"] = 2.0;
+  v["b"] = 5.0;
+  v["c"] = 1.5;
+
+  EXPECT_EQ(7.0, p.Calculate(v));
+}
+
+TEST(TPostfix, can_calculate_unary_minus)
+{
+  TPostfix p("-2*(-3)");
+
+  EXPECT_EQ(6.0, p.Calculate(std::map<std::string, double>()));
+}
+
+TEST(TPostfix, can_calculate_functions)
+{
+  TPostfix p("sin(x)+cos(x)+ln(x)+exp(x)");
+  std::map<std::string, double> v;
+  v["x"] = 0.5;
+
+  EXPECT_DOUBLE_EQ(std::sin(0.5) + std::cos(0.5) + std::log(0.5) + std::exp(0.5), p.Calculate(v));
+}
+
+TEST(TPostfix, throws_when_variable_value_is_missing)
+{
+  TPostfix p("a+b");
+  std::map<std::string, double> v;
+  v["a"] = 1.0;
+
+  ASSERT_ANY_THROW(p.Calculate(v));
+}
+
+TEST(TPostfix, check_accepts_correct_expression)
+{
+  TPostfix::TCheckResult r = TPostfix::Check("-(a + 2.5e-1) * sin(-x) / (b)");
+
+  EXPECT_TRUE(r.ok);
+}
+
+TEST(TPostfix, check_reports_missing_operand)
+{
+  TPostfix::TCheckResult r = TPostfix::Check("a + * b");
+
+  EXPECT_FALSE(r.ok);
+  EXPECT_EQ(4u, r.pos);
+}
+
+TEST(TPostfix, check_reports_missing_operand_at_end)
+{
+  TPostfix::TCheckResult r = TPostfix::Check("a+");
+
+  EXPECT_FALSE(r.ok);
+  EXPECT_EQ(2u, r.pos);
+}
+
+TEST(TPostfix, check_reports_missing_operation)
+{
+  TPostfix::TCheckResult r = TPostfix::Check("a b");
+
+  EXPECT_FALSE(r.ok);
+  EXPECT_EQ(2u, r.pos);
+}
+
+TEST(TPostfix, check_reports_missing_operation_before_bracket)
+{
+  TPostfix::TCheckResult r = TPostfix::Check("2(a)");
+
+  EXPECT_FALSE(r.ok);
+  EXPECT_EQ(1u, r.pos);
+}
+
+TEST(TPostfix, check_rejects_unary_minus_after_operation)
+{
+  TPostfix::TCheckResult r = TPostfix::Check("a*-b");
+
+  EXPECT_FALSE(r.ok);
+  EXPECT_EQ(2u, r.pos);
+}
+
+TEST(TPostfix, check_rejects_double_unary_minus)
+{
+  EXPECT_FALSE(TPostfix::Check("--a").ok);
+}
+
+TEST(TPostfix, check_rejects_function_without_bracket)
+{
+  TPostfix::TCheckResult r = TPostfix::Check("sin x");
+
+  EXPECT_FALSE(r.ok);
+  EXPECT_EQ(4u, r.pos);
+}
+
+TEST(TPostfix, check_rejects_empty_brackets)
+{
+  TPostfix::TCheckResult r = TPostfix::Check("a+()");
+
+  EXPECT_FALSE(r.ok);
+  EXPECT_EQ(3u, r.pos);
+}
+
+TEST(TPostfix, check_rejects_lone_point)
+{
+  EXPECT_FALSE(TPostfix::Check("a+.").ok);
+}
+
+TEST(TPostfix, check_and_constructor_agree_on_error_position)
+{
+  const char* expr = "(a+b)*(c";
+  TPostfix::TCheckResult r = TPostfix::Check(expr);
+
+  ASSERT_FALSE(r.ok);
+  try
+  {
+    TPostfix p(expr);
+    FAIL();
+  }
+  catch (const TExpressionError& e)
+  {
+    EXPECT_EQ(r.pos, e.Position());
+    EXPECT_EQ(6u, e.Position());
+  }
+}
+
+TEST(TPostfix, check_lines_counts_lines_and_reports_line_and_column)
+{
+  const std::string text = "a+b\n\n(a*\r\n  sin(x)\nx y\n";
+
+  TPostfix::TLinesCheckResult r = TPostfix::CheckLines(text.c_str(), text.size(), 1);
+
+  EXPECT_EQ(5u, r.lines);
+  ASSERT_EQ(2u, r.errors.size());
+  EXPECT_EQ(3u, r.errors[0].line);
+  EXPECT_EQ(4u, r.errors[0].column);
+  EXPECT_EQ(5u, r.errors[1].line);
+  EXPECT_EQ(3u, r.errors[1].column);
+}
+
+TEST(TPostfix, check_lines_gives_same_result_for_any_number_of_threads)
+{
+  std::string text;
+  for (int i = 0; i < 1000; i++)
+    text += (i % 7 == 3) ? "a+*b\n" : "(a+b)*c\n";
+
+  TPostfix::TLinesCheckResult one = TPostfix::CheckLines(text.c_str(), text.size(), 1);
+  for (unsigned threads = 2; threads <= 8; threads++)
+  {
+    TPostfix::TLinesCheckResult many = TPostfix::CheckLines(text.c_str(), text.size(), threads);
+
+    EXPECT_EQ(one.lines, many.lines);
+    ASSERT_EQ(one.errors.size(), many.errors.size());
+    for (size_t i = 0; i < one.errors.size(); i++)
+      EXPECT_EQ(one.errors[i].line, many.errors[i].line);
+  }
+  EXPECT_EQ(1000u, one.lines);
+  EXPECT_EQ(143u, one.errors.size());
+}
+
+TEST(TPostfix, check_lines_accepts_last_line_without_newline)
+{
+  const std::string text = "a\nb+";
+
+  TPostfix::TLinesCheckResult r = TPostfix::CheckLines(text.c_str(), text.size(), 2);
+
+  EXPECT_EQ(2u, r.lines);
+  ASSERT_EQ(1u, r.errors.size());
+  EXPECT_EQ(2u, r.errors[0].line);
+}
+
+TEST(TPostfix, compiles_to_bytecode)
+{
+  TPostfix p("-(a+1.5)*b");
+  const TProgram& prog = p.GetProgram();
+  const unsigned char expected[] =
+  {
+    OP_VAR, 0, 0, OP_CONST, 0, 0, OP_ADD, OP_NEG, OP_VAR, 1, 0, OP_MUL, OP_END
+  };
+
+  ASSERT_EQ(sizeof(expected), prog.code.size());
+  for (size_t i = 0; i < sizeof(expected); i++)
+    EXPECT_EQ(expected[i], prog.code[i]);
+  ASSERT_EQ(1u, prog.constants.size());
+  EXPECT_EQ(1.5, prog.constants[0]);
+}
+
+TEST(TPostfix, constant_pool_has_no_duplicates)
+{
+  TPostfix p("2*a + 2.0*b - 3 + 2e0");
+
+  EXPECT_EQ(2u, p.GetProgram().constants.size());
+}
+
+TEST(TPostfix, can_calculate_with_values_by_slot)
+{
+  TPostfix p("x/y - y");
+  const double values[] = { 9.0, 3.0 };
+
+  EXPECT_EQ(0.0, p.Calculate(values));
+}
+
+TEST(TPostfix, can_execute_program_directly)
+{
+  TPostfix p("exp(ln(a)) + 1");
+  const TProgram& prog = p.GetProgram();
+  const double a = 2.0;
+
+  EXPECT_DOUBLE_EQ(3.0, Execute(&prog.code[0], &prog.constants[0], &a));
+}
+
+TEST(TPostfix, stack_engine_is_default)
+{
+  TPostfix p("a+b");
+
+  EXPECT_EQ(ENGINE_STACK, p.GetEngine());
+}
+
+TEST(TPostfix, register_program_has_no_loads_and_reuses_temporaries)
+{
+  TPostfix p("(a+b)*(c+d) - (a+b)");
+  p.SetEngine(ENGINE_REGISTER);
+  const TRegisterProgram& prog = p.GetRegisterProgram();
+
+  EXPECT_EQ(5u, prog.code.size());
+  EXPECT_EQ(4u + 2u, prog.registers);
+}
+
+TEST(TPostfix, register_engine_gives_same_results_as_stack_engine)
+{
+  const char* exprs[] =
+  {
+    "a", "2.5", "-a", "-(a+b)*c/(d-2)", "sin(a)*cos(b)+ln(c)-exp(-d)",
+    "a-b-c-d", "a/(b/(c/d))", "((a*b)+(c*d))*((a-b)/(c+1))"
+  };
+  const double values[] = { 1.25, -0.5, 3.0, 0.75 };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+  {
+    TPostfix p(exprs[i]);
+    std::vector<double> slots;
+    for (size_t v = 0; v < p.GetVariables().size(); v++)
+      slots.push_back(values[p.GetVariables()[v][0] - 'a']);
+    const double* args = slots.empty() ? 0 : &slots[0];
+    const double expected = p.Calculate(args);
+
+    p.SetEngine(ENGINE_REGISTER);
+
+    EXPECT_EQ(expected, p.Calculate(args)) << exprs[i];
+  }
+}
+
+TEST(TPostfix, optimize_reports_node_counts)
+{
+  TPostfix p("x*(2+3) - 0");
+
+  TOptimizeStats stats = p.Optimize();
+
+  EXPECT_EQ(7u, stats.nodesBefore);
+  EXPECT_EQ(3u, stats.nodesAfter);
+}
+
+TEST(TPostfix, optimized_expression_gives_same_result)
+{
+  const char* exprs[] =
+  {
+    "x*(2+3)", "-(-x)*1", "(x+0)/1 - 0", "sin(2)*x + exp(1-1)", "(1+2)*(3+4)", "-x"
+  };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+  {
+    TPostfix p(exprs[i]);
+    const double x = 1.75;
+    const double expected = p.Calculate(&x);
+
+    p.Optimize();
+
+    EXPECT_EQ(expected, p.Calculate(&x)) << exprs[i];
+  }
+}
+
+TEST(TPostfix, optimize_updates_register_program)
+{
+  TPostfix p("(a*1)*(2+3)");
+  p.SetEngine(ENGINE_REGISTER);
+  const double a = 2.0;
+
+  p.Optimize();
+
+  EXPECT_EQ(1u, p.GetRegisterProgram().code.size());
+  EXPECT_EQ(10.0, p.Calculate(&a));
+}
+
+TEST(TPostfix, optimize_reports_shared_nodes)
+{
+  TPostfix p("(a+b)*(a+b)");
+
+  TOptimizeStats stats = p.Optimize(OPT_CSE);
+
+  EXPECT_EQ(7u, stats.nodesBefore);
+  EXPECT_EQ(4u, stats.nodesAfter);
+  EXPECT_EQ(3u, stats.shared);
+}
+
+TEST(TPostfix, common_subexpressions_give_same_result_in_both_engines)
+{
+  const char* exprs[] =
+  {
+    "(a+b)*(a+b)/(a+b)", "sin(a*b) - cos(a*b) * sin(a*b)", "(a-b)*(a-b) + (a-b)",
+    "exp(-(a+b)) * exp(-(a+b))", "((a*b)+(a*b))*((a*b)+(a*b))"
+  };
+  const double values[] = { 0.3, 1.7 };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+  {
+    TPostfix p(exprs[i]);
+    const double expected = p.Calculate(values);
+
+    p.Optimize(OPT_FOLD | OPT_CSE);
+
+    EXPECT_EQ(expected, p.Calculate(values)) << exprs[i];
+    p.SetEngine(ENGINE_REGISTER);
+    EXPECT_EQ(expected, p.Calculate(values)) << exprs[i];
+  }
+}
+
+TEST(TPostfix, stack_depth_is_computed_while_compiling)
+{
+  EXPECT_EQ(1u, TPostfix("a").GetProgram().depth);
+  EXPECT_EQ(2u, TPostfix("a+b+c+d").GetProgram().depth);
+  EXPECT_EQ(3u, TPostfix("a+b*c").GetProgram().depth);
+  EXPECT_EQ(3u, TPostfix("(a+b)*(c+d)").GetProgram().depth);
+}
+
+TEST(TPostfix, stack_depth_matches_depth_found_by_bytecode_scan)
+{
+  const char* exprs[] =
+  {
+    "-(a+1.5)*b", "sin(a*(b-(c/d)))", "(a+b)*(a+b)/(a+b)", "x*(2+3) + 0 - (y*(z+(w*1)))"
+  };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+  {
+    TPostfix p(exprs[i]);
+    EXPECT_EQ(StackDepth(&p.GetProgram().code[0]), p.GetProgram().depth) << exprs[i];
+    p.Optimize(OPT_FOLD | OPT_CSE);
+    EXPECT_EQ(StackDepth(&p.GetProgram().code[0]), p.GetProgram().depth) << exprs[i];
+  }
+}
+
+TEST(TPostfix, stack_depth_scan_rejects_broken_bytecode)
+{
+  const unsigned char underflow[] = { OP_VAR, 0, 0, OP_ADD, OP_END };
+  const unsigned char twoValues[] = { OP_VAR, 0, 0, OP_VAR, 1, 0, OP_END };
+
+  ASSERT_ANY_THROW(StackDepth(underflow));
+  ASSERT_ANY_THROW(StackDepth(twoValues));
+}
+
+TEST(TPostfix, can_calculate_expression_deeper_than_local_stack)
+{
+  std::string expr = "1";
+  for (int i = 0; i < 100; i++)
+    expr = "1-(" + expr + ")";
+  TPostfix p(expr);
+
+  EXPECT_EQ(101u, p.GetProgram().depth);
+  EXPECT_EQ(1.0, p.Calculate(std::map<std::string, double>()));
+}
+
+TEST(TPostfix, jit_engine_is_used_when_supported)
+{
+  TPostfix p("a*b+sin(a)");
+
+  p.SetEngine(ENGINE_JIT);
+
+  EXPECT_EQ(TJitCode::Supported() ? ENGINE_JIT : ENGINE_STACK, p.GetEngine());
+}
+
+TEST(TPostfix, jit_falls_back_to_stack_engine_for_deep_expression)
+{
+  std::string expr = "a";
+  for (int i = 0; i < 20; i++)
+    expr = "a-(" + expr + ")";
+  TPostfix p(expr);
+  const double a[] = { 2 };
+
+  p.SetEngine(ENGINE_JIT);
+
+  EXPECT_EQ(ENGINE_STACK, p.GetEngine());
+  EXPECT_EQ(2.0, p.Calculate(a));
+}
+
+TEST(TPostfix, jit_gives_same_results_as_stack_engine)
+{
+  const char* exprs[] =
+  {
+    "a", "2.5", "-a", "-(a+b)*c/(d-2)", "sin(a)*cos(b)+ln(c)-exp(-d)",
+    "a-b-c-d", "a/(b/(c/d))", "a+(b+(c+(d+sin(a+(b+(c+d))))))"
+  };
+  const double values[] = { 1.25, -0.5, 3.0, 0.75 };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+  {
+    TPostfix p(exprs[i]);
+    const std::vector<double> slots = Slots(p, values);
+    const double expected = p.Calculate(&slots[0]);
+
+    p.SetEngine(ENGINE_JIT);
+
+    EXPECT_EQ(expected, p.Calculate(&slots[0])) << exprs[i];
+  }
+}
+
+TEST(TPostfix, jit_agrees_with_interpreter_on_random_expressions)
+{
+  TRandomExpression gen(12345);
+  const double values[][4] =
+  {
+    { 1.25, -0.5, 3.0, 0.75 },
+    { 0.0, -0.0, 1e300, -1e-300 },
+    { 2.0, 0.5, -7.0, 100.0 }
+  };
+
+  for (int n = 0; n < 300; n++)
+  {
+    const std::string expr = gen.Make(6);
+    TPostfix p(expr);
+    if (n % 2)
+      p.Optimize(OPT_FOLD | OPT_CSE);
+    TPostfix jit(p);
+    jit.SetEngine(ENGINE_JIT);
+    for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); v++)
+    {
+      const std::vector<double> slots = Slots(p, values[v]);
+      const double expected = p.Calculate(&slots[0]);
+      const double actual = jit.Calculate(&slots[0]);
+      EXPECT_TRUE(Same(expected, actual)) << expr << ": " << expected << " != " << actual;
+    }
+  }
+}
+
+TEST(TPostfix, jit_code_survives_optimize)
+{
+  TPostfix p("(a+b)*(a+b)+0");
+  const double ab[] = { 1, 2 };
+  p.SetEngine(ENGINE_JIT);
+
+  p.Optimize(OPT_FOLD | OPT_CSE);
+
+  EXPECT_EQ(9.0, p.Calculate(ab));
+}
+
+TEST(TPostfix, can_register_binary_operator)
+{
+  TPostfix::RegisterOperator('%', 2, ASSOC_LEFT, Mod);
+
+  TPostfix p("7 % 4 + 1");
+
+  EXPECT_EQ("7 4 % 1 +", p.GetPostfix());
+  EXPECT_EQ(4.0, p.Calculate(std::map<std::string, double>()));
+}
+
+TEST(TPostfix, registered_operator_respects_priority)
+{
+  TPostfix::RegisterOperator('%', 2, ASSOC_LEFT, Mod);
+
+  TPostfix p("1 + 7 % 4 * 2");
+
+  EXPECT_EQ("1 7 4 % 2 * +", p.GetPostfix());
+}
+
+TEST(TPostfix, right_associative_operator_groups_from_right)
+{
+  TPostfix::RegisterOperator(';', 1, ASSOC_RIGHT, Minus);
+
+  TPostfix p("8 ; 4 ; 2");
+
+  EXPECT_EQ("8 4 2 ; ;", p.GetPostfix());
+  EXPECT_EQ(6.0, p.Calculate(std::map<std::string, double>()));
+}
+
+TEST(TPostfix, can_register_unary_operator)
+{
+  TPostfix::RegisterOperator('@', 3, Root);
+
+  TPostfix p("@16*2 + (@a)");
+  std::map<std::string, double> v;
+  v["a"] = 9.0;
+
+  EXPECT_EQ("16 @ 2 * a @ +", p.GetPostfix());
+  EXPECT_EQ(11.0, p.Calculate(v));
+}
+
+TEST(TPostfix, registered_unary_operator_is_allowed_only_at_start_or_after_bracket)
+{
+  TPostfix::RegisterOperator('@', 3, Root);
+
+  TPostfix::TCheckResult r = TPostfix::Check("a*@b");
+
+  EXPECT_FALSE(r.ok);
+  EXPECT_EQ(2u, r.pos);
+  EXPECT_FALSE(TPostfix::Check("a@b").ok);
+}
+
+TEST(TPostfix, registered_operators_work_in_all_engines)
+{
+  TPostfix::RegisterOperator('%', 2, ASSOC_LEFT, Mod);
+  TPostfix::RegisterOperator('@', 3, Root);
+  const double values[] = { 10.5, 4.0, 2.0 };
+  TPostfix p("(@(a % b) + c % 3) * (@(a % b) - (@4 % 3))");
+  const double expected = p.Calculate(values);
+  const TEngine engines[] = { ENGINE_STACK, ENGINE_REGISTER, ENGINE_JIT };
+
+  for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+  {
+    TPostfix q(p);
+    q.SetEngine(engines[e]);
+    if (engines[e] != ENGINE_JIT || TJitCode::Supported())
+    {
+      EXPECT_EQ(engines[e], q.GetEngine());
+    }
+    EXPECT_EQ(expected, q.Calculate(values));
+    q.Optimize(OPT_FOLD | OPT_CSE);
+    EXPECT_EQ(expected, q.Calculate(values));
+  }
+}
+
+TEST(TPostfix, optimize_folds_registered_operator)
+{
+  TPostfix::RegisterOperator('%', 2, ASSOC_LEFT, Mod);
+  TPostfix p("a + 7 % 4");
+
+  p.Optimize(OPT_FOLD);
+
+  EXPECT_EQ(1u, p.GetProgram().constants.size());
+  EXPECT_EQ(3.0, p.GetProgram().constants[0]);
+}
+
+TEST(TPostfix, cannot_register_builtin_or_invalid_operator)
+{
+  ASSERT_ANY_THROW(TPostfix::RegisterOperator('+', 1, ASSOC_LEFT, Minus));
+  ASSERT_ANY_THROW(TPostfix::RegisterOperator('-', 3, Root));
+  ASSERT_ANY_THROW(TPostfix::RegisterOperator('x', 1, ASSOC_LEFT, Minus));
+  ASSERT_ANY_THROW(TPostfix::RegisterOperator('(', 1, ASSOC_LEFT, Minus));
+  ASSERT_ANY_THROW(TPostfix::RegisterOperator('.', 1, ASSOC_LEFT, Minus));
+  ASSERT_ANY_THROW(TPostfix::RegisterOperator(' ', 1, ASSOC_LEFT, Minus));
+  ASSERT_ANY_THROW(TPostfix::RegisterOperator('%', 0, ASSOC_LEFT, Minus));
+}
+
+TEST(TPostfix, power_is_right_associative)
+{
+  TPostfix p("2^3^2");
+
+  EXPECT_EQ("2 3 2 ^ ^", p.GetPostfix());
+  EXPECT_EQ(512.0, p.Calculate(std::map<std::string, double>()));
+}
+
+TEST(TPostfix, power_binds_tighter_than_unary_minus_and_multiplication)
+{
+  EXPECT_EQ(-4.0, TPostfix("-2^2").Calculate(std::map<std::string, double>()));
+  EXPECT_EQ(18.0, TPostfix("2*3^2").Calculate(std::map<std::string, double>()));
+  EXPECT_EQ(-7.0, TPostfix("1-2^3").Calculate(std::map<std::string, double>()));
+}
+
+TEST(TPostfix, integer_exponent_compiles_to_multiplications)
+{
+  TPostfix p("x^3");
+  const unsigned char expected[] = { OP_VAR, 0, 0, OP_POWI, 3, 0, OP_END };
+
+  const TProgram& prog = p.GetProgram();
+
+  ASSERT_EQ(sizeof(expected), prog.code.size());
+  for (size_t i = 0; i < sizeof(expected); i++)
+    EXPECT_EQ(expected[i], prog.code[i]) << i;
+  EXPECT_TRUE(prog.constants.empty());
+  EXPECT_EQ(1u, prog.depth);
+}
+
+TEST(TPostfix, fractional_or_variable_exponent_uses_pow)
+{
+  TPostfix p("x^0.5 + x^y + x^100");
+  const double values[] = { 2.0, 3.0 };
+  size_t pows = 0;
+
+  for (const unsigned char* pc = &p.GetProgram().code[0]; *pc != OP_END; pc += HasOperand(*pc) ? 3 : 1)
+    if (*pc == OP_POW)
+      pows++;
+
+  EXPECT_EQ(3u, pows);
+  EXPECT_EQ(std::pow(2.0, 0.5) + 8.0 + std::pow(2.0, 100.0), p.Calculate(values));
+}
+
+TEST(TPostfix, integer_power_is_close_to_pow)
+{
+  const double xs[] = { 0.1, 1.7, -3.25, 123.456, 1e-3 };
+  for (size_t i = 0; i < sizeof(xs) / sizeof(xs[0]); i++)
+  {
+    EXPECT_EQ(std::pow(xs[i], 2.0), PowI(xs[i], 2));
+    for (int n = -POWI_LIMIT; n <= POWI_LIMIT; n++)
+      EXPECT_NEAR(1.0, PowI(xs[i], n) / std::pow(xs[i], n), 1e-13) << xs[i] << "^" << n;
+  }
+  EXPECT_EQ(1.0, PowI(std::nan(""), 0));
+}
+
+TEST(TPostfix, optimize_turns_folded_integer_exponent_into_multiplications)
+{
+  TPostfix p("x^(-(1+1))");
+  const double x[] = { 4.0 };
+
+  p.Optimize(OPT_FOLD);
+
+  EXPECT_EQ(OP_POWI, p.GetProgram().code[3]);
+  EXPECT_EQ(1.0 / 16.0, p.Calculate(x));
+}
+
+TEST(TPostfix, integer_power_gives_same_results_in_all_engines)
+{
+  const char* exprs[] = { "x^0", "x^1", "x^2", "x^3", "x^7 - x^64", "(x^(-(3)))^2", "2^x^2" };
+  const double x[] = { -1.37 };
+  const TEngine engines[] = { ENGINE_REGISTER, ENGINE_JIT };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+  {
+    TPostfix p(exprs[i]);
+    const double expected = p.Calculate(x);
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+    {
+      TPostfix q(p);
+      q.SetEngine(engines[e]);
+      EXPECT_EQ(expected, q.Calculate(x)) << exprs[i];
+      q.Optimize(OPT_FOLD | OPT_CSE);
+      EXPECT_TRUE(Same(q.Calculate(x), TPostfix(q).Calculate(x))) << exprs[i];
+    }
+  }
+}
+
+TEST(TPostfix, comparisons_give_one_or_zero)
+{
+  const double xy[] = { 1.0, 2.0 };
+  const double yx[] = { 2.0, 1.0 };
+  const double nan[] = { std::nan(""), std::nan("") };
+
+  EXPECT_EQ(1.0, TPostfix("x < y").Calculate(xy));
+  EXPECT_EQ(0.0, TPostfix("x < y").Calculate(yx));
+  EXPECT_EQ(1.0, TPostfix("x <= x").Calculate(xy));
+  EXPECT_EQ(0.0, TPostfix("x == y").Calculate(xy));
+  EXPECT_EQ(0.0, TPostfix("x == y").Calculate(nan));
+  EXPECT_EQ(0.0, TPostfix("x <= y").Calculate(nan));
+}
+
+TEST(TPostfix, comparisons_and_logic_have_c_precedence)
+{
+  TPostfix p("a + 1 < b * 2 == c || d && a <= b");
+
+  EXPECT_EQ("a 1 + b 2 * < c == d a b <= && ||", p.GetPostfix());
+  EXPECT_EQ(1.0, TPostfix("1 < 2 == 1").Calculate(std::map<std::string, double>()));
+  EXPECT_EQ(0.0, TPostfix("0 && 1 || 0").Calculate(std::map<std::string, double>()));
+}
+
+TEST(TPostfix, conditional_operator_is_right_associative)
+{
+  TPostfix p("a ? b : c ? d : 5");
+  const double values[] = { 0.0, 2.0, 0.0, 4.0 };
+
+  EXPECT_EQ("a b c d 5 ?: ?:", p.GetPostfix());
+  EXPECT_EQ(5.0, p.Calculate(values));
+}
+
+TEST(TPostfix, conditional_operator_has_lowest_priority)
+{
+  TPostfix p("x < 1 || x == 2 ? x + 1 : x * 10");
+  const double one[] = { 0.5 };
+  const double two[] = { 2.0 };
+  const double three[] = { 3.0 };
+
+  EXPECT_EQ(1.5, p.Calculate(one));
+  EXPECT_EQ(3.0, p.Calculate(two));
+  EXPECT_EQ(30.0, p.Calculate(three));
+}
+
+TEST(TPostfix, nan_and_negative_zero_conditions)
+{
+  TPostfix p("c ? 1 : 2");
+  const double nan[] = { std::nan("") };
+  const double zero[] = { -0.0 };
+
+  EXPECT_EQ(1.0, p.Calculate(nan));
+  EXPECT_EQ(2.0, p.Calculate(zero));
+  // -0 && x дает +0
+  EXPECT_FALSE(std::signbit(TPostfix("c && 1").Calculate(zero)));
+  EXPECT_EQ(1.0, TPostfix("c || 0").Calculate(nan));
+}
+
+TEST(TPostfix, conditional_operator_compiles_to_jumps)
+{
+  TPostfix p("c ? x : 2");
+  const unsigned char expected[] =
+  {
+    OP_VAR, 0, 0, OP_JZ, 6, 0, OP_VAR, 1, 0, OP_JMP, 3, 0, OP_CONST, 0, 0, OP_END
+  };
+
+  const TProgram& prog = p.GetProgram();
+
+  ASSERT_EQ(sizeof(expected), prog.code.size());
+  for (size_t i = 0; i < sizeof(expected); i++)
+    EXPECT_EQ(expected[i], prog.code[i]) << i;
+  EXPECT_EQ(1u, prog.depth);
+}
+
+TEST(TPostfix, logical_operators_compile_to_jumps)
+{
+  TPostfix p("a && b || c");
+  const unsigned char expected[] =
+  {
+    OP_VAR, 0, 0, OP_JZ_OR_POP, 4, 0, OP_VAR, 1, 0, OP_BOOL,
+    OP_JNZ_OR_POP, 4, 0, OP_VAR, 2, 0, OP_BOOL, OP_END
+  };
+
+  const TProgram& prog = p.GetProgram();
+
+  ASSERT_EQ(sizeof(expected), prog.code.size());
+  for (size_t i = 0; i < sizeof(expected); i++)
+    EXPECT_EQ(expected[i], prog.code[i]) << i;
+}
+
+TEST(TPostfix, untaken_branches_are_not_evaluated)
+{
+  TPostfix::RegisterOperator('$', 5, Counted);
+  const char* exprs[] = { "a && ($b)", "a || ($b)", "a ? ($b) : ($c)", "(1 - a) ? ($b) : ($c) * ($c)" };
+  const double values[] = { 0.0, 2.0, 3.0 };
+  const TEngine engines[] = { ENGINE_STACK, ENGINE_REGISTER, ENGINE_JIT };
+  const int expected[] = { 0, 1, 1, 1 };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+    {
+      TPostfix p(exprs[i]);
+      p.Optimize(OPT_CSE);
+      p.SetEngine(engines[e]);
+      calls = 0;
+      p.Calculate(values);
+      EXPECT_EQ(expected[i], calls) << exprs[i] << ", engine " << engines[e];
+    }
+}
+
+TEST(TPostfix, optimize_selects_branch_with_constant_condition)
+{
+  TPostfix p("1 < 2 ? x : y");
+  const double xy[] = { 3.0, 4.0 };
+
+  p.Optimize(OPT_FOLD);
+
+  ASSERT_EQ(4u, p.GetProgram().code.size());
+  EXPECT_EQ(OP_VAR, p.GetProgram().code[0]);
+  EXPECT_EQ(3.0, p.Calculate(xy));
+}
+
+TEST(TPostfix, common_subexpression_inside_branch_is_not_reused_outside)
+{
+  // sin(x) сохраняется в ячейку в ветви "то", которая при c = 0 не
+  // выполняется, поэтому в ветви "иначе" он вычисляется заново
+  TPostfix p("(c ? sin(x) * sin(x) : sin(x) + 1) + (c < 1 && sin(x) < 2)");
+  const double values[][2] = { { 0.0, 0.5 }, { 1.0, 0.5 } };
+  const TEngine engines[] = { ENGINE_STACK, ENGINE_REGISTER, ENGINE_JIT };
+
+  for (size_t v = 0; v < 2; v++)
+  {
+    const double expected = p.Calculate(values[v]);
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+    {
+      TPostfix q(p);
+      q.Optimize(OPT_FOLD | OPT_CSE);
+      q.SetEngine(engines[e]);
+      EXPECT_EQ(expected, q.Calculate(values[v])) << v << ", engine " << engines[e];
+    }
+  }
+}
+
+TEST(TPostfix, engines_agree_on_random_conditional_expressions)
+{
+  TRandomExpression gen(777);
+  const double values[][4] =
+  {
+    { 1.25, -0.5, 0.0, 0.75 },
+    { 0.0, -0.0, std::nan(""), 1.0 },
+    { 2.0, 2.0, -7.0, 100.0 }
+  };
+  const TEngine engines[] = { ENGINE_REGISTER, ENGINE_JIT };
+
+  for (int n = 0; n < 300; n++)
+  {
+    const std::string expr = gen.Make(6);
+    const TPostfix p(expr);
+    TPostfix optimized(p);
+    optimized.Optimize(OPT_FOLD | OPT_CSE);
+    for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); v++)
+    {
+      const std::vector<double> slots = Slots(p, values[v]);
+      const double expected = p.Calculate(&slots[0]);
+      EXPECT_TRUE(Same(expected, optimized.Calculate(&slots[0]))) << expr;
+      for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+      {
+        TPostfix q(e % 2 ? optimized : p);
+        q.SetEngine(engines[e]);
+        EXPECT_TRUE(Same(expected, q.Calculate(&slots[0]))) << expr << ", engine " << engines[e];
+      }
+    }
+  }
+}
+
+TEST(TPostfix, check_reports_unmatched_conditional_parts)
+{
+  const struct
+  {
+    const char* expr;
+    size_t pos;
+    const char* message;
+  } cases[] =
+  {
+    { "a ? b", 2, "'?' without matching ':'" },
+    { "a : b", 2, "':' without matching '?'" },
+    { "(a ? b) : c", 3, "'?' without matching ':'" },
+    { "a ? (b : c)", 7, "':' without matching '?'" },
+    { "a ? b : c : d", 10, "':' without matching '?'" },
+    { "a = b", 2, "invalid character" },
+    { "a & b", 2, "invalid character" },
+    { "a < = b", 4, "invalid character" },
+    { "a ? : b", 4, "operand expected" }
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+  {
+    const TPostfix::TCheckResult r = TPostfix::Check(cases[i].expr);
+    EXPECT_FALSE(r.ok) << cases[i].expr;
+    EXPECT_EQ(cases[i].pos, r.pos) << cases[i].expr;
+    EXPECT_STREQ(cases[i].message, r.message) << cases[i].expr;
+  }
+}
+
+TEST(TPostfix, cannot_register_logical_operator_symbols)
+{
+  const char symbols[] = { '<', '=', '&', '|', '?', ':' };
+  for (size_t i = 0; i < sizeof(symbols); i++)
+    EXPECT_THROW(TPostfix::RegisterOperator(symbols[i], 1, ASSOC_LEFT, Mod), std::invalid_argument)
+      << symbols[i];
+}
+
+TEST(TSimdKernels, scalar_level_is_always_supported)
+{
+  EXPECT_EQ(SIMD_SCALAR, SimdKernels(SIMD_SCALAR).level);
+  EXPECT_EQ(SimdSupported(), SimdKernels(SimdSupported()).level);
+  if (SimdSupported() < SIMD_AVX512)
+  {
+    EXPECT_THROW(SimdKernels(SIMD_AVX512), std::invalid_argument);
+  }
+}
+
+TEST(TSimdKernels, kernels_match_scalar_bit_for_bit)
+{
+  const TSimdKernels& scalar = SimdKernels(SIMD_SCALAR);
+  // хвосты любой длины и невыровненное начало массива
+  for (size_t n = 0; n < 40; n++)
+    for (int level = SIMD_SSE2; level <= SimdSupported(); level++)
+    {
+      const TSimdKernels& simd = SimdKernels(static_cast<TSimdLevel>(level));
+      const std::vector<double> y = SpecialValues(n + 1, static_cast<unsigned>(n));
+      const std::vector<double> x = SpecialValues(n + 1, static_cast<unsigned>(n + 1000));
+      void (*const scalarOps[])(double*, const double*, size_t) = { scalar.add, scalar.sub, scalar.mul, scalar.div };
+      void (*const simdOps[])(double*, const double*, size_t) = { simd.add, simd.sub, simd.mul, simd.div };
+      for (size_t op = 0; op < 4; op++)
+      {
+        std::vector<double> expected(y), actual(y);
+        scalarOps[op](&expected[1], &x[1], n);
+        simdOps[op](&actual[1], &x[1], n);
+        EXPECT_TRUE(SameBits(expected, actual)) << "level " << level << ", op " << op << ", n " << n;
+      }
+      std::vector<double> expected(y), actual(y);
+      scalar.neg(&expected[1], n);
+      simd.neg(&actual[1], n);
+      EXPECT_TRUE(SameBits(expected, actual)) << "level " << level << ", neg, n " << n;
+    }
+}
+
+TEST(TSimdKernels, float_kernels_match_scalar_bit_for_bit)
+{
+  const TSimdFloatKernels& scalar = SimdFloatKernels(SIMD_SCALAR);
+  for (size_t n = 0; n < 70; n++)
+    for (int level = SIMD_SSE2; level <= SimdSupported(); level++)
+    {
+      const TSimdFloatKernels& simd = SimdFloatKernels(static_cast<TSimdLevel>(level));
+      const std::vector<double> dy = SpecialValues(n + 1, static_cast<unsigned>(n));
+      const std::vector<double> dx = SpecialValues(n + 1, static_cast<unsigned>(n + 1000));
+      const std::vector<float> y(dy.begin(), dy.end());
+      const std::vector<float> x(dx.begin(), dx.end());
+      void (*const scalarOps[])(float*, const float*, size_t) = { scalar.add, scalar.sub, scalar.mul, scalar.div };
+      void (*const simdOps[])(float*, const float*, size_t) = { simd.add, simd.sub, simd.mul, simd.div };
+      for (size_t op = 0; op < 4; op++)
+      {
+        std::vector<float> expected(y), actual(y);
+        scalarOps[op](&expected[1], &x[1], n);
+        simdOps[op](&actual[1], &x[1], n);
+        EXPECT_TRUE(SameBits(expected, actual)) << "level " << level << ", op " << op << ", n " << n;
+      }
+      std::vector<float> expected(y), actual(y);
+      scalar.neg(&expected[1], n);
+      simd.neg(&actual[1], n);
+      EXPECT_TRUE(SameBits(expected, actual)) << "level " << level << ", neg, n " << n;
+    }
+}
+
+TEST(TSimdKernels, batch_results_do_not_depend_on_level)
+{
+  TRandomExpression gen(4242);
+  const size_t rows = 3 * BATCH_BLOCK + 5;
+  std::vector<std::vector<double> > data;
+  std::vector<const double*> columns;
+  for (unsigned i = 0; i < 4; i++)
+    data.push_back(SpecialValues(rows, i));
+  for (unsigned i = 0; i < 4; i++)
+    columns.push_back(&data[i][0]);
+
+  for (int n = 0; n < 50; n++)
+  {
+    TPostfix p(gen.Make(5));
+    p.Optimize(OPT_FOLD | OPT_CSE);
+    // переменные выражения - первые столбцы в порядке a, b, c, d
+    std::vector<const double*> used;
+    for (size_t v = 0; v < p.GetVariables().size(); v++)
+      used.push_back(columns[p.GetVariables()[v][0] - 'a']);
+    used.push_back(0);
+    std::vector<double> expected(rows);
+    ExecuteBatch(p.GetProgram(), &used[0], rows, &expected[0], SIMD_SCALAR);
+    for (int level = SIMD_SSE2; level <= SimdSupported(); level++)
+    {
+      std::vector<double> actual(rows);
+      ExecuteBatch(p.GetProgram(), &used[0], rows, &actual[0], static_cast<TSimdLevel>(level));
+      EXPECT_TRUE(SameBits(expected, actual)) << p.GetInfix() << ", level " << level;
+    }
+  }
+}
+
+TEST(TMathKernels, precise_kernels_are_within_one_ulp)
+{
+  for (int level = SIMD_SCALAR; level <= SimdSupported(); level++)
+    for (int f = 0; f < 4; f++)
+      EXPECT_LT(MaxUlpError(MATH_PRECISE, static_cast<TSimdLevel>(level), f), 1.0) << "level " << level << ", f " << f;
+}
+
+TEST(TMathKernels, fast_kernels_are_within_four_ulp)
+{
+  for (int level = SIMD_SCALAR; level <= SimdSupported(); level++)
+    for (int f = 0; f < 4; f++)
+      EXPECT_LT(MaxUlpError(MATH_FAST, static_cast<TSimdLevel>(level), f), 4.0) << "level " << level << ", f " << f;
+}
+
+TEST(TMathKernels, special_arguments_give_libm_results)
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  const double nan = std::nan("");
+  const double denorm = std::numeric_limits<double>::denorm_min();
+  // значения вне диапазона многочленов каждой функции: sin, cos, ln, exp
+  const double x[][9] =
+  {
+    { nan, inf, -inf, 1e6, -1e300, 100000.5, -2e5, nan, nan },
+    { nan, inf, -inf, 1e6, -1e300, 100000.5, -2e5, nan, nan },
+    { nan, inf, -inf, 0.0, -0.0, -1.0, denorm, 1e-310, -denorm },
+    { nan, inf, -inf, 709.5, -740.0, -708.5, 1e300, -1e300, nan }
+  };
+  const size_t n = sizeof(x[0]) / sizeof(x[0][0]);
+  const TMathAccuracy tiers[] = { MATH_PRECISE, MATH_FAST };
+
+  for (size_t t = 0; t < 2; t++)
+  {
+    const TMathKernels& kernels = MathKernels(tiers[t], SimdSupported());
+    void (*const f[])(double*, size_t) = { kernels.sin, kernels.cos, kernels.ln, kernels.exp };
+    double (*const libm[])(double) = { std::sin, std::cos, std::log, std::exp };
+    for (int i = 0; i < 4; i++)
+    {
+      std::vector<double> y(x[i], x[i] + n);
+      f[i](&y[0], n);
+      for (size_t k = 0; k < n; k++)
+        EXPECT_TRUE(Same(libm[i](x[i][k]), y[k])) << "tier " << tiers[t] << ", f " << i << ", x " << x[i][k];
+    }
+  }
+}
+
+TEST(TMathKernels, exact_values_stay_exact)
+{
+  const TMathAccuracy tiers[] = { MATH_PRECISE, MATH_FAST };
+
+  for (size_t t = 0; t < 2; t++)
+  {
+    const TMathKernels& kernels = MathKernels(tiers[t], SimdSupported());
+    double zeros[] = { 0.0, -0.0, 0.0, -0.0 };
+    double ones[] = { 0.0, 1.0, 0.0, 1.0 };
+    kernels.sin(zeros, 4);
+    kernels.exp(ones, 1);
+    kernels.ln(ones + 1, 1);
+    kernels.cos(ones + 2, 1);
+    EXPECT_FALSE(std::signbit(zeros[0]));
+    EXPECT_TRUE(std::signbit(zeros[1]));
+    EXPECT_EQ(1.0, ones[0]);
+    EXPECT_EQ(0.0, ones[1]);
+    EXPECT_EQ(1.0, ones[2]);
+  }
+}
+
+TEST(TMathKernels, vector_kernels_match_scalar_bit_for_bit)
+{
+  const TMathAccuracy tiers[] = { MATH_LIBM, MATH_PRECISE, MATH_FAST };
+  std::vector<double> x = SpecialValues(1003, 5);
+  for (size_t k = 0; k < x.size(); k += 3)
+    x[k] = std::fmod(x[k], 800.0);
+
+  for (size_t t = 0; t < 3; t++)
+  {
+    const TMathKernels& scalar = MathKernels(tiers[t], SIMD_SCALAR);
+    void (*const expected[])(double*, size_t) = { scalar.sin, scalar.cos, scalar.ln, scalar.exp };
+    for (int level = SIMD_SSE2; level <= SimdSupported(); level++)
+    {
+      const TMathKernels& simd = MathKernels(tiers[t], static_cast<TSimdLevel>(level));
+      void (*const actual[])(double*, size_t) = { simd.sin, simd.cos, simd.ln, simd.exp };
+      for (int i = 0; i < 4; i++)
+      {
+        std::vector<double> y1(x), y2(x);
+        expected[i](&y1[1], y1.size() - 1);
+        actual[i](&y2[1], y2.size() - 1);
+        EXPECT_TRUE(SameBits(y1, y2)) << "tier " << tiers[t] << ", level " << level << ", f " << i;
+      }
+    }
+  }
+}
+
+TEST(TPostfix, batch_with_fast_math_is_close_to_calculate)
+{
+  const TPostfix p("sin(a) * exp(b) - ln(c) + cos(a * b)");
+  const size_t rows = 1000;
+  std::vector<double> a, b, c, result(rows);
+  for (size_t k = 0; k < rows; k++)
+  {
+    a.push_back(std::sin(k * 0.37) * 10);
+    b.push_back(std::cos(k * 0.11) * 5);
+    c.push_back(1.0 + k);
+  }
+  const double* columns[] = { &a[0], &b[0], &c[0] };
+
+  p.CalculateBatch(columns, rows, &result[0], MATH_FAST);
+
+  for (size_t k = 0; k < rows; k++)
+  {
+    const double values[] = { a[k], b[k], c[k] };
+    const double expected = p.Calculate(values);
+    EXPECT_NEAR(expected, result[k], 1e-12 * (1.0 + std::fabs(expected))) << k;
+  }
+}
+
+TEST(TPostfix, calculate_in_double_type_gives_same_result)
+{
+  TRandomExpression gen(777);
+  const double values[] = { 1.25, -0.5, 3.0, 0.75 };
+
+  for (int n = 0; n < 200; n++)
+  {
+    const TPostfix p(gen.Make(5));
+    const std::vector<double> slots = Slots(p, values);
+    const double expected = p.Calculate(&slots[0]);
+    const double actual = p.Calculate<double>(&slots[0]);
+    EXPECT_TRUE(Same(expected, actual)) << p.GetInfix();
+  }
+}
+
+TEST(TPostfix, calculate_in_float_rounds_every_operation_to_float)
+{
+  const TPostfix p("a * b + c - 0.1");
+  const float values[] = { 1.1f, 3.3f, 1e-3f };
+
+  const float expected = values[0] * values[1] + values[2] - 0.1f;
+
+  EXPECT_EQ(expected, p.Calculate(values));
+  EXPECT_EQ(5.0f, TPostfix("2 ^ 2 + (a < b ? 1 : 0)").Calculate(values));
+}
+
+TEST(TPostfix, calculate_in_long_double_keeps_more_bits)
+{
+  // у MSVC long double совпадает с double
+  if (std::numeric_limits<long double>::digits <= std::numeric_limits<double>::digits)
+    return;
+  const TPostfix p("(a + b) - a");
+  const long double values[] = { 1.0L, std::ldexp(1.0L, -60) };
+  const double doubles[] = { 1.0, std::ldexp(1.0, -60) };
+
+  EXPECT_EQ(0.0, p.Calculate(doubles));
+  EXPECT_EQ(std::ldexp(1.0L, -60), p.Calculate(values));
+}
+
+// расхождение с double на формулах вида весовых оценок: у хорошо
+// обусловленных формул относительная ошибка float - порядка нескольких
+// его эпсилон, long double точнее double
+TEST(TPostfix, float_and_long_double_diverge_from_double_within_precision)
+{
+  const char* const exprs[] =
+  {
+    "0.3 * a + 0.5 * b + 0.2 * c - 0.1 * d",
+    "1 / (1 + exp(-(1.7 * a - 0.8 * b + 0.1)))",
+    "ln(1 + a * b) * c + sin(d) ^ 2",
+    "(a * a + b * b) / (c + d) + cos(a - b)",
+    "a < b ? exp(-a * c) : sin(b) * d"
+  };
+  double floatWorst = 0, longWorst = 0;
+  for (size_t e = 0; e < sizeof(exprs) / sizeof(exprs[0]); e++)
+  {
+    const TPostfix p(exprs[e]);
+    unsigned seed = static_cast<unsigned>(e);
+    for (int row = 0; row < 1000; row++)
+    {
+      double d[4];
+      float f[4];
+      long double l[4];
+      for (size_t v = 0; v < 4; v++)
+      {
+        seed = seed * 1103515245u + 12345u;
+        // значения точно представимы во float, чтобы сравнивать только
+        // ошибки вычисления
+        f[v] = 0.5f + static_cast<float>(seed >> 16) / 65536.0f * 1.5f;
+        d[v] = f[v];
+        l[v] = f[v];
+      }
+      const double expected = p.Calculate(d);
+      const double relFloat = std::fabs((p.Calculate(f) - expected) / expected);
+      const double relLong = static_cast<double>(std::fabs((p.Calculate(l) - expected) / expected));
+      ASSERT_LT(relFloat, 1e-5) << exprs[e] << ", row " << row;
+      ASSERT_LT(relLong, 1e-15) << exprs[e] << ", row " << row;
+      floatWorst = std::fmax(floatWorst, relFloat);
+      longWorst = std::fmax(longWorst, relLong);
+    }
+  }
+  // float действительно вычисляется во float
+  EXPECT_GT(floatWorst, std::numeric_limits<float>::epsilon() / 4);
+  RecordProperty("float_max_relative_divergence", (testing::Message() << floatWorst).GetString());
+  RecordProperty("long_double_max_relative_divergence", (testing::Message() << longWorst).GetString());
+}
+
+TEST(TPostfix, integer_program_is_detected)
+{
+  EXPECT_TRUE(TPostfix("a * b + 3 - c").IsInteger());
+  EXPECT_TRUE(TPostfix("-(a - 2) ^ 3").IsInteger());
+  EXPECT_TRUE(TPostfix("7").IsInteger());
+  EXPECT_FALSE(TPostfix("a / b").IsInteger());
+  EXPECT_FALSE(TPostfix("a + 0.5").IsInteger());
+  EXPECT_FALSE(TPostfix("a ^ (-1)").IsInteger());
+  EXPECT_FALSE(TPostfix("a ^ b").IsInteger());
+  EXPECT_FALSE(TPostfix("sin(a)").IsInteger());
+  EXPECT_FALSE(TPostfix("a < b ? a : b").IsInteger());
+  EXPECT_FALSE(TPostfix("1e300 * a").IsInteger());
+}
+
+TEST(TPostfix, optimize_can_make_program_integer)
+{
+  TPostfix p("a / 1 * b");
+  EXPECT_FALSE(p.IsInteger());
+
+  p.Optimize(OPT_FOLD | OPT_CSE);
+
+  EXPECT_TRUE(p.IsInteger());
+}
+
+TEST(TPostfix, integer_evaluation_is_exact_beyond_double_precision)
+{
+  TPostfix p("a * a - (a - 1) * (a + 1)");
+  const long long a = 3037000499LL; // a * a < 2^63
+  const double values[] = { static_cast<double>(a) };
+  long long exact = 0;
+
+  ASSERT_TRUE(p.CalculateInteger(&a, exact));
+
+  EXPECT_EQ(1, exact);
+  EXPECT_EQ(1.0, p.CalculateExact(values));
+  // в double произведения округляются, и единица теряется
+  EXPECT_NE(1.0, p.Calculate(values));
+}
+
+TEST(TPostfix, exact_evaluation_falls_back_to_double)
+{
+  // переполнение int64
+  TPostfix cube("a * a * a");
+  const double big = std::ldexp(1.0, 30);
+  EXPECT_EQ(std::ldexp(1.0, 90), cube.CalculateExact(&big));
+
+  // нецелые значения и выражения с делением
+  TPostfix triple("a * 3");
+  const double half = 0.5, huge = 1e300, nan = std::nan("");
+  EXPECT_EQ(1.5, triple.CalculateExact(&half));
+  EXPECT_EQ(3e300, triple.CalculateExact(&huge));
+  EXPECT_TRUE(std::isnan(triple.CalculateExact(&nan)));
+  const double seven = 7.0;
+  EXPECT_EQ(3.5, TPostfix("a / 2").CalculateExact(&seven));
+
+  // в JIT и регистровой машине - то же
+  TPostfix p("a * a - (a - 1) * (a + 1) + a / 4");
+  const double a = 3037000499.0;
+  for (int e = ENGINE_STACK; e <= ENGINE_JIT; e++)
+  {
+    p.SetEngine(static_cast<TEngine>(e));
+    EXPECT_EQ(p.Calculate(&a), p.CalculateExact(&a)) << e;
+  }
+}
+
+TEST(TPostfix, exact_zero_keeps_sign_of_double_evaluation)
+{
+  const double zero = 0.0, minusZero = -0.0, five = 5.0;
+
+  EXPECT_TRUE(std::signbit(TPostfix("-a").CalculateExact(&zero)));
+  EXPECT_TRUE(std::signbit(TPostfix("a * 2").CalculateExact(&minusZero)));
+  EXPECT_FALSE(std::signbit(TPostfix("a - a").CalculateExact(&five)));
+}
+
+TEST(TPostfix, engines_agree_on_integer_expression_beyond_double_precision)
+{
+  TPostfix p("(a * b + c) * 3 - a ^ 2");
+  const double a = 123456789.0, b = 987654321.0, c = 5.0;
+  const double values[] = { a, b, c };
+  const double* columns[] = { &values[0], &values[1], &values[2] };
+  const long long ints[] = { 123456789, 987654321, 5 };
+  long long exact = 0;
+  ASSERT_TRUE(p.CalculateInteger(ints, exact));
+  ASSERT_GT(exact, 1LL << 53);
+  const double expected = (a * b + c) * 3 - a * a;
+  // округления double заметны, точный результат отличается
+  ASSERT_NE(static_cast<double>(exact), expected);
+
+  for (int e = ENGINE_STACK; e <= ENGINE_JIT; e++)
+  {
+    p.SetEngine(static_cast<TEngine>(e));
+    EXPECT_EQ(expected, p.Calculate(values)) << e;
+    double batch = 0.0, gradient[3];
+    p.CalculateBatch(columns, 1, &batch);
+    EXPECT_EQ(expected, batch) << e;
+    EXPECT_EQ(expected, p.CalculateGradient(values, gradient)) << e;
+  }
+  EXPECT_EQ(expected, p.Calculate<double>(values));
+}
+
+TEST(TPostfix, integer_evaluation_reports_overflow)
+{
+  TPostfix p("a * a * a");
+  const long long a = 1LL << 30;
+  const double values[] = { static_cast<double>(a) };
+  long long exact = 0;
+
+  EXPECT_FALSE(p.CalculateInteger(&a, exact));
+  EXPECT_EQ(std::ldexp(1.0, 90), p.Calculate(values));
+
+  const long long min = LLONG_MIN;
+  EXPECT_FALSE(TPostfix("-a").CalculateInteger(&min, exact));
+  EXPECT_FALSE(TPostfix("a - 1").CalculateInteger(&min, exact));
+  EXPECT_FALSE(TPostfix("a ^ 2").CalculateInteger(&min, exact));
+}
+
+TEST(TPostfix, non_integer_values_are_calculated_in_double)
+{
+  TPostfix p("a * 3");
+  const double half = 0.5, big = 1e300;
+  const double nan = std::nan("");
+
+  EXPECT_EQ(1.5, p.Calculate(&half));
+  EXPECT_EQ(3e300, p.Calculate(&big));
+  EXPECT_TRUE(std::isnan(p.Calculate(&nan)));
+  long long exact = 0;
+  EXPECT_FALSE(TPostfix("a / 2").CalculateInteger(&exact, exact));
+}
+
+TEST(TPostfix, gradient_of_polynomial)
+{
+  TPostfix p("a*a*b + 3*b");
+  const double ab[] = { 2, 5 };
+  double gradient[2];
+
+  ASSERT_EQ(2u, p.GetVariables().size());
+  EXPECT_EQ(35.0, p.CalculateGradient(ab, gradient));
+  EXPECT_EQ(20.0, gradient[0]);
+  EXPECT_EQ(7.0, gradient[1]);
+}
+
+TEST(TPostfix, gradient_can_be_taken_by_some_variables)
+{
+  TPostfix p("a*b*c");
+  const double abc[] = { 2, 3, 5 };
+  const size_t wrt[] = { 2, 0 };
+  double gradient[2];
+
+  EXPECT_EQ(30.0, p.CalculateGradient(abc, wrt, 2, gradient));
+  EXPECT_EQ(6.0, gradient[0]);
+  EXPECT_EQ(15.0, gradient[1]);
+  EXPECT_EQ(30.0, p.CalculateGradient(abc, wrt, 0, gradient));
+}
+
+TEST(TPostfix, gradient_of_elementary_functions)
+{
+  const double x = 0.7;
+  double g = 0.0;
+
+  TPostfix("sin(a)").CalculateGradient(&x, &g);
+  EXPECT_NEAR(std::cos(x), g, 1e-15);
+  TPostfix("cos(a)").CalculateGradient(&x, &g);
+  EXPECT_NEAR(-std::sin(x), g, 1e-15);
+  TPostfix("ln(a)").CalculateGradient(&x, &g);
+  EXPECT_NEAR(1 / x, g, 1e-15);
+  TPostfix("exp(a)").CalculateGradient(&x, &g);
+  EXPECT_NEAR(std::exp(x), g, 1e-15);
+  TPostfix("1 / a").CalculateGradient(&x, &g);
+  EXPECT_NEAR(-1 / (x * x), g, 1e-14);
+  TPostfix("a ^ (-2)").CalculateGradient(&x, &g);
+  EXPECT_NEAR(-2 / (x * x * x), g, 1e-14);
+  TPostfix("a ^ a").CalculateGradient(&x, &g);
+  EXPECT_NEAR(std::pow(x, x) * (std::log(x) + 1), g, 1e-15);
+}
+
+TEST(TPostfix, gradient_of_power_with_negative_base_is_finite)
+{
+  const double x = -3.0;
+  double g = 0.0;
+
+  EXPECT_EQ(9.0, TPostfix("a ^ 2").CalculateGradient(&x, &g));
+  EXPECT_EQ(-6.0, g);
+}
+
+TEST(TPostfix, gradient_follows_chosen_branch)
+{
+  TPostfix p("a < b ? a*a : 3*b");
+  const double less[] = { 2, 5 }, greater[] = { 7, 5 };
+  double gradient[2];
+
+  p.CalculateGradient(less, gradient);
+  EXPECT_EQ(4.0, gradient[0]);
+  EXPECT_EQ(0.0, gradient[1]);
+  p.CalculateGradient(greater, gradient);
+  EXPECT_EQ(0.0, gradient[0]);
+  EXPECT_EQ(3.0, gradient[1]);
+  EXPECT_EQ(1.0, TPostfix("a < b").CalculateGradient(less, gradient));
+  EXPECT_EQ(0.0, gradient[0]);
+  EXPECT_EQ(0.0, gradient[1]);
+}
+
+TEST(TPostfix, gradient_of_registered_operator_is_estimated)
+{
+  TPostfix::RegisterOperator('@', 3, Root);
+  TPostfix p("(@a) * b");
+  const double ab[] = { 4, 3 };
+  double gradient[2];
+
+  EXPECT_EQ(6.0, p.CalculateGradient(ab, gradient));
+  EXPECT_NEAR(0.75, gradient[0], 1e-9);
+  EXPECT_EQ(2.0, gradient[1]);
+}
+
+TEST(TPostfix, gradient_matches_finite_differences)
+{
+  const char* expressions[] = {
+    "sin(a*b) + exp(a - b) / (1 + b*b)",
+    "ln(a*a + b) * cos(b) ^ 3",
+    "(a + b) ^ (a / 3) - a*b*a",
+  };
+  const double ab[] = { 0.8, 1.3 };
+  for (size_t e = 0; e < sizeof(expressions) / sizeof(*expressions); e++)
+  {
+    TPostfix p(expressions[e]);
+    p.Optimize(OPT_FOLD | OPT_CSE);
+    double gradient[2];
+    EXPECT_EQ(p.Calculate(ab), p.CalculateGradient(ab, gradient)) << expressions[e];
+    for (size_t i = 0; i < 2; i++)
+    {
+      const double h = 1e-6;
+      double shifted[] = { ab[0], ab[1] };
+      shifted[i] = ab[i] + h;
+      const double up = p.Calculate(shifted);
+      shifted[i] = ab[i] - h;
+      const double down = p.Calculate(shifted);
+      EXPECT_NEAR((up - down) / (2 * h), gradient[i], 1e-7) << expressions[e] << " " << i;
+    }
+  }
+}
+
+TEST(TPostfix, gradient_throws_when_variable_index_is_out_of_range)
+{
+  TPostfix p("a + b");
+  const double ab[] = { 1, 2 };
+  const size_t wrt[] = { 2 };
+  double gradient[1];
+
+  EXPECT_THROW(p.CalculateGradient(ab, wrt, 1, gradient), std::out_of_range);
+}
@@ -0,0 +1,363 @@
+// тесты для вычисления выражения по столбцам
+
+#include "arithmetic.h"
+#include "batch.h"
+#include <gtest.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// одинаковые результаты; NaN равен NaN, -0 не равен +0
+bool Same(double x, double y)
+{
+  return (x == y && std::signbit(x) == std::signbit(y)) || (x != x && y != y);
+}
+
+// столбцы значений переменных с особыми значениями в начале
+class TColumns
+{
+  std::vector<std::vector<double> > data;
+  std::vector<const double*> pointers;
+
+public:
+  TColumns(size_t count, size_t rows)
+  {
+    const double special[] = { 0.0, -0.0, 1.0, -1.0, std::nan(""), 1e300, 0.5 };
+    data.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+      for (size_t k = 0; k < rows; k++)
+      {
+        const size_t s = k + i * 3;
+        data[i].push_back(k < 40 ? special[s % 7] : std::sin(static_cast<double>(k * (i + 2))) * 3.0);
+      }
+      pointers.push_back(&data[i][0]);
+    }
+  }
+
+  const double* const* Get() const { return pointers.empty() ? 0 : &pointers[0]; }
+
+  std::vector<double> Row(size_t k) const
+  {
+    std::vector<double> row;
+    for (size_t i = 0; i < data.size(); i++)
+      row.push_back(data[i][k]);
+    if (row.empty())
+      row.push_back(0.0);
+    return row;
+  }
+};
+
+void ExpectSameAsCalculate(const TPostfix& p, size_t rows)
+{
+  const TColumns columns(p.GetVariables().size(), rows);
+  std::vector<double> result(rows + 1, 42.0);
+
+  p.CalculateBatch(columns.Get(), rows, &result[0]);
+
+  for (size_t k = 0; k < rows; k++)
+  {
+    const double expected = p.Calculate(&columns.Row(k)[0]);
+    ASSERT_TRUE(Same(expected, result[k])) << p.GetInfix() << ", row " << k << ": "
+      << expected << " != " << result[k];
+  }
+  EXPECT_EQ(42.0, result[rows]);
+}
+
+int calls = 0;
+double Counted(double a) { calls++; return a; }
+
+} // namespace
+
+TEST(TBatch, gives_same_results_as_calculate_for_each_row)
+{
+  const char* exprs[] =
+  {
+    "a", "a + b * c - d / a", "sin(a) * cos(b) + ln(c) - exp(-d)",
+    "a^3 - b^2^2 + c^0.5 + 2^a", "(a + b) * (a + b) - (a + b)"
+  };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+    ExpectSameAsCalculate(TPostfix(exprs[i]), 1000);
+}
+
+TEST(TBatch, rows_need_not_fill_whole_blocks)
+{
+  const TPostfix p("a * b + 1");
+  const size_t sizes[] = { 1, BATCH_BLOCK - 1, BATCH_BLOCK, BATCH_BLOCK + 1, 3 * BATCH_BLOCK + 7 };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    ExpectSameAsCalculate(p, sizes[i]);
+}
+
+TEST(TBatch, zero_rows_write_nothing)
+{
+  const TPostfix p("a + 1");
+  double result = 42.0;
+
+  ASSERT_NO_THROW(p.CalculateBatch(0, 0, &result));
+  EXPECT_EQ(42.0, result);
+}
+
+TEST(TBatch, expression_without_variables_needs_no_columns)
+{
+  const TPostfix p("2 * 3 + 1");
+  std::vector<double> result(300);
+
+  p.CalculateBatch(0, result.size(), &result[0]);
+
+  for (size_t k = 0; k < result.size(); k++)
+    EXPECT_EQ(7.0, result[k]);
+}
+
+TEST(TBatch, optimized_program_with_temporaries_gives_same_results)
+{
+  TPostfix p("sin(a + b) * sin(a + b) + (a + b) / (c - sin(a + b))");
+
+  p.Optimize(OPT_FOLD | OPT_CSE);
+
+  ASSERT_NE(0u, p.GetProgram().temps);
+  ExpectSameAsCalculate(p, 700);
+}
+
+TEST(TBatch, conditional_operators_select_value_for_each_row)
+{
+  const char* exprs[] =
+  {
+    "a < b ? a : b", "a ? b : c", "a && b", "a || b", "-0 && a", "a ? (b < c ? b : c) : (c ? d : a)",
+    "a < 0 || b < 0 && c == c ? sin(a) : ln(b) + (d ? 1 : 2)", "(a ? b : c) + (b && c) * (c || d)"
+  };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+  {
+    TPostfix p(exprs[i]);
+    ExpectSameAsCalculate(p, 600);
+    p.Optimize(OPT_FOLD | OPT_CSE);
+    ExpectSameAsCalculate(p, 600);
+  }
+}
+
+TEST(TBatch, uniform_block_evaluates_only_selected_branch)
+{
+  TPostfix::RegisterOperator('$', 5, Counted);
+  const TPostfix p("a ? ($b) : 0");
+  std::vector<double> a(2 * BATCH_BLOCK, 0.0), b(2 * BATCH_BLOCK, 1.0), result(2 * BATCH_BLOCK);
+  const double* columns[] = { &a[0], &b[0] };
+
+  // во втором блоке условие истинно в одной строке
+  a[BATCH_BLOCK + 3] = 1.0;
+  calls = 0;
+  p.CalculateBatch(columns, a.size(), &result[0]);
+
+  EXPECT_EQ(static_cast<int>(BATCH_BLOCK), calls);
+  EXPECT_EQ(0.0, result[3]);
+  EXPECT_EQ(1.0, result[BATCH_BLOCK + 3]);
+  EXPECT_EQ(0.0, result[BATCH_BLOCK + 4]);
+}
+
+TEST(TBatch, pool_gives_same_results_as_sequential_evaluation)
+{
+  const char* exprs[] =
+  {
+    "a + b", "sin(a) * exp(b) - ln(c)", "a < b ? c : d", "(a + b) * (a + b) / (c - d)", "7"
+  };
+  const size_t rows = 3 * BATCH_TASK_ROWS + 100;
+  const TColumns columns(4, rows);
+  std::vector<TPostfix> list;
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+    list.push_back(TPostfix(exprs[i]));
+  std::vector<std::vector<double> > results(list.size(), std::vector<double>(rows));
+  std::vector<TBatchJob> jobs;
+  for (size_t i = 0; i < list.size(); i++)
+  {
+    // у всех выражений переменные a, b, c, d идут в порядке первого появления
+    TBatchJob job = { &list[i], columns.Get(), &results[i][0] };
+    jobs.push_back(job);
+  }
+  TThreadPool pool(4);
+
+  ExecuteBatch(pool, jobs, rows);
+
+  for (size_t i = 0; i < list.size(); i++)
+  {
+    std::vector<double> expected(rows);
+    list[i].CalculateBatch(columns.Get(), rows, &expected[0]);
+    for (size_t k = 0; k < rows; k++)
+      ASSERT_TRUE(Same(expected[k], results[i][k])) << exprs[i] << ", row " << k;
+  }
+}
+
+TEST(TBatch, fused_expressions_give_same_results_as_each_expression)
+{
+  const char* exprs[] =
+  {
+    "a + b", "sin(a + b) * c", "c - sin(a + b)", "d < a ? exp(a + b) : ln(c)", "a + b",
+    "(0 < a && 0 < sin(a + b)) || d == 0", "7", "e ^ 3 + d"
+  };
+  std::vector<TPostfix> list;
+  std::vector<const TPostfix*> ptrs;
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+    list.push_back(TPostfix(exprs[i]));
+  for (size_t i = 0; i < list.size(); i++)
+    ptrs.push_back(&list[i]);
+  const TFusedBatch fused(ptrs);
+  ASSERT_EQ(5u, fused.GetVariables().size());
+  const size_t rows = 2 * BATCH_BLOCK + 17;
+  const TColumns columns(fused.GetVariables().size(), rows);
+  std::vector<std::vector<double> > results(list.size(), std::vector<double>(rows));
+  std::vector<double*> out;
+  for (size_t i = 0; i < list.size(); i++)
+    out.push_back(&results[i][0]);
+
+  fused.Calculate(columns.Get(), rows, &out[0]);
+
+  for (size_t i = 0; i < list.size(); i++)
+  {
+    // столбцы выражения - по его собственному порядку переменных
+    std::vector<const double*> own;
+    for (size_t v = 0; v < list[i].GetVariables().size(); v++)
+    {
+      size_t slot = 0;
+      while (fused.GetVariables()[slot] != list[i].GetVariables()[v])
+        slot++;
+      own.push_back(columns.Get()[slot]);
+    }
+    std::vector<double> expected(rows);
+    list[i].CalculateBatch(own.empty() ? 0 : &own[0], rows, &expected[0]);
+    for (size_t k = 0; k < rows; k++)
+      ASSERT_TRUE(Same(expected[k], results[i][k])) << exprs[i] << ", row " << k;
+  }
+}
+
+TEST(TBatch, fused_expressions_compute_shared_subexpressions_once)
+{
+  TPostfix p("sin(a + b) * c");
+  TPostfix q("c - sin(a + b)");
+  std::vector<const TPostfix*> ptrs;
+  ptrs.push_back(&p);
+  ptrs.push_back(&q);
+
+  const TFusedBatch fused(ptrs);
+
+  EXPECT_EQ(2u, fused.Outputs());
+  EXPECT_EQ(12u, fused.Stats().nodesBefore);
+  EXPECT_EQ(7u, fused.Stats().nodesAfter);
+  size_t sines = 0;
+  const TProgram& prog = fused.GetProgram();
+  for (size_t i = 0; prog.code[i] != OP_END; i += HasOperand(prog.code[i]) ? 3 : 1)
+    sines += prog.code[i] == OP_SIN;
+  EXPECT_EQ(1u, sines);
+}
+
+TEST(TBatch, fused_registered_operation_is_called_once_per_row)
+{
+  TPostfix::RegisterOperator('$', 5, Counted);
+  TPostfix p("($a) * 2");
+  TPostfix q("($a) + 1");
+  std::vector<const TPostfix*> ptrs;
+  ptrs.push_back(&p);
+  ptrs.push_back(&q);
+  const TFusedBatch fused(ptrs);
+  const size_t rows = BATCH_BLOCK + 3;
+  const TColumns columns(1, rows);
+  std::vector<double> x(rows), y(rows);
+  double* out[] = { &x[0], &y[0] };
+  calls = 0;
+
+  fused.Calculate(columns.Get(), rows, out);
+
+  EXPECT_EQ(static_cast<int>(rows), calls);
+}
+
+TEST(TBatch, fused_pool_gives_same_results_as_single_thread)
+{
+  TPostfix p("a * b - ln(a)");
+  TPostfix q("exp(b) / (a * b)");
+  std::vector<const TPostfix*> ptrs;
+  ptrs.push_back(&p);
+  ptrs.push_back(&q);
+  const TFusedBatch fused(ptrs);
+  const size_t rows = 2 * BATCH_TASK_ROWS + 1;
+  const TColumns columns(2, rows);
+  std::vector<double> x1(rows), y1(rows), x2(rows), y2(rows);
+  double* single[] = { &x1[0], &y1[0] };
+  double* pooled[] = { &x2[0], &y2[0] };
+  TThreadPool pool(3);
+
+  fused.Calculate(columns.Get(), rows, single);
+  fused.Calculate(pool, columns.Get(), rows, pooled);
+
+  for (size_t k = 0; k < rows; k++)
+  {
+    ASSERT_TRUE(Same(x1[k], x2[k])) << k;
+    ASSERT_TRUE(Same(y1[k], y2[k])) << k;
+  }
+}
+
+TEST(TBatch, throws_when_nothing_to_fuse)
+{
+  ASSERT_THROW(TFusedBatch(std::vector<const TPostfix*>()), std::invalid_argument);
+}
+
+TEST(TBatch, float_batch_gives_same_results_as_float_calculate)
+{
+  const char* exprs[] =
+  {
+    "a + b * c - d / a", "sin(a) * cos(b) + ln(c) - exp(-d)", "a ^ 3 - b ^ (-2)", "a < b ? c : d",
+    "(a <= b && c == c) || d", "-a", "0.1 * a"
+  };
+  const size_t rows = 2 * BATCH_BLOCK + 31;
+  const TColumns columns(4, rows);
+  std::vector<std::vector<float> > data(4);
+  std::vector<const float*> pointers;
+  for (size_t i = 0; i < 4; i++)
+  {
+    data[i].assign(columns.Get()[i], columns.Get()[i] + rows);
+    pointers.push_back(&data[i][0]);
+  }
+
+  for (size_t e = 0; e < sizeof(exprs) / sizeof(exprs[0]); e++)
+  {
+    const TPostfix p(exprs[e]);
+    std::vector<float> result(rows);
+    p.CalculateBatch(&pointers[0], rows, &result[0]);
+    for (size_t k = 0; k < rows; k++)
+    {
+      float row[4];
+      for (size_t v = 0; v < p.GetVariables().size(); v++)
+        row[v] = data[v][k];
+      const float expected = p.Calculate(row);
+      ASSERT_TRUE(Same(expected, result[k])) << exprs[e] << ", row " << k << ": " << expected << " != " << result[k];
+    }
+  }
+}
+
+TEST(TBatch, float_batch_with_precise_math_is_within_one_float_ulp)
+{
+  const char* exprs[] = { "sin(a)", "cos(a)", "ln(b)", "exp(a)" };
+  const size_t rows = 1000;
+  std::vector<float> a, b;
+  for (size_t k = 0; k < rows; k++)
+  {
+    a.push_back(static_cast<float>(std::sin(k * 0.37) * 50));
+    b.push_back(static_cast<float>(1e-3 + k * 7.5));
+  }
+
+  for (size_t e = 0; e < sizeof(exprs) / sizeof(exprs[0]); e++)
+  {
+    const TPostfix p(exprs[e]);
+    const float* columns[] = { p.GetVariables()[0] == "a" ? &a[0] : &b[0] };
+    std::vector<float> libm(rows), precise(rows);
+    p.CalculateBatch(columns, rows, &libm[0]);
+    p.CalculateBatch(columns, rows, &precise[0], MATH_PRECISE);
+    for (size_t k = 0; k < rows; k++)
+    {
+      const float ulp = std::nextafter(std::fabs(libm[k]), HUGE_VALF) - std::fabs(libm[k]);
+      EXPECT_LE(std::fabs(precise[k] - libm[k]), ulp) << exprs[e] << ", row " << k;
+    }
+  }
+}
@@ -0,0 +1,197 @@
+// тесты для кэша скомпилированных выражений
+
+#include "cache.h"
+#include <gtest.h>
+
+#include <thread>
+
+TEST(TPostfixCache, can_create_cache)
+{
+  ASSERT_NO_THROW(TPostfixCache c(1 << 20));
+}
+
+TEST(TPostfixCache, normalize_removes_spaces_between_operations)
+{
+  EXPECT_EQ("a+b*(c-1)", TPostfixCache::Normalize("  a + b *\t( c - 1 ) "));
+}
+
+TEST(TPostfixCache, normalize_keeps_one_space_between_names)
+{
+  EXPECT_EQ("sin x+a 2", TPostfixCache::Normalize("sin   x + a  2"));
+}
+
+TEST(TPostfixCache, normalize_keeps_one_space_between_operations)
+{
+  EXPECT_EQ("a< =b", TPostfixCache::Normalize("a < = b"));
+  EXPECT_EQ("a& &b||c", TPostfixCache::Normalize("a &  & b|| c"));
+  EXPECT_EQ("(a)-(b)", TPostfixCache::Normalize("( a ) - ( b )"));
+}
+
+TEST(TPostfixCache, invalid_expression_is_not_found_by_valid_one)
+{
+  TPostfixCache c(1 << 20);
+  c.Get("a<=b");
+  c.Get("a==b");
+
+  EXPECT_THROW(c.Get("a < = b"), TExpressionError);
+  EXPECT_THROW(c.Get("a = = b"), TExpressionError);
+  EXPECT_THROW(c.Get("a & & b"), TExpressionError);
+  EXPECT_THROW(c.Get("a | | b"), TExpressionError);
+}
+
+TEST(TPostfixCache, broken_exponent_is_not_found_by_number)
+{
+  TPostfixCache c(1 << 20);
+  c.Get("2e+3");
+  c.Get("x*1E-2");
+
+  EXPECT_EQ("2e +3", TPostfixCache::Normalize("2e +3"));
+  EXPECT_EQ("2e+ 3", TPostfixCache::Normalize("2e+ 3"));
+  EXPECT_EQ("x*1E -2", TPostfixCache::Normalize("x * 1E -2"));
+  EXPECT_EQ("a e+3", TPostfixCache::Normalize("a e + 3"));
+  EXPECT_THROW(c.Get("2e +3"), TExpressionError);
+  EXPECT_THROW(c.Get("2e+ 3"), TExpressionError);
+  EXPECT_THROW(c.Get("x*1E -2"), TExpressionError);
+  EXPECT_EQ(2000.0, c.Get("2e+3")->Calculate(static_cast<const double*>(0)));
+}
+
+TEST(TPostfixCache, hash_depends_on_text)
+{
+  EXPECT_EQ(TPostfixCache::Hash("a+b", 3), TPostfixCache::Hash("a+b", 3));
+  EXPECT_NE(TPostfixCache::Hash("a+b", 3), TPostfixCache::Hash("b+a", 3));
+}
+
+TEST(TPostfixCache, first_request_is_miss_and_second_is_hit)
+{
+  TPostfixCache c(1 << 20);
+
+  std::shared_ptr<const TPostfix> p1 = c.Get("a+b");
+  std::shared_ptr<const TPostfix> p2 = c.Get("a + b");
+
+  EXPECT_EQ(p1.get(), p2.get());
+  EXPECT_EQ(1u, c.GetStats().misses);
+  EXPECT_EQ(1u, c.GetStats().hits);
+  EXPECT_EQ(1u, c.GetStats().entries);
+}
+
+TEST(TPostfixCache, cached_expression_can_be_calculated)
+{
+  TPostfixCache c(1 << 20);
+  const double values[] = { 2.0, 3.0 };
+
+  EXPECT_EQ(8.0, c.Get("x*y + x")->Calculate(values));
+  EXPECT_EQ(8.0, c.Get("x*y + x")->Calculate(values));
+}
+
+TEST(TPostfixCache, invalid_expression_is_not_cached)
+{
+  TPostfixCache c(1 << 20);
+
+  ASSERT_THROW(c.Get("a+"), TExpressionError);
+  EXPECT_EQ(0u, c.GetStats().entries);
+}
+
+TEST(TPostfixCache, size_does_not_exceed_limit)
+{
+  TPostfixCache c(4096);
+
+  for (int i = 0; i < 200; i++)
+    c.Get("a*" + std::to_string(i));
+
+  EXPECT_LE(c.GetStats().bytes, 4096u);
+  EXPECT_GT(c.GetStats().evictions, 0u);
+  EXPECT_EQ(200u - c.GetStats().evictions, c.GetStats().entries);
+}
+
+TEST(TPostfixCache, least_recently_used_expression_is_evicted)
+{
+  TPostfixCache probe(1 << 20);
+  probe.Get("a+1");
+  const size_t entryBytes = probe.GetStats().bytes;
+  TPostfixCache c(entryBytes * 2 + entryBytes / 2);
+  c.Get("a+1");
+  c.Get("a+2");
+  c.Get("a+1");
+
+  c.Get("a+3");
+
+  EXPECT_EQ(1u, c.GetStats().evictions);
+  c.Get("a+1");
+  EXPECT_EQ(2u, c.GetStats().hits);
+  c.Get("a+2");
+  EXPECT_EQ(4u, c.GetStats().misses);
+}
+
+TEST(TPostfixCache, evicted_expression_stays_valid)
+{
+  TPostfixCache c(1);
+
+  std::shared_ptr<const TPostfix> p = c.Get("2*3");
+
+  EXPECT_EQ(0u, c.GetStats().entries);
+  EXPECT_EQ(6.0, p->Calculate(static_cast<const double*>(0)));
+}
+
+TEST(TPostfixCache, new_expressions_are_optimized_with_given_flags)
+{
+  TPostfixCache c(1 << 20, OPT_FOLD);
+
+  EXPECT_EQ(4u, c.Get("2*3+1")->GetProgram().code.size());
+}
+
+TEST(TPostfixCache, can_clear_cache)
+{
+  TPostfixCache c(1 << 20);
+  c.Get("a");
+
+  c.Clear();
+
+  EXPECT_EQ(0u, c.GetStats().entries);
+  EXPECT_EQ(0u, c.GetStats().bytes);
+}
+
+TEST(TShardedPostfixCache, shard_count_is_power_of_two)
+{
+  TShardedPostfixCache c(1 << 20, 12);
+
+  EXPECT_EQ(16u, c.ShardCount());
+}
+
+TEST(TShardedPostfixCache, equal_expressions_share_compiled_object)
+{
+  TShardedPostfixCache c(1 << 20);
+
+  std::shared_ptr<const TPostfix> p1 = c.Get("a * (b+c)");
+  std::shared_ptr<const TPostfix> p2 = c.Get("a*(b+c)");
+
+  EXPECT_EQ(p1.get(), p2.get());
+  EXPECT_EQ(1u, c.GetStats().hits);
+  EXPECT_EQ(1u, c.GetStats().entries);
+}
+
+TEST(TShardedPostfixCache, can_be_used_from_many_threads)
+{
+  TShardedPostfixCache c(1 << 22, 8);
+  std::vector<std::thread> workers;
+  std::vector<int> failures(8, 0);
+
+  for (int t = 0; t < 8; t++)
+    workers.push_back(std::thread([&c, &failures, t]()
+    {
+      for (int i = 0; i < 2000; i++)
+      {
+        const int k = (i * 7 + t) % 50;
+        const double x = 2.0;
+        if (c.Get("x*" + std::to_string(k))->Calculate(&x) != 2.0 * k)
+          failures[t]++;
+      }
+    }));
+  for (size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  for (int t = 0; t < 8; t++)
+    EXPECT_EQ(0, failures[t]);
+  TPostfixCache::TStats s = c.GetStats();
+  EXPECT_EQ(50u, s.entries);
+  EXPECT_EQ(16000u, s.hits + s.misses);
+}
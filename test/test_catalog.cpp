@@ -0,0 +1,272 @@
+// тесты для файла скомпилированных выражений
+
+#include "catalog.h"
+#include <gtest.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+std::vector<const TPostfix*> Pointers(const std::vector<TPostfix>& exprs)
+{
+  std::vector<const TPostfix*> res;
+  for (size_t i = 0; i < exprs.size(); i++)
+    res.push_back(&exprs[i]);
+  return res;
+}
+
+// образ открывается, но выражение 0 в нем отвергается при обращении
+bool Rejected(const std::vector<unsigned char>& image)
+{
+  TCompiledCatalog c(&image[0], image.size());
+  try
+  {
+    c.Source(0);
+  }
+  catch (const std::runtime_error&)
+  {
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+TEST(TCompiledCatalog, can_save_and_open_file)
+{
+  std::vector<TPostfix> exprs;
+  exprs.push_back(TPostfix("a+b*2"));
+  exprs.push_back(TPostfix("sin(x)*sin(x)+cos(x)*cos(x)"));
+  const char* path = "test_catalog.bin";
+  TCompiledCatalog::Save(path, Pointers(exprs));
+
+  {
+    TCompiledCatalog c(path);
+    ASSERT_EQ(2u, c.Count());
+    EXPECT_STREQ("a+b*2", c.Source(0));
+    ASSERT_EQ(2u, c.VariableCount(0));
+    EXPECT_STREQ("a", c.Variable(0, 0));
+    EXPECT_STREQ("b", c.Variable(0, 1));
+    const double ab[] = { 1, 3 };
+    EXPECT_DOUBLE_EQ(7.0, c.Calculate(0, ab));
+    const double x[] = { 0.7 };
+    EXPECT_DOUBLE_EQ(1.0, c.Calculate(1, x));
+  }
+  std::remove(path);
+}
+
+TEST(TCompiledCatalog, results_match_interpreter)
+{
+  std::vector<TPostfix> exprs;
+  exprs.push_back(TPostfix("-(a-1.5)/(b+2)"));
+  exprs.push_back(TPostfix("exp(ln(a))*(a+b)*(a+b)"));
+  exprs.push_back(TPostfix("42"));
+  exprs[1].Optimize(OPT_FOLD | OPT_CSE);
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  TCompiledCatalog c(&image[0], image.size());
+
+  const double values[] = { 2.5, 0.25 };
+  for (size_t i = 0; i < exprs.size(); i++)
+    EXPECT_EQ(exprs[i].Calculate(values), c.Calculate(i, values));
+}
+
+TEST(TCompiledCatalog, image_does_not_depend_on_address)
+{
+  std::vector<TPostfix> exprs;
+  exprs.push_back(TPostfix("x*x-3"));
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  // копия по другому адресу с тем же выравниванием
+  std::vector<double> moved(image.size() / sizeof(double) + 1);
+  std::memcpy(&moved[0], &image[0], image.size());
+
+  TCompiledCatalog c(&moved[0], image.size());
+  const double x[] = { 4 };
+
+  EXPECT_DOUBLE_EQ(13.0, c.Calculate(0, x));
+}
+
+TEST(TCompiledCatalog, empty_catalog_is_valid)
+{
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(std::vector<const TPostfix*>());
+  TCompiledCatalog c(&image[0], image.size());
+
+  EXPECT_EQ(0u, c.Count());
+}
+
+TEST(TCompiledCatalog, throws_on_bad_magic)
+{
+  std::vector<TPostfix> exprs(1, TPostfix("a"));
+  std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  image[0] = 'X';
+
+  ASSERT_ANY_THROW(TCompiledCatalog c(&image[0], image.size()));
+}
+
+TEST(TCompiledCatalog, throws_on_other_version)
+{
+  std::vector<TPostfix> exprs(1, TPostfix("a"));
+  std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  image[8] = TCompiledCatalog::VERSION + 1;
+
+  ASSERT_ANY_THROW(TCompiledCatalog c(&image[0], image.size()));
+}
+
+TEST(TCompiledCatalog, throws_on_truncated_image)
+{
+  std::vector<TPostfix> exprs(1, TPostfix("a+b"));
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+
+  ASSERT_ANY_THROW(TCompiledCatalog c(&image[0], image.size() - 8));
+}
+
+TEST(TCompiledCatalog, damaged_bytecode_is_rejected_or_stays_valid)
+{
+  std::vector<TPostfix> exprs(1, TPostfix("a < b ? c * 2 : sin(a)"));
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  TCatalogEntry e;
+  std::memcpy(&e, &image[sizeof(TCatalogHeader)], sizeof(e));
+
+  // каждый байт кода, кроме OP_END, по очереди заменяется значениями,
+  // ломающими операцию или операнд; образ либо отвергается, либо
+  // остается допустимым и вычисляется
+  const unsigned char bytes[] = { 0x00, 0x02, 0x07, 0x0D, 0x7F, 0xFF };
+  const double values[] = { 1, 2, 3 };
+  for (size_t i = 0; i + 1 < e.codeSize; i++)
+    for (size_t b = 0; b < sizeof(bytes); b++)
+    {
+      std::vector<unsigned char> damaged(image);
+      damaged[e.code + i] = bytes[b];
+      try
+      {
+        TCompiledCatalog c(&damaged[0], damaged.size());
+        c.Calculate(0, values);
+      }
+      catch (const std::runtime_error&)
+      {
+      }
+    }
+}
+
+TEST(TCompiledCatalog, throws_on_bad_operands)
+{
+  std::vector<TPostfix> exprs(1, TPostfix("a + 2"));
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  TCatalogEntry e;
+  std::memcpy(&e, &image[sizeof(TCatalogHeader)], sizeof(e));
+  ASSERT_EQ(OP_VAR, image[e.code]);
+  ASSERT_EQ(OP_CONST, image[e.code + 3]);
+
+  std::vector<unsigned char> badVar(image);
+  badVar[e.code + 1] = 1;
+  EXPECT_TRUE(Rejected(badVar));
+
+  std::vector<unsigned char> badConst(image);
+  badConst[e.code + 5] = 1;
+  EXPECT_TRUE(Rejected(badConst));
+
+  // операнд OP_CONST заходит на OP_END
+  std::vector<unsigned char> cut(image);
+  TCatalogEntry shorter = e;
+  shorter.codeSize = 5;
+  cut[e.code + 4] = OP_END;
+  std::memcpy(&cut[sizeof(TCatalogHeader)], &shorter, sizeof(shorter));
+  EXPECT_TRUE(Rejected(cut));
+}
+
+TEST(TCompiledCatalog, throws_on_bad_jump_and_depth)
+{
+  std::vector<TPostfix> exprs(1, TPostfix("a < b ? a : b"));
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  TCatalogEntry e;
+  std::memcpy(&e, &image[sizeof(TCatalogHeader)], sizeof(e));
+  size_t jump = 0;
+  while (image[e.code + jump] != OP_JZ)
+    jump += HasOperand(image[e.code + jump]) ? 3 : 1;
+
+  std::vector<unsigned char> farJump(image);
+  farJump[e.code + jump + 2] = 0x7F;
+  EXPECT_TRUE(Rejected(farJump));
+
+  std::vector<unsigned char> shallow(image);
+  TCatalogEntry small = e;
+  small.depth = 1;
+  std::memcpy(&shallow[sizeof(TCatalogHeader)], &small, sizeof(small));
+  EXPECT_TRUE(Rejected(shallow));
+}
+
+TEST(TCompiledCatalog, throws_on_bad_strings)
+{
+  std::vector<TPostfix> exprs(1, TPostfix("a + b"));
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  TCatalogEntry e;
+  std::memcpy(&e, &image[sizeof(TCatalogHeader)], sizeof(e));
+
+  std::vector<unsigned char> badName(image);
+  const uint64_t outside = image.size();
+  std::memcpy(&badName[e.variables + 8], &outside, sizeof(outside));
+  EXPECT_TRUE(Rejected(badName));
+
+  // в конец файла дописаны байты без нуля, исходный текст начинается там
+  std::vector<unsigned char> unterminated(image);
+  unterminated.resize(image.size() + 8, 'x');
+  const uint64_t size = unterminated.size();
+  std::memcpy(&unterminated[offsetof(TCatalogHeader, size)], &size, sizeof(size));
+  TCatalogEntry tail = e;
+  tail.source = image.size();
+  std::memcpy(&unterminated[sizeof(TCatalogHeader)], &tail, sizeof(tail));
+  EXPECT_TRUE(Rejected(unterminated));
+  tail.source = e.source;
+  std::memcpy(&unterminated[sizeof(TCatalogHeader)], &tail, sizeof(tail));
+  EXPECT_FALSE(Rejected(unterminated));
+}
+
+TEST(TCompiledCatalog, throws_on_oversized_temps)
+{
+  std::vector<TPostfix> exprs(1, TPostfix("(a+b)*(a+b)"));
+  exprs[0].Optimize(OPT_FOLD | OPT_CSE);
+  const std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  TCatalogEntry e;
+  std::memcpy(&e, &image[sizeof(TCatalogHeader)], sizeof(e));
+  ASSERT_EQ(1u, e.temps);
+
+  std::vector<unsigned char> huge(image);
+  TCatalogEntry big = e;
+  big.temps = 0xFFFFFFFFu;
+  std::memcpy(&huge[sizeof(TCatalogHeader)], &big, sizeof(big));
+  EXPECT_TRUE(Rejected(huge));
+
+  big = e;
+  big.depth = 0xFFFFFFFFu;
+  std::memcpy(&huge[sizeof(TCatalogHeader)], &big, sizeof(big));
+  EXPECT_TRUE(Rejected(huge));
+}
+
+TEST(TCompiledCatalog, damaged_expression_does_not_affect_others)
+{
+  std::vector<TPostfix> exprs;
+  exprs.push_back(TPostfix("a + 2"));
+  exprs.push_back(TPostfix("a * 3"));
+  std::vector<unsigned char> image = TCompiledCatalog::Serialize(Pointers(exprs));
+  TCatalogEntry e;
+  std::memcpy(&e, &image[sizeof(TCatalogHeader)], sizeof(e));
+  image[e.code + 1] = 7; // номер переменной
+
+  TCompiledCatalog c(&image[0], image.size());
+  const double a[] = { 2 };
+
+  EXPECT_THROW(c.Calculate(0, a), std::runtime_error);
+  // результат проверки запоминается, но исключение бросается каждый раз
+  EXPECT_THROW(c.Calculate(0, a), std::runtime_error);
+  EXPECT_THROW(c.Variable(0, 0), std::runtime_error);
+  EXPECT_EQ(6.0, c.Calculate(1, a));
+  EXPECT_STREQ("a * 3", c.Source(1));
+}
+
+TEST(TCompiledCatalog, throws_when_file_does_not_exist)
+{
+  ASSERT_ANY_THROW(TCompiledCatalog c("no_such_catalog.bin"));
+}
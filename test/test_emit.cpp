@@ -0,0 +1,182 @@
+// тесты для перевода выражений в исходный текст C++
+
+#include "emit.h"
+#include <gtest.h>
+
+#include <bit>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+TEST(TCppEmitter, literal_is_read_back_to_same_value)
+{
+  const double values[] = { 0.1, 1.0 / 3.0, 2.5, 1e300, 5e-324, 123456789.0 };
+
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    EXPECT_EQ(values[i], std::strtod(CppLiteral(values[i]).c_str(), 0));
+}
+
+TEST(TCppEmitter, literal_is_never_integer)
+{
+  EXPECT_EQ("2.0", CppLiteral(2.0));
+  EXPECT_EQ("-0.0", CppLiteral(-0.0));
+}
+
+TEST(TCppEmitter, literal_of_infinity_and_nan)
+{
+  EXPECT_EQ("std::numeric_limits<double>::infinity()", CppLiteral(1.0 / 0.0));
+  EXPECT_EQ("std::numeric_limits<double>::quiet_NaN()", CppLiteral(std::numeric_limits<double>::quiet_NaN()));
+}
+
+TEST(TCppEmitter, literal_of_nan_keeps_its_bits)
+{
+  const double minusNaN = std::bit_cast<double>(0xFFF8000000000000ULL);
+  const double payload = std::bit_cast<double>(0x7FF0000000000001ULL);
+
+  EXPECT_EQ("std::bit_cast<double>(0xFFF8000000000000ULL)", CppLiteral(minusNaN));
+  EXPECT_EQ("std::bit_cast<double>(0x7FF0000000000001ULL)", CppLiteral(payload));
+}
+
+TEST(TCppEmitter, header_includes_bit_only_for_nan_with_sign)
+{
+  TCppEmitter plain;
+  plain.Add("f", TPostfix("a + 1"));
+  EXPECT_EQ(std::string::npos, plain.Header("F_H", "formulas").find("<bit>"));
+
+  // отрицательный NaN получается сверткой 0 * (-inf)
+  TPostfix p("a + (-0) * (-ln(0))");
+  p.Optimize(OPT_FOLD);
+  const double a = 1.0;
+  const double folded = p.Calculate(&a);
+  ASSERT_TRUE(std::isnan(folded));
+  TCppEmitter e;
+  e.Add("f", p);
+  const std::string h = e.Header("F_H", "formulas");
+  if (std::signbit(folded))
+  {
+    EXPECT_NE(std::string::npos, h.find("#include <bit>"));
+    EXPECT_NE(std::string::npos, h.find("std::bit_cast<double>(0xFFF"));
+  }
+}
+
+TEST(TCppEmitter, emits_operations_in_bytecode_order)
+{
+  TCppEmitter e;
+
+  e.Add("f", TPostfix("a*b+sin(-a)"));
+  const std::string h = e.Header("F_H", "formulas");
+
+  EXPECT_NE(std::string::npos, h.find("struct f_vars\n{\n  double a;\n  double b;\n};"));
+  EXPECT_NE(std::string::npos, h.find("inline double f(const f_vars& v)"));
+  EXPECT_NE(std::string::npos, h.find(
+    "  const double t0 = v.a * v.b;\n"
+    "  const double t1 = -v.a;\n"
+    "  const double t2 = std::sin(t1);\n"
+    "  const double t3 = t0 + t2;\n"
+    "  return t3;\n"));
+}
+
+TEST(TCppEmitter, shared_subexpression_is_computed_once)
+{
+  TPostfix p("(a+b)*(a+b)");
+  p.Optimize(OPT_CSE);
+  TCppEmitter e;
+
+  e.Add("sq", p);
+  const std::string h = e.Header("SQ_H", "formulas");
+
+  EXPECT_NE(std::string::npos, h.find("  const double t0 = v.a + v.b;\n  const double t1 = t0 * t0;\n"));
+}
+
+TEST(TCppEmitter, header_has_guard_and_namespace)
+{
+  TCppEmitter e;
+  e.Add("one", TPostfix("1"));
+
+  const std::string h = e.Header("ONE_H", "ns");
+
+  EXPECT_NE(std::string::npos, h.find("#ifndef ONE_H\n#define ONE_H\n"));
+  EXPECT_NE(std::string::npos, h.find("namespace ns\n{"));
+  EXPECT_NE(std::string::npos, h.find("return 1.0;"));
+  EXPECT_EQ(1u, e.Count());
+}
+
+TEST(TCppEmitter, throws_on_bad_function_name)
+{
+  TCppEmitter e;
+
+  ASSERT_ANY_THROW(e.Add("1f", TPostfix("a")));
+  ASSERT_ANY_THROW(e.Add("", TPostfix("a")));
+  ASSERT_ANY_THROW(e.Add("return", TPostfix("a")));
+}
+
+TEST(TCppEmitter, throws_on_keyword_variable)
+{
+  TCppEmitter e;
+
+  ASSERT_ANY_THROW(e.Add("f", TPostfix("new+1")));
+}
+
+TEST(TCppEmitter, throws_on_duplicate_function)
+{
+  TCppEmitter e;
+  e.Add("f", TPostfix("a"));
+
+  ASSERT_ANY_THROW(e.Add("f", TPostfix("b")));
+}
+
+TEST(TCppEmitter, throws_when_name_collides_with_structure)
+{
+  TCppEmitter e;
+  e.Add("f", TPostfix("a"));
+
+  EXPECT_THROW(e.Add("f_vars", TPostfix("b")), std::invalid_argument);
+  e.Add("g_vars", TPostfix("c"));
+  EXPECT_THROW(e.Add("g", TPostfix("d")), std::invalid_argument);
+  EXPECT_NO_THROW(e.Add("f_vars_vars", TPostfix("b")));
+  EXPECT_EQ(3u, e.Count());
+}
+
+TEST(TCppEmitter, integer_power_is_emitted_as_multiplications)
+{
+  TCppEmitter e;
+
+  e.Add("p5", TPostfix("x^5 + x^0.5"));
+  const std::string h = e.Header("P_H", "formulas");
+
+  EXPECT_NE(std::string::npos, h.find(
+    "  const double t0 = v.x * v.x;\n"
+    "  const double t1 = t0 * t0;\n"
+    "  const double t2 = v.x * t1;\n"
+    "  const double t3 = std::pow(v.x, 0.5);\n"
+    "  const double t4 = t2 + t3;\n"));
+}
+
+TEST(TCppEmitter, conditional_operators_are_emitted_as_if_blocks)
+{
+  TCppEmitter e;
+
+  e.Add("f", TPostfix("x < 2 ? x : y && x"));
+  const std::string h = e.Header("F_H", "formulas");
+
+  EXPECT_NE(std::string::npos, h.find(
+    "  const double t0 = v.x < 2.0 ? 1.0 : 0.0;\n"
+    "  double t1;\n"
+    "  if (t0 != 0.0)\n"
+    "  {\n"
+    "    t1 = v.x;\n"
+    "  }\n"
+    "  else\n"
+    "  {\n"
+    "    double t2 = 0.0;\n"
+    "    if (v.y != 0.0)\n"
+    "    {\n"
+    "      const double t3 = v.x != 0.0 ? 1.0 : 0.0;\n"
+    "      t2 = t3;\n"
+    "    }\n"
+    "    t1 = t2;\n"
+    "  }\n"
+    "  return t1;\n"));
+}
@@ -0,0 +1,113 @@
+// тесты для пула потоков
+
+#include "pool.h"
+#include <gtest.h>
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// каждая задача пишет только в свой элемент
+void Mark(void* context, size_t index)
+{
+  (*static_cast<std::vector<int>*>(context))[index]++;
+}
+
+void RememberThread(void* context, size_t index)
+{
+  (*static_cast<std::vector<std::thread::id>*>(context))[index] = std::this_thread::get_id();
+}
+
+// первые десять задач - часть исполнителя 0 - намного дольше остальных
+void Uneven(void* context, size_t index)
+{
+  if (index < 10)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  Mark(context, index);
+}
+
+void ThrowOnFive(void* context, size_t index)
+{
+  if (index == 5)
+    throw std::runtime_error("task failed");
+  Mark(context, index);
+}
+
+} // namespace
+
+TEST(TThreadPool, zero_workers_means_number_of_cores)
+{
+  TThreadPool pool;
+
+  EXPECT_GE(pool.Workers(), 1u);
+}
+
+TEST(TThreadPool, runs_every_task_exactly_once)
+{
+  TThreadPool pool(4);
+  std::vector<int> done(1000);
+
+  pool.Run(done.size(), Mark, &done);
+
+  for (size_t i = 0; i < done.size(); i++)
+    EXPECT_EQ(1, done[i]) << i;
+}
+
+TEST(TThreadPool, can_run_many_times)
+{
+  TThreadPool pool(3);
+  std::vector<int> done(7);
+
+  for (int r = 0; r < 100; r++)
+    pool.Run(done.size(), Mark, &done);
+
+  for (size_t i = 0; i < done.size(); i++)
+    EXPECT_EQ(100, done[i]) << i;
+}
+
+TEST(TThreadPool, zero_tasks_do_nothing)
+{
+  TThreadPool pool(2);
+
+  ASSERT_NO_THROW(pool.Run(0, Mark, 0));
+}
+
+TEST(TThreadPool, single_worker_is_calling_thread)
+{
+  TThreadPool pool(1);
+  std::vector<std::thread::id> ids(10);
+
+  pool.Run(ids.size(), RememberThread, &ids);
+
+  for (size_t i = 0; i < ids.size(); i++)
+    EXPECT_EQ(std::this_thread::get_id(), ids[i]);
+  EXPECT_EQ(0u, pool.Steals());
+}
+
+TEST(TThreadPool, idle_workers_steal_expensive_tasks)
+{
+  TThreadPool pool(4);
+  std::vector<int> done(40);
+
+  pool.Run(done.size(), Uneven, &done);
+
+  EXPECT_GT(pool.Steals(), 0u);
+  for (size_t i = 0; i < done.size(); i++)
+    EXPECT_EQ(1, done[i]) << i;
+}
+
+TEST(TThreadPool, exception_is_rethrown_after_other_tasks)
+{
+  TThreadPool pool(4);
+  std::vector<int> done(100);
+
+  EXPECT_THROW(pool.Run(done.size(), ThrowOnFive, &done), std::runtime_error);
+
+  for (size_t i = 0; i < done.size(); i++)
+    EXPECT_EQ(i == 5 ? 0 : 1, done[i]) << i;
+  ASSERT_NO_THROW(pool.Run(done.size(), Mark, &done));
+}
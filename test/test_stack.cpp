@@ -1,4 +1,153 @@
-//   
+// тесты для стека
 
 #include "stack.h"
-#include <gtest.h>
\ No newline at end of file
+#include <gtest.h>
+
+TEST(TStack, can_create_stack)
+{
+  ASSERT_NO_THROW(TStack<int> s);
+}
+
+TEST(TStack, new_stack_is_empty)
+{
+  TStack<int> s;
+
+  EXPECT_TRUE(s.IsEmpty());
+  EXPECT_EQ(0u, s.Size());
+}
+
+TEST(TStack, can_create_stack_with_zero_capacity)
+{
+  TStack<int> s(0);
+
+  s.Push(1);
+
+  EXPECT_EQ(1, s.Top());
+}
+
+TEST(TStack, can_push_and_pop_element)
+{
+  TStack<int> s;
+
+  s.Push(5);
+
+  EXPECT_EQ(5, s.Pop());
+  EXPECT_TRUE(s.IsEmpty());
+}
+
+TEST(TStack, pop_returns_elements_in_reverse_order)
+{
+  TStack<int> s;
+
+  s.Push(1);
+  s.Push(2);
+  s.Push(3);
+
+  EXPECT_EQ(3, s.Pop());
+  EXPECT_EQ(2, s.Pop());
+  EXPECT_EQ(1, s.Pop());
+}
+
+TEST(TStack, top_does_not_remove_element)
+{
+  TStack<int> s;
+  s.Push(7);
+
+  EXPECT_EQ(7, s.Top());
+  EXPECT_EQ(1u, s.Size());
+}
+
+TEST(TStack, can_change_top_element)
+{
+  TStack<int> s;
+  s.Push(7);
+
+  s.Top() = 8;
+
+  EXPECT_EQ(8, s.Pop());
+}
+
+TEST(TStack, throws_when_pop_from_empty_stack)
+{
+  TStack<int> s;
+
+  ASSERT_ANY_THROW(s.Pop());
+}
+
+TEST(TStack, throws_when_top_of_empty_stack)
+{
+  TStack<int> s;
+
+  ASSERT_ANY_THROW(s.Top());
+}
+
+TEST(TStack, memory_is_reallocated_when_stack_is_full)
+{
+  TStack<int> s(2);
+
+  for (int i = 0; i < 100; i++)
+    s.Push(i);
+
+  EXPECT_EQ(100u, s.Size());
+  EXPECT_GE(s.Capacity(), 100u);
+  for (int i = 99; i >= 0; i--)
+    EXPECT_EQ(i, s.Pop());
+}
+
+TEST(TStack, can_clear_stack)
+{
+  TStack<int> s;
+  s.Push(1);
+  s.Push(2);
+
+  s.Clear();
+
+  EXPECT_TRUE(s.IsEmpty());
+}
+
+TEST(TStack, copied_stack_is_equal_to_source)
+{
+  TStack<int> s;
+  s.Push(1);
+  s.Push(2);
+
+  TStack<int> c(s);
+
+  EXPECT_EQ(2, c.Pop());
+  EXPECT_EQ(1, c.Pop());
+}
+
+TEST(TStack, copied_stack_has_its_own_memory)
+{
+  TStack<int> s;
+  s.Push(1);
+
+  TStack<int> c(s);
+  c.Push(2);
+  c.Top() = 3;
+
+  EXPECT_EQ(1u, s.Size());
+  EXPECT_EQ(1, s.Top());
+}
+
+TEST(TStack, can_assign_stack)
+{
+  TStack<int> s, c;
+  s.Push(4);
+  c.Push(1);
+  c.Push(2);
+
+  c = s;
+
+  EXPECT_EQ(1u, c.Size());
+  EXPECT_EQ(4, c.Pop());
+}
+
+TEST(TStack, can_assign_stack_to_itself)
+{
+  TStack<int> s;
+  s.Push(4);
+
+  ASSERT_NO_THROW(s = s);
+  EXPECT_EQ(4, s.Top());
+}
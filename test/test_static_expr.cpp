@@ -0,0 +1,131 @@
+// тесты для разбора выражений во время компиляции
+
+#include "static_expr.h"
+#include <gtest.h>
+
+#include <cmath>
+#include <type_traits>
+
+namespace
+{
+
+// одно и то же выражение через ARITH_COMPILE и через TPostfix
+template <class TExpr>
+void ExpectSameAsPostfix(const TExpr& f, const double* values)
+{
+  TPostfix p{ std::string(f.Text()) };
+  ASSERT_EQ(f.VariableCount(), p.GetVariables().size());
+  for (size_t i = 0; i < f.VariableCount(); i++)
+    EXPECT_EQ(p.GetVariables()[i], std::string(f.Variable(i)));
+  EXPECT_EQ(p.Calculate(values), f.Calculate(values)) << f.Text();
+}
+
+} // namespace
+
+TEST(TStaticExpression, can_calculate_expression)
+{
+  const auto f = ARITH_COMPILE("x*x + 2*y");
+
+  EXPECT_EQ(17.0, f(3.0, 4.0));
+}
+
+TEST(TStaticExpression, variables_are_known_at_compile_time)
+{
+  const auto f = ARITH_COMPILE("b*a + b - c");
+  using F = std::decay_t<decltype(f)>;
+
+  static_assert(F::VariableCount() == 3, "three variables");
+  static_assert(F::Variable(0) == "b" && F::Variable(1) == "a" && F::Variable(2) == "c", "order of appearance");
+  static_assert(F::Depth() == 2, "stack depth");
+}
+
+TEST(TStaticExpression, constant_expression_has_no_variables)
+{
+  const auto f = ARITH_COMPILE("-(1.5 + 2) * 4");
+
+  EXPECT_EQ(-14.0, f());
+}
+
+TEST(TStaticExpression, gives_same_results_as_postfix)
+{
+  const double values[] = { 1.25, -0.5, 3.0, 0.75 };
+
+  ExpectSameAsPostfix(ARITH_COMPILE("a"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("-(a+b)*c/(d-2)"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("sin(a)*cos(b)+ln(c)-exp(-d)"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("a-b-c-d"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("a/(b/(c/d))"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("-a*b + c"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE(" ( ( a ) ) * exp ( b ) "), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("a^3 - b^2^2 + c^0.5 + 2^a^2"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("-a^2 * d^2.000000000000000000000 + c^(-2)"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("a < b ? c : d <= a ? a == a : 2"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("(a < 0 || b < 0) && c + d"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("a ? (b ? c : d) : sin(b) && ln(b)"), values);
+}
+
+TEST(TStaticExpression, numbers_match_postfix_exactly)
+{
+  const double values[] = { 1.0 };
+
+  ExpectSameAsPostfix(ARITH_COMPILE("0.1 + a"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("1e-5 * 3.3e+7"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE(".5 + 2. + 0.000"), values);
+  // не помещаются в быстрый путь: значение берется из strtod
+  ExpectSameAsPostfix(ARITH_COMPILE("3.14159265358979323846264338 * a"), values);
+  ExpectSameAsPostfix(ARITH_COMPILE("1e300 * 1e-250"), values);
+}
+
+TEST(TStaticExpression, parse_reports_errors_like_postfix)
+{
+  const char* exprs[] = { "", "a+", "(a", "a)", "a b", "-a*-b", "sin a", "()", "a # b", ".",
+    "a ? b", "a : b", "(a ? b) : c", "a & b", "a = b", "a ? : b" };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+  {
+    const TPostfix::TCheckResult check = TPostfix::Check(exprs[i]);
+    try
+    {
+      arith::Parse<16>(exprs[i]);
+      ADD_FAILURE() << exprs[i];
+    }
+    catch (const TExpressionError& e)
+    {
+      EXPECT_EQ(check.pos, e.Position()) << exprs[i];
+      EXPECT_STREQ(check.message, e.what()) << exprs[i];
+    }
+  }
+}
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+TEST(TStaticExpression, can_compile_string_literal_template_argument)
+{
+  const auto f = arith::compile<"x*x + 2*y">();
+  const double values[] = { 3.0, 4.0 };
+
+  EXPECT_EQ(17.0, f(3.0, 4.0));
+  EXPECT_EQ(TPostfix("x*x + 2*y").Calculate(values), f.Calculate(values));
+}
+
+#endif
+
+TEST(TStaticExpression, integer_exponent_is_not_pushed)
+{
+  const auto f = ARITH_COMPILE("x^2");
+  using F = std::decay_t<decltype(f)>;
+
+  static_assert(F::Depth() == 1, "exponent is folded into the operation");
+  EXPECT_EQ(9.0, f(3.0));
+}
+
+TEST(TStaticExpression, conditional_operators_select_branch)
+{
+  const auto f = ARITH_COMPILE("x < 0 ? 0 : ln(x)");
+  const auto g = ARITH_COMPILE("x == 0 || 1 / x < 2");
+
+  EXPECT_EQ(0.0, f(-1.0));
+  EXPECT_EQ(std::log(2.0), f(2.0));
+  EXPECT_EQ(1.0, g(0.0));
+  EXPECT_EQ(0.0, g(0.25));
+}
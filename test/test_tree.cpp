@@ -0,0 +1,219 @@
+// тесты для дерева выражения
+
+#include "tree.h"
+#include <gtest.h>
+
+#include <cmath>
+
+TEST(TExprTree, can_build_tree_from_program)
+{
+  TPostfix p("a*(b+c)");
+
+  TExprTree t(p.GetProgram(), 0);
+
+  EXPECT_EQ(5u, t.Size());
+  EXPECT_EQ(OP_MUL, t.Node(t.Root()).op);
+}
+
+TEST(TExprTree, children_are_created_before_parent)
+{
+  TPostfix p("-(a+b)*sin(c/d)");
+
+  TExprTree t(p.GetProgram(), 0);
+
+  for (unsigned int i = 0; i < t.Size(); i++)
+  {
+    if (t.Node(i).left != TExprTree::NO_NODE)
+    {
+      EXPECT_LT(t.Node(i).left, i);
+    }
+    if (t.Node(i).right != TExprTree::NO_NODE)
+    {
+      EXPECT_LT(t.Node(i).right, i);
+    }
+  }
+}
+
+TEST(TExprTree, emit_without_passes_gives_same_program)
+{
+  TPostfix p("-(a+2)*sin(b/2)");
+
+  TProgram prog = TExprTree(p.GetProgram(), 0).Emit();
+
+  EXPECT_EQ(p.GetProgram().code, prog.code);
+  EXPECT_EQ(p.GetProgram().constants, prog.constants);
+}
+
+TEST(TExprTree, folds_constants)
+{
+  TPostfix p("(2+3)*4 - exp(0)");
+
+  TExprTree t(p.GetProgram(), OPT_FOLD);
+
+  EXPECT_EQ(OP_CONST, t.Node(t.Root()).op);
+  EXPECT_EQ(19.0, t.Node(t.Root()).value);
+  EXPECT_EQ(1u, t.Reachable());
+}
+
+TEST(TExprTree, removes_identity_operations)
+{
+  TPostfix p("(a*1 + (-0))/1 - 0 + 1*((-0)+b)");
+
+  TExprTree t(p.GetProgram(), OPT_FOLD);
+
+  EXPECT_EQ(3u, t.Reachable());
+}
+
+TEST(TExprTree, keeps_additions_that_change_sign_of_zero)
+{
+  // при a = -0: a + 0 = +0, a - (-0) = +0
+  TPostfix p("1/(a + 0) + 1/(0 + a) + 1/(a - (-0))");
+  const double minusZero = -0.0;
+  const double before = p.Calculate(&minusZero);
+  ASSERT_EQ(INFINITY, before);
+
+  p.Optimize(OPT_FOLD);
+
+  EXPECT_EQ(before, p.Calculate(&minusZero));
+}
+
+TEST(TExprTree, removes_double_negation)
+{
+  TPostfix p("-(-a)");
+
+  TExprTree t(p.GetProgram(), OPT_FOLD);
+
+  EXPECT_EQ(OP_VAR, t.Node(t.Root()).op);
+}
+
+TEST(TExprTree, does_not_replace_difference_of_equal_operands)
+{
+  TPostfix p("a-a");
+
+  TExprTree t(p.GetProgram(), OPT_FOLD);
+
+  EXPECT_EQ(OP_SUB, t.Node(t.Root()).op);
+}
+
+TEST(TExprTree, folds_subtrees_of_partially_constant_expression)
+{
+  TPostfix p("a*(2*3) + (1-1)*b");
+
+  TExprTree t(p.GetProgram(), OPT_FOLD);
+
+  // (1-1)*b не сворачивается: 0*b - NaN при бесконечном b
+  EXPECT_EQ(7u, t.Reachable());
+}
+
+TEST(TExprTree, equal_subtrees_become_one_node)
+{
+  TPostfix p("(a+b)*(a+b)/(a+b)");
+
+  TExprTree t(p.GetProgram(), OPT_CSE);
+
+  EXPECT_EQ(5u, t.Reachable());
+  EXPECT_EQ(6u, t.Shared());
+}
+
+TEST(TExprTree, operands_order_matters_for_sharing)
+{
+  TPostfix p("(a-b)*(b-a)");
+
+  TExprTree t(p.GetProgram(), OPT_CSE);
+
+  EXPECT_EQ(5u, t.Reachable());
+}
+
+TEST(TExprTree, shared_subexpression_is_computed_once)
+{
+  TPostfix p("(a+b)*(a+b)/(a+b)");
+
+  TProgram prog = TExprTree(p.GetProgram(), OPT_CSE).Emit();
+
+  size_t adds = 0, loads = 0;
+  for (size_t i = 0; prog.code[i] != OP_END; i += HasOperand(prog.code[i]) ? 3 : 1)
+  {
+    adds += prog.code[i] == OP_ADD;
+    loads += prog.code[i] == OP_LOAD;
+  }
+  EXPECT_EQ(1u, adds);
+  EXPECT_EQ(2u, loads);
+  EXPECT_EQ(1u, prog.temps);
+}
+
+TEST(TExprTree, can_rebuild_tree_from_program_with_temps)
+{
+  TPostfix p("sin(a*b) + sin(a*b)*c");
+  TProgram prog = TExprTree(p.GetProgram(), OPT_CSE).Emit();
+
+  TExprTree t(prog, OPT_CSE);
+
+  EXPECT_EQ(7u, t.Reachable());
+  EXPECT_EQ(prog.code, t.Emit().code);
+}
+
+TEST(TExprTree, folding_and_sharing_work_together)
+{
+  TPostfix p("(a*(1+1)) - (a*2)*1");
+
+  TExprTree t(p.GetProgram(), OPT_FOLD | OPT_CSE);
+
+  EXPECT_EQ(4u, t.Reachable());
+}
+
+TEST(TExprTree, appended_expressions_share_nodes)
+{
+  TPostfix p("(a+b)*c");
+  TPostfix q("c - (b+a)");
+  TPostfix r("x + (a+b)"); // переменные x, a, b
+  TExprTree t(OPT_CSE);
+  std::vector<unsigned int> slots;
+  t.Append(p.GetProgram(), slots);
+  slots.push_back(2);
+  slots.push_back(1);
+  slots.push_back(0);
+  t.Append(q.GetProgram(), slots);
+  slots[0] = 3;
+  slots[1] = 0;
+  slots[2] = 1;
+
+  t.Append(r.GetProgram(), slots);
+
+  ASSERT_EQ(3u, t.Roots().size());
+  // a, b, c, x, a+b, (a+b)*c, b+a, c-(b+a), x+(a+b)
+  EXPECT_EQ(9u, t.Reachable());
+  EXPECT_EQ(OP_VAR, t.Node(t.Node(t.Roots()[1]).left).op);
+  EXPECT_EQ(2u, t.Node(t.Node(t.Roots()[1]).left).slot);
+}
+
+TEST(TExprTree, emit_of_several_expressions_stores_shared_nodes_once)
+{
+  TPostfix p("sin(a) * 2");
+  TPostfix q("sin(a) + 1");
+  TExprTree t(OPT_CSE);
+  t.Append(p.GetProgram(), std::vector<unsigned int>());
+  t.Append(q.GetProgram(), std::vector<unsigned int>());
+  t.Append(p.GetProgram(), std::vector<unsigned int>());
+  std::vector<size_t> ends;
+
+  TProgram prog = t.Emit(&ends);
+
+  ASSERT_EQ(3u, ends.size());
+  EXPECT_EQ(prog.code.size() - 1, ends[2]);
+  EXPECT_EQ(OP_LOAD, prog.code[ends[1]]); // третье - то же, что первое
+  size_t sines = 0;
+  for (size_t i = 0; prog.code[i] != OP_END; i += HasOperand(prog.code[i]) ? 3 : 1)
+    sines += prog.code[i] == OP_SIN;
+  EXPECT_EQ(1u, sines);
+  EXPECT_EQ(2u, prog.temps);
+}
+
+TEST(TExprTree, emit_of_several_expressions_needs_ends)
+{
+  TPostfix p("a");
+  TExprTree t(0);
+  t.Append(p.GetProgram(), std::vector<unsigned int>());
+  t.Append(p.GetProgram(), std::vector<unsigned int>());
+
+  ASSERT_ANY_THROW(t.Emit());
+}